@@ -0,0 +1,550 @@
+/**
+ * @file smc_bench.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Benchmark - client response path without network
+ *
+ * Builds synthetic responses in memory and feeds them to the receiver of
+ * libsmc (smc_receive() in smc_response.c) either from a memfd or through a socketpair written by a
+ * second thread. The files of the response are stored in a scratch directory.
+ * Linked with --wrap for malloc(), calloc() and realloc(), so allocations of
+ * the response path are counted. Prints one key=value line per scenario,
+ * transport and format (text, binary of protocol version 2, checksum of
+ * version 3):
+ *
+ *     scenario=small transport=memory format=text files=1000 file_bytes=100
+ *     response_bytes=118899 iterations=10 bytes_per_s=... allocs_per_response=0.0
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <endian.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "libsmc.h"
+#include "crc32c.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define DEFAULT_ITERATIONS 10
+#define DEFAULT_HUGE_MB 64
+#define DEFAULT_SCENARIOS "small,huge,longnames"
+#define DEFAULT_TRANSPORTS "memory,socketpair"
+#define DEFAULT_FORMATS "text,binary,checksum"
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//shape of a synthetic response
+struct scenario
+{
+    const char *name;
+    long files;
+    long file_bytes;    //0 = -H megabytes
+    int name_len;
+};
+
+//a response as it comes from the server
+struct stream
+{
+    char *data;
+    size_t len;
+};
+
+//what the writer thread of the socketpair transport sends where
+struct feed_arg
+{
+    const struct stream *st;
+    int fd;
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+static const char *sprogram_arg0 = NULL;
+
+static const struct scenario scenarios[] = {
+    {"small", 1000, 100, 8},
+    {"huge", 2, 0, 8},
+    {"longnames", 200, 1024, SMC_NAME_MAX - 1},
+};
+
+//counted by the --wrap functions below
+static unsigned long alloc_count = 0;
+static unsigned long long alloc_bytes = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+static void usage(void);
+static int listed(const char *list, const char *name);
+static int build_stream(const struct scenario *sc, long file_bytes, int version, struct stream *st);
+static int run(const struct stream *st, int socketpair_transport, int version, long iterations, double *elapsed);
+static void *feed(void *arg);
+static double now_s(void);
+
+/**
+ *
+ * \brief Main Program logic
+ *
+ * \param argc the number of arguments
+ * \param argv the arguments
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS returned on success
+ * \retval EXIT_FAILURE returned on error
+ *
+ */
+
+int main(int argc, char *argv[])
+{
+    const char *selected = DEFAULT_SCENARIOS;
+    const char *transports = DEFAULT_TRANSPORTS;
+    const char *formats = DEFAULT_FORMATS;
+    const char *dir = NULL;
+    char scratch[] = "/tmp/smc_bench.XXXXXX";
+    long iterations = DEFAULT_ITERATIONS;
+    long huge_mb = DEFAULT_HUGE_MB;
+    int state = EXIT_SUCCESS;
+    char *end;
+    int c;
+
+    sprogram_arg0 = argv[0];
+
+    while ((c = getopt(argc, argv, "n:H:s:t:f:d:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            iterations = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || iterations <= 0)
+                usage();
+            break;
+        case 'H':
+            huge_mb = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || huge_mb <= 0)
+                usage();
+            break;
+        case 's':
+            selected = optarg;
+            break;
+        case 't':
+            transports = optarg;
+            break;
+        case 'f':
+            formats = optarg;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    //the response path stores files in the working directory
+    if (dir == NULL && (dir = mkdtemp(scratch)) == NULL)
+    {
+        fprintf(stderr, "%s: Could not create a scratch directory: %s\n", sprogram_arg0, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (chdir(dir) == -1)
+    {
+        fprintf(stderr, "%s: Could not change to \"%s\": %s\n", sprogram_arg0, dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        const struct scenario *sc = &scenarios[i];
+        long file_bytes = sc->file_bytes > 0 ? sc->file_bytes : huge_mb << 20;
+
+        if (!listed(selected, sc->name))
+            continue;
+
+        for (int version = PROTO_VERSION_TEXT; version <= PROTO_VERSION_CRC; version++)
+        {
+            const char *format = version == PROTO_VERSION_CRC ? "checksum" : version == PROTO_VERSION_BINARY ? "binary" : "text";
+            struct stream st;
+
+            if (!listed(formats, format))
+                continue;
+            if (build_stream(sc, file_bytes, version, &st) == -1)
+                return EXIT_FAILURE;
+
+            for (int sp = 0; sp <= 1; sp++)
+            {
+                const char *transport = sp ? "socketpair" : "memory";
+                unsigned long allocs;
+                unsigned long long bytes;
+                double elapsed;
+
+                if (!listed(transports, transport))
+                    continue;
+
+                alloc_count = 0;
+                alloc_bytes = 0;
+                if (run(&st, sp, version >= PROTO_VERSION_BINARY ? version : 0, iterations, &elapsed) == -1)
+                {
+                    fprintf(stderr, "%s: Scenario %s failed with %s over %s\n", sprogram_arg0, sc->name, format, transport);
+                    state = EXIT_FAILURE;
+                    continue;
+                }
+                allocs = alloc_count;
+                bytes = alloc_bytes;
+
+                printf("scenario=%s transport=%s format=%s files=%ld file_bytes=%ld response_bytes=%zu "
+                       "iterations=%ld bytes_per_s=%.0f allocs_per_response=%.1f alloc_bytes_per_response=%.1f\n",
+                       sc->name, transport, format, sc->files, file_bytes, st.len, iterations,
+                       elapsed > 0 ? st.len * iterations / elapsed : 0,
+                       (double)allocs / iterations, (double)bytes / iterations);
+                fflush(stdout);
+            }
+            free(st.data);
+        }
+    }
+
+    //the scratch directory is ours, the files in it are overwritten by every iteration
+    if (dir == scratch)
+    {
+        for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        {
+            for (long f = 0; f < scenarios[i].files; f++)
+            {
+                char name[SMC_NAME_MAX];
+                snprintf(name, sizeof(name), "%0*ld", scenarios[i].name_len, f);
+                unlink(name);
+            }
+        }
+        if (chdir("/") == 0)
+            rmdir(scratch);
+    }
+    return state;
+}
+
+/**
+ *
+ * \brief prints the usage and terminates the program
+ *
+ */
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage:\n%s [-n iterations] [-H mb] [-s scenarios] [-t transports] [-f formats] [-d dir] [-h]\n"
+                    "\t-n responses per scenario, transport and format (default %d)\n"
+                    "\t-H file size of scenario huge in MB (default %d)\n"
+                    "\t-s scenarios (default %s)\n"
+                    "\t-t transports (default %s)\n"
+                    "\t-f response formats (default %s)\n"
+                    "\t-d directory for the received files (default a temporary one)\n",
+            sprogram_arg0, DEFAULT_ITERATIONS, DEFAULT_HUGE_MB, DEFAULT_SCENARIOS, DEFAULT_TRANSPORTS, DEFAULT_FORMATS);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ * \brief checks whether a comma separated list contains a name
+ *
+ * \param list the list
+ * \param name the name
+ *
+ * \return 1 if it does, 0 otherwise
+ *
+ */
+
+static int listed(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+
+    for (const char *p = list; (p = strstr(p, name)) != NULL; p += len)
+    {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief builds a response in the text or the protocol version 2 or 3 format
+ *
+ * \param sc the scenario
+ * \param file_bytes size of every file
+ * \param version PROTO_VERSION_BINARY or PROTO_VERSION_CRC for a frame, PROTO_VERSION_TEXT for the text response
+ * \param st receives the response, allocated with malloc()
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int build_stream(const struct scenario *sc, long file_bytes, int version, struct stream *st)
+{
+    int binary = version >= PROTO_VERSION_BINARY;
+    size_t per_file = binary ? PROTO_BIN_FILE_HEADER + PROTO_BIN_FILE_TRAILER + (size_t)sc->name_len
+                             : strlen("file=\nlen=\n") + sc->name_len + 20;
+    size_t cap = PROTO_FRAME_HEADER + PROTO_BIN_HEADER + strlen("status=0\n") +
+                 sc->files * (per_file + file_bytes);
+    char *p;
+
+    if ((st->data = malloc(cap)) == NULL)
+    {
+        fprintf(stderr, "%s: Could not allocate %zu bytes\n", sprogram_arg0, cap);
+        return -1;
+    }
+    p = st->data;
+
+    if (binary)
+    {
+        uint32_t u32;
+
+        p += PROTO_FRAME_HEADER;
+        u32 = htonl(0);
+        memcpy(p, &u32, sizeof(u32));
+        u32 = htonl((uint32_t)sc->files);
+        memcpy(p + sizeof(u32), &u32, sizeof(u32));
+        p += PROTO_BIN_HEADER;
+    }
+    else
+        p += sprintf(p, "status=0\n");
+
+    for (long f = 0; f < sc->files; f++)
+    {
+        char name[SMC_NAME_MAX];
+
+        snprintf(name, sizeof(name), "%0*ld", sc->name_len, f);
+        if (binary)
+        {
+            uint16_t name_len = htons((uint16_t)sc->name_len);
+            uint64_t len = htobe64((uint64_t)file_bytes);
+
+            memcpy(p, &name_len, sizeof(name_len));
+            memcpy(p + sizeof(name_len), &len, sizeof(len));
+            memcpy(p + PROTO_BIN_FILE_HEADER, name, sc->name_len);
+            p += PROTO_BIN_FILE_HEADER + sc->name_len;
+        }
+        else
+            p += sprintf(p, "file=%s\nlen=%ld\n", name, file_bytes);
+        memset(p, 'x', file_bytes);
+        p += file_bytes;
+        if (version >= PROTO_VERSION_CRC)
+        {
+            uint32_t crc = htonl(crc32c(p - file_bytes, file_bytes));
+
+            memcpy(p, &crc, sizeof(crc));
+            p += sizeof(crc);
+        }
+    }
+
+    st->len = p - st->data;
+    if (binary)
+    {
+        uint32_t frame_len = htonl((uint32_t)(st->len - PROTO_FRAME_HEADER));
+        memcpy(st->data, &frame_len, sizeof(frame_len));
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief feeds the response to smc_receive() repeatedly
+ *
+ * \param st the response
+ * \param socketpair_transport 1 to send it through a socketpair, 0 to read it from a memfd
+ * \param version protocol version of the response, 0 for plain text
+ * \param iterations number of responses
+ * \param elapsed receives the seconds spent in smc_receive()
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int run(const struct stream *st, int socketpair_transport, int version, long iterations, double *elapsed)
+{
+    static struct smc_receiver rx;
+    int memfd = -1;
+    int result = 1;
+
+    *elapsed = 0;
+    if (!socketpair_transport &&
+        ((memfd = memfd_create("smc_bench", MFD_CLOEXEC)) == -1 || smc_write_all(memfd, st->data, st->len) == -1))
+    {
+        fprintf(stderr, "%s: Could not fill memfd: %s\n", sprogram_arg0, strerror(errno));
+        if (memfd != -1)
+            close(memfd);
+        return -1;
+    }
+
+    smc_receiver_init(&rx, version, SMC_FILES_DISK, AT_FDCWD, -1, NULL);
+    for (long i = 0; i < iterations && result == 1; i++)
+    {
+        struct feed_arg arg = {st, -1};
+        pthread_t writer;
+        int sv[2];
+        int err;
+        double start;
+
+        if (socketpair_transport)
+        {
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+            {
+                fprintf(stderr, "%s: socketpair failed: %s\n", sprogram_arg0, strerror(errno));
+                return -1;
+            }
+            arg.fd = sv[1];
+            if ((err = pthread_create(&writer, NULL, feed, &arg)) != 0)
+            {
+                fprintf(stderr, "%s: Could not start writer: %s\n", sprogram_arg0, strerror(err));
+                close(sv[0]);
+                close(sv[1]);
+                return -1;
+            }
+        }
+        else
+            lseek(memfd, 0, SEEK_SET);
+
+        start = now_s();
+        smc_receiver_start(&rx, NULL, NULL);
+        result = smc_receive(&rx, socketpair_transport ? sv[0] : memfd);
+        *elapsed += now_s() - start;
+        if (result == -1)
+            fprintf(stderr, "%s: %s\n", sprogram_arg0, rx.error);
+
+        if (socketpair_transport)
+        {
+            //unblocks the writer if the response was not read completely
+            close(sv[0]);
+            pthread_join(writer, NULL);
+        }
+    }
+    smc_receiver_destroy(&rx);
+    if (memfd != -1)
+        close(memfd);
+    return result == 1 ? 0 : -1;
+}
+
+/**
+ *
+ * \brief writer thread of the socketpair transport
+ *
+ * \param arg the response and the descriptor, closed when done
+ *
+ * \return always NULL
+ *
+ */
+
+static void *feed(void *arg)
+{
+    struct feed_arg *fa = arg;
+
+    (void)smc_write_all(fa->fd, fa->st->data, fa->st->len);
+    close(fa->fd);
+    return NULL;
+}
+
+/**
+ *
+ * \brief monotonic clock in seconds
+ *
+ * \return current time in seconds
+ *
+ */
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ *
+ * \brief counts malloc() calls of the linked client objects
+ *
+ * \param size passed on
+ *
+ * \return see malloc()
+ *
+ */
+
+void *__wrap_malloc(size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+/**
+ *
+ * \brief counts calloc() calls of the linked client objects
+ *
+ * \param nmemb passed on
+ * \param size passed on
+ *
+ * \return see calloc()
+ *
+ */
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += nmemb * size;
+    return __real_calloc(nmemb, size);
+}
+
+/**
+ *
+ * \brief counts realloc() calls of the linked client objects
+ *
+ * \param ptr passed on
+ * \param size passed on
+ *
+ * \return see realloc()
+ *
+ */
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+/*
+ * =================================================================== eof ==
+ */
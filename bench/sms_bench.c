@@ -0,0 +1,594 @@
+/**
+ * @file sms_bench.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Benchmark - end-to-end loopback benchmark of simple_message_server
+ *
+ * For every launch mode and concurrency level: starts the server on a
+ * loopback port, runs the client's load generator against it and reads the
+ * server's CPU time and peak resident set from /proc. Every run becomes one
+ * key=value line in the report:
+ *
+ *     mode=exec connections=8 requests=2000 errors=0 elapsed_s=1.234
+ *     conn_per_s=1620.7 p50_us=4100 p99_us=9800 cpu_us_per_req=410.2 rss_kb=5120
+ *
+ * (one line). Each request is a connection of its own, so conn_per_s is also
+ * the request rate. CPU time covers the server, its worker processes and
+ * every business logic process they reaped. rss_kb only adds up the peak
+ * resident sets of the server and of the processes still alive when the run
+ * ends (acceptors, warm workers); business logic processes reaped during the
+ * run are not in it, their peaks are in sms_child_max_rss_bytes on the stats
+ * socket (-s).
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define DEFAULT_MODES "exec,spawn,pool,plugin"
+#define DEFAULT_CONNECTIONS "1,8,32"
+#define DEFAULT_REQUESTS 2000
+#define DEFAULT_PORT "5099"
+#define STARTUP_TIMEOUT_MS 5000
+#define PROC_PATH_MAX 64
+#define OUTPUT_MAX 1024
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//what one run measured
+struct bench_result
+{
+    unsigned long requests;
+    unsigned long errors;
+    double elapsed;
+    double rps;
+    unsigned long long p50;
+    unsigned long long p99;
+    double cpu_us;
+    long rss_kb;
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+static const char *sprogram_arg0 = NULL;
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void usage(void);
+static int run_one(const char *server, const char *client, const char *plugin, const char *port,
+                   const char *mode, long connections, long requests, struct bench_result *res);
+static pid_t start_server(const char *server, const char *plugin, const char *port, const char *mode);
+static int wait_for_port(const char *port);
+static int run_client(const char *client, const char *port, long connections, long requests, struct bench_result *res);
+static long long tree_cpu_ticks(pid_t pid);
+static long tree_rss_kb(pid_t pid);
+static int for_each_child(pid_t pid, void (*fn)(pid_t child, void *arg), void *arg);
+static void add_cpu(pid_t child, void *arg);
+static void add_rss(pid_t child, void *arg);
+
+/**
+ *
+ * \brief Main Program logic
+ *
+ * \param argc the number of arguments
+ * \param argv the arguments
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS returned on success
+ * \retval EXIT_FAILURE returned on error
+ *
+ */
+
+int main(int argc, char *argv[])
+{
+    const char *server = NULL;
+    const char *client = NULL;
+    const char *plugin = NULL;
+    const char *modes = DEFAULT_MODES;
+    const char *levels = DEFAULT_CONNECTIONS;
+    const char *port = DEFAULT_PORT;
+    const char *report_path = NULL;
+    long requests = DEFAULT_REQUESTS;
+    FILE *report = NULL;
+    int state = EXIT_SUCCESS;
+    char *end;
+    int c;
+
+    sprogram_arg0 = argv[0];
+
+    while ((c = getopt(argc, argv, "s:c:l:m:n:r:p:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            server = optarg;
+            break;
+        case 'c':
+            client = optarg;
+            break;
+        case 'l':
+            plugin = optarg;
+            break;
+        case 'm':
+            modes = optarg;
+            break;
+        case 'n':
+            levels = optarg;
+            break;
+        case 'r':
+            requests = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || requests <= 0)
+                usage();
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'o':
+            report_path = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (server == NULL || client == NULL)
+        usage();
+
+    if (report_path != NULL && (report = fopen(report_path, "w")) == NULL)
+    {
+        fprintf(stderr, "%s: Could not open \"%s\": %s\n", sprogram_arg0, report_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    //the server's business logic may write to clients that are gone
+    signal(SIGPIPE, SIG_IGN);
+
+    for (const char *m = modes; *m != '\0';)
+    {
+        size_t mode_len = strcspn(m, ",");
+        char mode[16];
+
+        if (mode_len == 0 || mode_len >= sizeof(mode))
+            usage();
+        memcpy(mode, m, mode_len);
+        mode[mode_len] = '\0';
+        m += m[mode_len] == ',' ? mode_len + 1 : mode_len;
+
+        if (strcmp(mode, "plugin") == 0 && plugin == NULL)
+        {
+            fprintf(stderr, "%s: Launch mode plugin needs -l\n", sprogram_arg0);
+            state = EXIT_FAILURE;
+            continue;
+        }
+
+        for (const char *l = levels; *l != '\0';)
+        {
+            struct bench_result res;
+            long connections = strtol(l, &end, 10);
+
+            if (end == l || connections <= 0 || (*end != ',' && *end != '\0'))
+                usage();
+            l = *end == ',' ? end + 1 : end;
+
+            if (run_one(server, client, plugin, port, mode, connections, requests, &res) < 0)
+            {
+                state = EXIT_FAILURE;
+                continue;
+            }
+            for (FILE *out = stdout; out != NULL; out = out == stdout ? report : NULL)
+            {
+                fprintf(out, "mode=%s connections=%ld requests=%lu errors=%lu elapsed_s=%.3f conn_per_s=%.1f "
+                             "p50_us=%llu p99_us=%llu cpu_us_per_req=%.1f rss_kb=%ld\n",
+                        mode, connections, res.requests, res.errors, res.elapsed, res.rps,
+                        res.p50, res.p99, res.requests > 0 ? res.cpu_us / res.requests : 0, res.rss_kb);
+                fflush(out);
+            }
+            if (res.errors > 0)
+                state = EXIT_FAILURE;
+        }
+    }
+
+    if (report != NULL && fclose(report) != 0)
+    {
+        fprintf(stderr, "%s: Writing \"%s\" failed: %s\n", sprogram_arg0, report_path, strerror(errno));
+        state = EXIT_FAILURE;
+    }
+    return state;
+}
+
+/**
+ *
+ * \brief prints the usage and terminates the program
+ *
+ */
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage:\n%s -s server -c client [-l plugin.so] [-m modes] [-n connections] [-r requests]\n"
+                    "\t[-p port] [-o report] [-h]\n"
+                    "\t-s simple_message_server to benchmark\n"
+                    "\t-c simple_message_client driving the load\n"
+                    "\t-l business logic plugin for launch mode plugin\n"
+                    "\t-m launch modes (default %s)\n"
+                    "\t-n concurrent connections (default %s)\n"
+                    "\t-r requests per run (default %d)\n"
+                    "\t-p loopback port (default %s)\n"
+                    "\t-o also write the report to this file\n",
+            sprogram_arg0, DEFAULT_MODES, DEFAULT_CONNECTIONS, DEFAULT_REQUESTS, DEFAULT_PORT);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ * \brief benchmarks one launch mode at one concurrency level
+ *
+ * \param server the server program
+ * \param client the client program
+ * \param plugin the plugin for launch mode plugin, may be NULL
+ * \param port loopback port
+ * \param mode launch mode of the server
+ * \param connections concurrent connections of the load generator
+ * \param requests requests of the run
+ * \param res receives the results
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int run_one(const char *server, const char *client, const char *plugin, const char *port,
+                   const char *mode, long connections, long requests, struct bench_result *res)
+{
+    long ticks = sysconf(_SC_CLK_TCK);
+    long long cpu_start;
+    pid_t pid;
+    int result;
+
+    if ((pid = start_server(server, plugin, port, mode)) < 0)
+        return -1;
+    if (wait_for_port(port) < 0)
+    {
+        fprintf(stderr, "%s: Server (mode %s) did not start listening\n", sprogram_arg0, mode);
+        kill(-pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    cpu_start = tree_cpu_ticks(pid);
+    result = run_client(client, port, connections, requests, res);
+    res->cpu_us = (tree_cpu_ticks(pid) - cpu_start) * 1e6 / ticks;
+    res->rss_kb = tree_rss_kb(pid);
+
+    //the server and its workers share a process group
+    kill(-pid, SIGTERM);
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+    return result;
+}
+
+/**
+ *
+ * \brief starts the server in a process group of its own
+ *
+ * \param server the server program
+ * \param plugin the plugin for launch mode plugin, may be NULL
+ * \param port loopback port
+ * \param mode launch mode
+ *
+ * \return the process id or -1 on error
+ *
+ */
+
+static pid_t start_server(const char *server, const char *plugin, const char *port, const char *mode)
+{
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        fprintf(stderr, "%s: fork failed: %s\n", sprogram_arg0, strerror(errno));
+        return -1;
+    }
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        setpgid(0, 0);
+        //the server reports every connection on stdout
+        if (null_fd >= 0)
+            dup2(null_fd, STDOUT_FILENO);
+        signal(SIGPIPE, SIG_DFL);
+        if (strcmp(mode, "plugin") == 0)
+            execl(server, server, "-p", port, "-m", mode, "-l", plugin, (char *)NULL);
+        else
+            execl(server, server, "-p", port, "-m", mode, (char *)NULL);
+        fprintf(stderr, "%s: Could not start %s: %s\n", sprogram_arg0, server, strerror(errno));
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    return pid;
+}
+
+/**
+ *
+ * \brief waits until the server accepts connections on the loopback port
+ *
+ * The probe is an empty request whose response is read, so the business logic
+ * does not fail on a client that is gone.
+ *
+ * \param port the port
+ *
+ * \return 0 once a connection succeeded, -1 on timeout
+ *
+ */
+
+static int wait_for_port(const char *port)
+{
+    struct sockaddr_in addr;
+    struct timespec pause = {0, 10 * 1000 * 1000};
+    struct timeval timeout = {STARTUP_TIMEOUT_MS / 1000, 0};
+    char buf[OUTPUT_MAX];
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)atoi(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (int waited = 0; waited < STARTUP_TIMEOUT_MS; waited += 10)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int ok;
+
+        if (fd < 0)
+            return -1;
+        ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (ok && shutdown(fd, SHUT_WR) == 0 && setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0)
+        {
+            while (read(fd, buf, sizeof(buf)) > 0)
+                ;
+        }
+        close(fd);
+        if (ok)
+            return 0;
+        nanosleep(&pause, NULL);
+    }
+    return -1;
+}
+
+/**
+ *
+ * \brief runs the client's load generator and parses its summary
+ *
+ * \param client the client program
+ * \param port loopback port
+ * \param connections concurrent connections
+ * \param requests requests of the run
+ * \param res receives requests, errors, elapsed time, rate and latencies
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int run_client(const char *client, const char *port, long connections, long requests, struct bench_result *res)
+{
+    char output[OUTPUT_MAX];
+    char conn_arg[32], req_arg[32];
+    size_t have = 0;
+    const char *line;
+    int pipe_fd[2];
+    ssize_t n;
+    pid_t pid;
+    int status;
+
+    memset(res, 0, sizeof(*res));
+    snprintf(conn_arg, sizeof(conn_arg), "%ld", connections);
+    snprintf(req_arg, sizeof(req_arg), "%ld", requests);
+
+    if (pipe(pipe_fd) < 0 || (pid = fork()) < 0)
+    {
+        fprintf(stderr, "%s: Could not start %s: %s\n", sprogram_arg0, client, strerror(errno));
+        return -1;
+    }
+    if (pid == 0)
+    {
+        close(pipe_fd[0]);
+        dup2(pipe_fd[1], STDOUT_FILENO);
+        execl(client, client, "-s", "127.0.0.1", "-p", port, "-u", "bench", "-m", "bench",
+              "--load", "--connections", conn_arg, "--requests", req_arg, (char *)NULL);
+        fprintf(stderr, "%s: Could not start %s: %s\n", sprogram_arg0, client, strerror(errno));
+        _exit(127);
+    }
+    close(pipe_fd[1]);
+    while ((n = read(pipe_fd[0], output + have, sizeof(output) - 1 - have)) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        have += n;
+    }
+    output[have] = '\0';
+    close(pipe_fd[0]);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+
+    if ((line = strstr(output, "requests=")) == NULL ||
+        sscanf(line, "requests=%lu errors=%lu elapsed_s=%lf throughput_rps=%lf",
+               &res->requests, &res->errors, &res->elapsed, &res->rps) != 4 ||
+        (line = strstr(output, "latency_us ")) == NULL ||
+        sscanf(line, "latency_us p50=%llu p90=%*u p99=%llu", &res->p50, &res->p99) != 2)
+    {
+        fprintf(stderr, "%s: Unexpected output of %s\n", sprogram_arg0, client);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief CPU time of a process, its reaped children and its living descendants
+ *
+ * \param pid the process
+ *
+ * \return clock ticks, 0 if the process is gone
+ *
+ */
+
+static long long tree_cpu_ticks(pid_t pid)
+{
+    char path[PROC_PATH_MAX];
+    char buf[OUTPUT_MAX];
+    unsigned long long utime, stime;
+    long long cutime, cstime, total = 0;
+    const char *p;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((f = fopen(path, "r")) == NULL)
+        return 0;
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+
+    //fields 14 to 17 follow the command name, which may contain blanks
+    if (p != NULL && (p = strrchr(buf, ')')) != NULL &&
+        sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %lld %lld",
+               &utime, &stime, &cutime, &cstime) == 4)
+        total = utime + stime + cutime + cstime;
+
+    for_each_child(pid, add_cpu, &total);
+    return total;
+}
+
+/**
+ *
+ * \brief peak resident set of a process and its living descendants
+ *
+ * \param pid the process
+ *
+ * \return kB, 0 if the process is gone
+ *
+ */
+
+static long tree_rss_kb(pid_t pid)
+{
+    char path[PROC_PATH_MAX];
+    char line[OUTPUT_MAX];
+    long total = 0, kb;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    if ((f = fopen(path, "r")) == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+            total = kb;
+    }
+    fclose(f);
+
+    for_each_child(pid, add_rss, &total);
+    return total;
+}
+
+/**
+ *
+ * \brief calls fn for every living child of all threads of a process
+ *
+ * \param pid the process
+ * \param fn the callback
+ * \param arg passed to fn
+ *
+ * \return 0 on success, -1 if the process is gone
+ *
+ */
+
+static int for_each_child(pid_t pid, void (*fn)(pid_t child, void *arg), void *arg)
+{
+    char path[PROC_PATH_MAX];
+    struct dirent *task;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    if ((dir = opendir(path)) == NULL)
+        return -1;
+    while ((task = readdir(dir)) != NULL)
+    {
+        FILE *f;
+        int child;
+
+        if (task->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "/proc/%d/task/%.16s/children", (int)pid, task->d_name);
+        if ((f = fopen(path, "r")) == NULL)
+            continue;
+        while (fscanf(f, "%d", &child) == 1)
+            fn(child, arg);
+        fclose(f);
+    }
+    closedir(dir);
+    return 0;
+}
+
+/**
+ *
+ * \brief for_each_child() callback summing CPU time
+ *
+ * \param child the child
+ * \param arg the sum, long long
+ *
+ */
+
+static void add_cpu(pid_t child, void *arg)
+{
+    *(long long *)arg += tree_cpu_ticks(child);
+}
+
+/**
+ *
+ * \brief for_each_child() callback summing resident sets
+ *
+ * \param child the child
+ * \param arg the sum, long
+ *
+ */
+
+static void add_rss(pid_t child, void *arg)
+{
+    *(long *)arg += tree_rss_kb(child);
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,239 @@
+/**
+ * @file spawn_bench.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Benchmark - fork/exec versus posix_spawn at growing resident set sizes
+ *
+ * Grows its own resident set to each of the given sizes and measures the mean
+ * time to launch and reap a program with fork()+execl() (launch mode exec) and
+ * with posix_spawn() (launch mode spawn). Prints one key=value line per size.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <spawn.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define DEFAULT_LAUNCHES 200
+#define DEFAULT_SIZES "0,64,256,1024"
+#define DEFAULT_PROGRAM "/bin/true"
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+extern char **environ;
+
+static const char *sprogram_arg0 = NULL;
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void usage(void);
+static double now_us(void);
+static double bench_fork(const char *program, long launches);
+static double bench_spawn(const char *program, long launches);
+
+/**
+ *
+ * \brief Main Program logic
+ *
+ * \param argc the number of arguments
+ * \param argv the arguments
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS returned on success
+ * \retval EXIT_FAILURE returned on error
+ *
+ */
+
+int main(int argc, char *argv[])
+{
+    long launches = DEFAULT_LAUNCHES;
+    const char *sizes = DEFAULT_SIZES;
+    const char *program = DEFAULT_PROGRAM;
+    char *ballast = NULL;
+    size_t ballast_len = 0;
+    const char *p;
+    char *end;
+    int c;
+
+    sprogram_arg0 = argv[0];
+
+    while ((c = getopt(argc, argv, "n:s:p:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            launches = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || launches <= 0)
+                usage();
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 'p':
+            program = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    for (p = sizes; *p != '\0';)
+    {
+        long mb = strtol(p, &end, 10);
+        if (end == p || mb < 0)
+            usage();
+        p = *end == ',' ? end + 1 : end;
+
+        //grow the resident set: realloc keeps the old pages, memset touches the new ones
+        size_t len = (size_t)mb << 20;
+        if (len > ballast_len)
+        {
+            char *grown = realloc(ballast, len);
+            if (grown == NULL)
+            {
+                fprintf(stderr, "%s: Could not allocate %ld MB: %s\n", sprogram_arg0, mb, strerror(errno));
+                free(ballast);
+                return EXIT_FAILURE;
+            }
+            ballast = grown;
+            memset(ballast + ballast_len, 1, len - ballast_len);
+            ballast_len = len;
+        }
+
+        double fork_us = bench_fork(program, launches);
+        double spawn_us = bench_spawn(program, launches);
+        if (fork_us < 0 || spawn_us < 0)
+        {
+            free(ballast);
+            return EXIT_FAILURE;
+        }
+        printf("rss_mb=%zu launches=%ld fork_us=%.1f spawn_us=%.1f\n", ballast_len >> 20, launches, fork_us, spawn_us);
+        fflush(stdout);
+    }
+
+    free(ballast);
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ * \brief prints the usage and terminates the program
+ *
+ */
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage:\n%s [-n launches] [-s mb,mb,...] [-p program] [-h]\n"
+                    "\t-n launches per size and method (default %d)\n"
+                    "\t-s resident set sizes in MB (default %s)\n"
+                    "\t-p program to launch (default %s)\n",
+            sprogram_arg0, DEFAULT_LAUNCHES, DEFAULT_SIZES, DEFAULT_PROGRAM);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ * \brief monotonic clock in microseconds
+ *
+ * \return current time in microseconds
+ *
+ */
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ *
+ * \brief mean time to fork, exec and reap a program
+ *
+ * \param program the program to launch
+ * \param launches number of launches
+ *
+ * \return mean microseconds per launch or -1 on error
+ *
+ */
+
+static double bench_fork(const char *program, long launches)
+{
+    double start = now_us();
+
+    for (long i = 0; i < launches; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            fprintf(stderr, "%s: fork failed: %s\n", sprogram_arg0, strerror(errno));
+            return -1;
+        }
+        if (pid == 0)
+        {
+            execl(program, program, (char *)NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return (now_us() - start) / launches;
+}
+
+/**
+ *
+ * \brief mean time to posix_spawn and reap a program
+ *
+ * \param program the program to launch
+ * \param launches number of launches
+ *
+ * \return mean microseconds per launch or -1 on error
+ *
+ */
+
+static double bench_spawn(const char *program, long launches)
+{
+    char *const argv[] = {(char *)program, NULL};
+    double start = now_us();
+    int err;
+
+    for (long i = 0; i < launches; i++)
+    {
+        pid_t pid;
+        if ((err = posix_spawn(&pid, program, NULL, NULL, argv, environ)) != 0)
+        {
+            fprintf(stderr, "%s: posix_spawn failed: %s\n", sprogram_arg0, strerror(err));
+            return -1;
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return (now_us() - start) / launches;
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,162 @@
+/**
+ * @file stub_logic.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Benchmark - business logic stub with configurable responses
+ *
+ * Reads the request until end of file and answers with STUB_FILES files of
+ * STUB_SIZE bytes each (environment variables, inherited through the server).
+ * Built twice by "make bench": as program for the launch modes exec, spawn
+ * and pool, and as shared object exporting handle() for the plugin mode.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define DEFAULT_SIZE 1024
+#define DEFAULT_FILES 1
+#define STUB_BUF_SIZE 4096
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+int handle(int in_fd, int out_fd);
+static long env_long(const char *name, long def);
+static int write_all(int fd, const char *buf, size_t len);
+
+/**
+ *
+ * \brief Main Program logic, serves one request on stdin and stdout
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS returned on success
+ * \retval EXIT_FAILURE returned on error
+ *
+ */
+
+int main(void)
+{
+    return handle(STDIN_FILENO, STDOUT_FILENO) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ *
+ * \brief Serves one request, see simple_message_server_plugin.h
+ *
+ * \param in_fd descriptor the request is read from
+ * \param out_fd descriptor the response is written to
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+int handle(int in_fd, int out_fd)
+{
+    char buf[STUB_BUF_SIZE];
+    long size = env_long("STUB_SIZE", DEFAULT_SIZE);
+    long files = env_long("STUB_FILES", DEFAULT_FILES);
+    ssize_t n;
+    int len;
+
+    while ((n = read(in_fd, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0 && errno != EINTR)
+            return -1;
+    }
+
+    if (write_all(out_fd, "status=0\n", strlen("status=0\n")) < 0)
+        return -1;
+
+    for (long i = 0; i < files; i++)
+    {
+        len = snprintf(buf, sizeof(buf), "file=stub%ld.html\nlen=%ld\n", i, size);
+        if (write_all(out_fd, buf, len) < 0)
+            return -1;
+
+        memset(buf, 'x', sizeof(buf));
+        for (long left = size; left > 0; left -= sizeof(buf))
+        {
+            if (write_all(out_fd, buf, left < (long)sizeof(buf) ? (size_t)left : sizeof(buf)) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Reads a non-negative number from the environment
+ *
+ * \param name the variable
+ * \param def value if the variable is not set or invalid
+ *
+ * \return the number
+ *
+ */
+
+static long env_long(const char *name, long def)
+{
+    const char *value = getenv(name);
+    char *end;
+    long number;
+
+    if (value == NULL)
+        return def;
+    number = strtol(value, &end, 10);
+    return end == value || *end != '\0' || number < 0 ? def : number;
+}
+
+/**
+ *
+ * \brief Writes the whole buffer
+ *
+ * \param fd descriptor to write to
+ * \param buf the data
+ * \param len number of bytes
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,201 @@
+/**
+ * @file crc32c.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * CRC-32C (Castagnoli)
+ *
+ * x86-64 processors with SSE4.2 compute it with the crc32 instruction, eight
+ * bytes per instruction. Everywhere else slice-by-8 looks up eight tables per
+ * eight bytes. Both run at a fraction of the cost of reading the data from a
+ * socket, so the checksum is computed in the same pass that copies the data
+ * instead of in a second one. The choice is made once at startup.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <string.h>
+
+#include "crc32c.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82f63b78U
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+//slice-by-8 tables, filled at startup
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_impl)(uint32_t crc, const unsigned char *p, size_t len);
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len);
+#if defined(__x86_64__)
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len);
+#endif
+static void crc32c_init(void) __attribute__((constructor));
+
+/**
+ *
+ * \brief Continues a checksum over more data
+ *
+ * \param crc CRC32C_INIT or the result of the previous call
+ * \param data the data
+ * \param len length of the data
+ *
+ * \return the checksum so far, see crc32c_final()
+ *
+ */
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len)
+{
+    return crc_impl(crc, data, len);
+}
+
+/**
+ *
+ * \brief Checksum of a whole buffer
+ *
+ * \param data the data
+ * \param len length of the data
+ *
+ * \return the checksum
+ *
+ */
+
+uint32_t crc32c(const void *data, size_t len)
+{
+    return crc32c_final(crc_impl(CRC32C_INIT, data, len));
+}
+
+/**
+ *
+ * \brief Name of the implementation in use, for benchmarks
+ *
+ * \return "sse4.2" or "slice-by-8"
+ *
+ */
+
+const char *crc32c_impl(void)
+{
+#if defined(__x86_64__)
+    if (crc_impl == crc32c_sse42)
+        return "sse4.2";
+#endif
+    return "slice-by-8";
+}
+
+/**
+ *
+ * \brief Fills the tables and picks the implementation
+ *
+ * Runs before main(), so the server threads never race on it.
+ *
+ */
+
+static void crc32c_init(void)
+{
+    for (unsigned i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_table[0][i] = crc;
+    }
+    //table k advances a byte that is followed by k more bytes
+    for (unsigned i = 0; i < 256; i++)
+        for (int k = 1; k < 8; k++)
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xff];
+
+    crc_impl = crc32c_sw;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc_impl = crc32c_sse42;
+#endif
+}
+
+/**
+ *
+ * \brief Slice-by-8 checksum
+ *
+ * \param crc the checksum so far
+ * \param p the data
+ * \param len length of the data
+ *
+ * \return the checksum so far
+ *
+ */
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint32_t lo, hi;
+
+        //little endian order of the bytes, as the reflected CRC needs it
+        lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+              crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+    }
+    while (len-- > 0)
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ *
+ * \brief Checksum with the SSE4.2 crc32 instruction
+ *
+ * \param crc the checksum so far
+ * \param p the data
+ * \param len length of the data
+ *
+ * \return the checksum so far
+ *
+ */
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, p, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    while (len-- > 0)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,52 @@
+/**
+ * @file crc32c.h
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * CRC-32C (Castagnoli) of the file checksums of protocol version 3
+ *
+ * Computed incrementally, so a receiver checks the content while it streams
+ * through:
+ *
+ *     uint32_t crc = CRC32C_INIT;
+ *     crc = crc32c_update(crc, part, len);   (for every part)
+ *     crc = crc32c_final(crc);
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define CRC32C_INIT 0xffffffffU
+#define crc32c_final(crc) ((crc) ^ 0xffffffffU)
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c(const void *data, size_t len);
+const char *crc32c_impl(void);
+
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,176 @@
+/**
+ * @file latency_histogram.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * HDR style latency histogram
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <string.h>
+
+#include "latency_histogram.h"
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+/**
+ *
+ * \brief Empties the histogram
+ *
+ * \param h the histogram
+ *
+ */
+
+void hist_reset(struct latency_histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+/**
+ *
+ * \brief Bucket index of a value
+ *
+ * \param value the value
+ *
+ * \return the bucket index
+ *
+ */
+
+unsigned hist_index(uint64_t value)
+{
+    unsigned shift;
+
+    if (value < 2 * HIST_HALF)
+        return value;
+
+    //shift so that value >> shift lies in [HIST_HALF, 2 * HIST_HALF)
+    shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS - 1);
+    return shift * HIST_HALF + (unsigned)(value >> shift);
+}
+
+/**
+ *
+ * \brief Largest value that falls into a bucket
+ *
+ * \param index the bucket index
+ *
+ * \return the largest value counted in the bucket
+ *
+ */
+
+uint64_t hist_highest_equivalent(unsigned index)
+{
+    unsigned shift;
+    uint64_t sub;
+
+    if (index < 2 * HIST_HALF)
+        return index;
+
+    shift = index / HIST_HALF - 1;
+    sub = index - shift * HIST_HALF;
+    return (sub << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+/**
+ *
+ * \brief Counts one value
+ *
+ * \param h the histogram
+ * \param value the value, e.g. a latency in microseconds
+ *
+ */
+
+void hist_record(struct latency_histogram *h, uint64_t value)
+{
+    h->counts[hist_index(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+/**
+ *
+ * \brief Adds all values of one histogram to another
+ *
+ * \param dst the histogram added to
+ * \param src the histogram added
+ *
+ */
+
+void hist_merge(struct latency_histogram *dst, const struct latency_histogram *src)
+{
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/**
+ *
+ * \brief Value at a percentile
+ *
+ * \param h the histogram
+ * \param percentile the percentile in [0, 100]
+ *
+ * \return the highest value equivalent to the percentile, 0 for an empty histogram
+ *
+ */
+
+uint64_t hist_percentile(const struct latency_histogram *h, double percentile)
+{
+    uint64_t rank, seen = 0;
+
+    if (h->total == 0)
+        return 0;
+
+    rank = (uint64_t)(percentile / 100.0 * h->total + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return hist_highest_equivalent(i) < h->max ? hist_highest_equivalent(i) : h->max;
+    }
+    return h->max;
+}
+
+/**
+ *
+ * \brief Mean of all values
+ *
+ * \param h the histogram
+ *
+ * \return the mean, 0 for an empty histogram
+ *
+ */
+
+double hist_mean(const struct latency_histogram *h)
+{
+    return h->total > 0 ? h->sum / h->total : 0;
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,67 @@
+/**
+ * @file latency_histogram.h
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * HDR style latency histogram
+ *
+ * Log-linear buckets: values below 2^HIST_SUB_BITS are counted exactly, above
+ * that every power of two is split into 2^(HIST_SUB_BITS-1) equal buckets. The
+ * relative error of a reported value is therefore below 1/64 over the whole
+ * 64 bit range, with a fixed 30 KB footprint and O(1) recording.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdint.h>
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define HIST_SUB_BITS 7
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 2) * HIST_HALF)
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+struct latency_histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+void hist_reset(struct latency_histogram *h);
+void hist_record(struct latency_histogram *h, uint64_t value);
+void hist_merge(struct latency_histogram *dst, const struct latency_histogram *src);
+uint64_t hist_percentile(const struct latency_histogram *h, double percentile);
+double hist_mean(const struct latency_histogram *h);
+unsigned hist_index(uint64_t value);
+uint64_t hist_highest_equivalent(unsigned index);
+
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
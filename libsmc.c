@@ -0,0 +1,1224 @@
+/**
+ * @file libsmc.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * libsmc - non-blocking connection to a simple message server
+ *
+ * A connection keeps the submitted requests in a queue in the order of
+ * submission and drives one non-blocking socket through
+ *
+ *     IDLE -> CONNECTING [-> HELLO -> ACK] -> OPEN
+ *
+ * Connecting follows the happy eyeballs algorithm of RFC 8305: the
+ * addresses of the server are tried with the address families interleaved,
+ * each one gets a head start of attempt_delay_ms before the next connect()
+ * is started in parallel, a failed attempt starts the next one right away,
+ * and the first connection established wins.
+ *
+ * With keep-alive every queued request is sent as a frame as soon as the
+ * socket takes it, and the responses are read back in the same order. A
+ * server that does not acknowledge the hello within KEEPALIVE_ACK_TIMEOUT_MS
+ * gets the queue as plain requests: one connection each, closed for writing
+ * after the request, the response ends with end of file.
+ *
+ * Any error of a connection fails all outstanding requests; the next
+ * smc_submit() starts over with a new connection.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "libsmc.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+//largest chunk moved by one sendfile()/splice() call when sending a message
+#define MAX_SENDFILE_SIZE (1 << 30)
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+enum conn_state
+{
+    CONN_IDLE,        //no socket
+    CONN_CONNECTING,  //non-blocking connect() attempts in progress
+    CONN_HELLO,       //sending the keep-alive hello
+    CONN_ACK,         //waiting for the acknowledgement
+    CONN_OPEN         //sending requests and reading responses
+};
+
+//how the message of a body_fd is sent, the first one the descriptor supports
+enum body_method
+{
+    BODY_SENDFILE, BODY_SPLICE, BODY_COPY
+};
+
+struct smc_request
+{
+    struct smc_request *next;
+    char *text;              //header lines
+    size_t text_len;
+    const char *message;     //without body_fd, sent after the header lines
+    size_t message_len;
+    char *copy;              //message unless borrowed
+    int body_fd;
+    long body_len;           //-1: up to end of file, plain requests only
+    enum body_method method;
+    struct smc_callbacks cb;
+    void *arg;
+    struct smc_trace *trace;      //with smc_callbacks.trace
+};
+
+struct smc_conn
+{
+    char *server;
+    char *port;
+    struct smc_options opts;
+    int dir_fd;
+    int cache_fd;                 //smc_options.cache_dir, -1 = none
+    struct smc_writer *writer;    //for SMC_FILES_DISK, NULL = the receiver writes
+    struct addrinfo *addrs;       //resolved on the first connect
+    size_t addr_count;
+    struct addrinfo **order;      //addrs in the order they are tried
+    struct pollfd *attempt;       //connect attempts, parallel to order, fd -1 = none
+    size_t next_addr;             //index in order of the next address to try
+    size_t attempts;              //attempts under way
+    long long next_attempt;       //when the next address is tried, see now_ms()
+    long long connect_deadline;   //when connecting gives up, 0 = never
+    int connect_err;              //error of the last failed attempt
+    long long connect_begin;      //smc_now_us() when conn_start() ran
+    long long resolve_us;         //getaddrinfo() of the current connection, for the trace
+    long long connect_us;         //connect and handshake of the current connection, for the trace
+    int connect_traced;           //the first request sent has taken resolve_us and connect_us
+    int fd;                       //while connecting the newest attempt
+    enum conn_state state;
+    int keepalive;                //cleared when the server does not acknowledge
+    int version;                  //of the open connection, 0 = plain
+    char ack[PROTO_HELLO_LEN];
+    size_t hello_done;            //bytes of the hello sent, then of the ack received
+    long long ack_deadline;       //milliseconds, see now_ms()
+    struct smc_request *head;     //outstanding requests, oldest first
+    struct smc_request *tail;
+    struct smc_request *send;     //first request not completely sent
+    size_t send_off;              //bytes of frame header and text of send written
+    long body_sent;
+    uint32_t frame_hdr;
+    char *copy_buf;               //BODY_COPY, allocated on first use
+    size_t copy_off;
+    size_t copy_len;
+    struct smc_request *rx_req;   //request the receiver was started for
+    long pending;
+    char error[SMC_ERROR_MAX];
+    struct smc_receiver rx;
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+static int conn_start(struct smc_conn *c);
+static int conn_resolve(struct smc_conn *c);
+static int conn_attempt(struct smc_conn *c);
+static int conn_won(struct smc_conn *c, size_t i);
+static int conn_connecting(struct smc_conn *c);
+static int conn_established(struct smc_conn *c);
+static int conn_step(struct smc_conn *c);
+static int conn_send(struct smc_conn *c);
+static int send_body(struct smc_conn *c, struct smc_request *req);
+static int conn_recv(struct smc_conn *c);
+static void conn_reset(struct smc_conn *c);
+static void conn_fail(struct smc_conn *c, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void complete(struct smc_conn *c, int result);
+static long long now_ms(void);
+
+/**
+ *
+ * \brief creates a connection object
+ *
+ * Nothing is sent yet, the server name is resolved when the first request
+ * is carried out.
+ *
+ * \param server name or address of the server
+ * \param port port or service name
+ * \param opts options, NULL for plain requests storing files in the working directory
+ *
+ * \return the connection or NULL with errno set on error
+ *
+ */
+
+struct smc_conn *smc_open(const char *server, const char *port, const struct smc_options *opts){
+    struct smc_conn *c = calloc(1, sizeof(*c));
+
+    if(c == NULL){
+        return NULL;
+    }
+    if(opts != NULL){
+        c->opts = *opts;
+    }
+    if(c->opts.protocol <= 0 || c->opts.protocol > PROTO_VERSION_MAX){
+        c->opts.protocol = PROTO_VERSION_DEFAULT;
+    }
+    c->keepalive = c->opts.keepalive;
+    c->fd = -1;
+    c->dir_fd = AT_FDCWD;
+    c->cache_fd = -1;
+    c->state = CONN_IDLE;
+    //smc_close() below releases the receiver
+    smc_receiver_init(&c->rx, 0, c->opts.files, c->dir_fd, -1, NULL);
+
+    if((c->server = strdup(server)) == NULL || (c->port = strdup(port)) == NULL ||
+       (c->opts.dir != NULL && (c->dir_fd = open(c->opts.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) ||
+       (c->opts.files == SMC_FILES_DISK && c->opts.cache_dir != NULL &&
+        (c->cache_fd = open(c->opts.cache_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) ||
+       (c->opts.files == SMC_FILES_DISK && c->cache_fd == -1 && (c->opts.write_buffers > 0 || c->opts.sync) &&
+        (c->writer = smc_writer_create(c->opts.write_buffers > 0 ? c->opts.write_buffers : SMC_WRITE_BUFFERS, c->opts.sync)) == NULL)){
+        int err = errno;
+
+        if(c->dir_fd == -1){
+            c->dir_fd = AT_FDCWD;
+        }
+        smc_close(c);
+        errno = err;
+        return NULL;
+    }
+    c->opts.dir = c->opts.cache_dir = NULL;
+    smc_receiver_init(&c->rx, 0, c->opts.files, c->dir_fd, c->cache_fd, c->writer);
+    return c;
+}
+
+/**
+ *
+ * \brief queues a request
+ *
+ * The strings of the message are copied unless the message is borrowed, a
+ * body_fd has to stay open until the request is done. The header lines and
+ * the message are sent with one sendmsg() from where they are. With keep-alive the message of a body_fd must be a
+ * regular file, a frame needs the length up front. Call smc_poll() to carry
+ * the request out.
+ *
+ * \param conn the connection
+ * \param msg the message
+ * \param cb callbacks for the response, copied, may be NULL
+ * \param arg passed to the callbacks
+ *
+ * \return 0 on success, -1 with errno set on error
+ *
+ */
+
+int smc_submit(struct smc_conn *conn, const struct smc_message *msg, const struct smc_callbacks *cb, void *arg){
+    struct smc_request *req = calloc(1, sizeof(*req));
+    struct stat st;
+
+    if(req == NULL){
+        return -1;
+    }
+    req->body_fd = msg->body_fd;
+    req->body_len = -1;
+    req->method = BODY_SENDFILE;
+    if(cb != NULL){
+        req->cb = *cb;
+    }
+    req->arg = arg;
+    if(req->cb.trace != NULL){
+        if((req->trace = calloc(1, sizeof(*req->trace))) == NULL){
+            free(req);
+            return -1;
+        }
+        req->trace->submit = smc_now_us();
+    }
+
+    if(req->body_fd != -1){
+        if(fstat(req->body_fd, &st) == -1){
+            free(req->trace);
+            free(req);
+            return -1;
+        }
+        if(S_ISREG(st.st_mode)){
+            req->body_len = st.st_size - lseek(req->body_fd, 0, SEEK_CUR);
+        }else if(conn->opts.keepalive){
+            free(req->trace);
+            free(req);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if((req->text = smc_build_request(msg->user, "", msg->img_url, &req->text_len)) == NULL){
+        free(req->trace);
+        free(req);
+        return -1;
+    }
+    if(req->body_fd == -1){
+        req->message = msg->message;
+        req->message_len = strlen(msg->message);
+    }
+    if(conn->opts.keepalive && req->text_len + req->message_len + (req->body_len > 0 ? (size_t)req->body_len : 0) > PROTO_FRAME_MAX){
+        free(req->text);
+        free(req->trace);
+        free(req);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if(req->body_fd == -1 && !msg->borrow){
+        if((req->copy = malloc(req->message_len + 1)) == NULL){
+            free(req->text);
+            free(req->trace);
+            free(req);
+            return -1;
+        }
+        req->message = memcpy(req->copy, msg->message, req->message_len + 1);
+    }
+
+    //a kept-alive connection idle for a while may have been closed by the server
+    if(conn->state == CONN_OPEN && conn->pending == 0){
+        struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+
+        if(poll(&pfd, 1, 0) != 0){
+            conn_reset(conn);
+        }
+    }
+
+    if(conn->tail != NULL){
+        conn->tail->next = req;
+    }else{
+        conn->head = req;
+    }
+    conn->tail = req;
+    conn->pending++;
+    //an open keep-alive connection takes it right away, a plain one only has room for its own
+    if(conn->send == NULL && conn->state == CONN_OPEN && conn->version > 0){
+        conn->send = req;
+        conn->send_off = 0;
+        conn->body_sent = 0;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief carries out the queued requests
+ *
+ * waits up to timeout_ms for the socket, then sends and receives as much as
+ * it can without blocking and calls the callbacks of the responses read.
+ * Whenever requests are pending afterwards, smc_fd() is the socket to wait
+ * for, and smc_poll() has to be called again after smc_timeout() at the
+ * latest.
+ *
+ * \param conn the connection
+ * \param timeout_ms milliseconds to wait at most, 0 to not wait, -1 without limit
+ *
+ * \return the number of requests still pending, -1 with errno set if poll() failed
+ *
+ */
+
+int smc_poll(struct smc_conn *conn, int timeout_ms){
+    struct pollfd pfd;
+    int wait;
+
+    if(conn->pending == 0){
+        return 0;
+    }
+    if(conn->state == CONN_IDLE && conn_start(conn) == -1){
+        return conn->pending;
+    }
+
+    if((wait = smc_timeout(conn)) >= 0 && (timeout_ms < 0 || wait < timeout_ms)){
+        timeout_ms = wait;
+    }
+    pfd.fd = conn->fd;
+    pfd.events = smc_events(conn);
+    //racing connect attempts are all waited for
+    if(poll(conn->state == CONN_CONNECTING ? conn->attempt : &pfd, conn->state == CONN_CONNECTING ? conn->next_addr : 1, timeout_ms) == -1){
+        return errno == EINTR ? conn->pending : -1;
+    }
+
+    while(conn_step(conn) == 1){
+    }
+    return conn->pending;
+}
+
+/**
+ *
+ * \brief socket of the connection, for a poll loop of the caller
+ *
+ * \param conn the connection
+ *
+ * \return the socket, -1 if there is none
+ *
+ */
+
+int smc_fd(const struct smc_conn *conn){
+    return conn->fd;
+}
+
+/**
+ *
+ * \brief events smc_poll() waits for on smc_fd()
+ *
+ * \param conn the connection
+ *
+ * \return POLLIN and/or POLLOUT, 0 if there is nothing to wait for
+ *
+ */
+
+short smc_events(const struct smc_conn *conn){
+    short events = 0;
+
+    switch(conn->state){
+    case CONN_IDLE:
+        break;
+    case CONN_CONNECTING:
+    case CONN_HELLO:
+        events = POLLOUT;
+        break;
+    case CONN_ACK:
+        events = POLLIN;
+        break;
+    case CONN_OPEN:
+        if(conn->send != NULL){
+            events |= POLLOUT;
+        }
+        if(conn->head != NULL && (conn->head != conn->send || conn->send_off > 0)){
+            events |= POLLIN;
+        }
+        break;
+    }
+    return events;
+}
+
+/**
+ *
+ * \brief time until smc_poll() has to run even if smc_fd() stays quiet
+ *
+ * While connecting several attempts may race, smc_fd() is only the newest
+ * of them. The others, the next attempt and the keep-alive acknowledgement
+ * are looked after when smc_poll() runs.
+ *
+ * \param conn the connection
+ *
+ * \return milliseconds, -1 if there is no such time
+ *
+ */
+
+int smc_timeout(const struct smc_conn *conn){
+    long long when = -1;
+    long long left;
+
+    if(conn->state == CONN_CONNECTING){
+        if(conn->next_addr < conn->addr_count){
+            when = conn->next_attempt;
+        }
+        if(conn->connect_deadline != 0 && (when == -1 || conn->connect_deadline < when)){
+            when = conn->connect_deadline;
+        }
+    }else if(conn->state == CONN_ACK){
+        when = conn->ack_deadline;
+    }
+    if(when == -1){
+        return -1;
+    }
+    left = when - now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+/**
+ *
+ * \brief number of requests not done yet
+ *
+ * \param conn the connection
+ *
+ * \return the number of requests
+ *
+ */
+
+long smc_pending(const struct smc_conn *conn){
+    return conn->pending;
+}
+
+/**
+ *
+ * \brief protocol version of the current or last connection
+ *
+ * \param conn the connection
+ *
+ * \return the keep-alive protocol version, 0 for plain requests
+ *
+ */
+
+int smc_version(const struct smc_conn *conn){
+    return conn->version;
+}
+
+/**
+ *
+ * \brief describes the last error
+ *
+ * \param conn the connection
+ *
+ * \return the message, empty if there was no error
+ *
+ */
+
+const char *smc_error(const struct smc_conn *conn){
+    return conn->error;
+}
+
+/**
+ *
+ * \brief closes the connection and frees it
+ *
+ * Requests still pending are dropped without calling their callbacks. Must
+ * not be called from a callback.
+ *
+ * \param conn the connection, may be NULL
+ *
+ */
+
+void smc_close(struct smc_conn *conn){
+    if(conn == NULL){
+        return;
+    }
+    while(conn->head != NULL){
+        struct smc_request *req = conn->head;
+
+        conn->head = req->next;
+        free(req->trace);
+        free(req->text);
+        free(req->copy);
+        free(req);
+    }
+    conn_reset(conn);
+    if(conn->dir_fd != AT_FDCWD){
+        close(conn->dir_fd);
+    }
+    if(conn->cache_fd != -1){
+        close(conn->cache_fd);
+    }
+    if(conn->addrs != NULL){
+        freeaddrinfo(conn->addrs);
+    }
+    free(conn->order);
+    free(conn->attempt);
+    smc_receiver_destroy(&conn->rx);
+    //after the receiver, which hands its open file to the writer
+    smc_writer_destroy(conn->writer);
+    free(conn->copy_buf);
+    free(conn->server);
+    free(conn->port);
+    free(conn);
+}
+
+/**
+ *
+ * \brief assembles the header lines and the message of a request
+ *
+ * \param user user to send
+ * \param message message to send
+ * \param img_url the url of the image. this can be null.
+ * \param len receives the length of the request without the terminating '\0'
+ *
+ * \return the request allocated with malloc() or NULL with errno set on error
+ *
+ */
+
+char *smc_build_request(const char *user, const char *message, const char *img_url, size_t *len){
+    char *request;
+
+    *len = strlen("user=") + strlen(user) + strlen("\n") + strlen(message);
+    if(img_url != NULL){
+        *len += strlen("img=") + strlen(img_url) + strlen("\n");
+    }
+    if((request = malloc(*len + 1)) == NULL){
+        return NULL;
+    }
+    if(img_url == NULL){
+        sprintf(request, "user=%s\n%s", user, message);
+    }else{
+        sprintf(request, "user=%s\nimg=%s\n%s", user, img_url, message);
+    }
+    return request;
+}
+
+/**
+ *
+ * \brief starts connecting to the server
+ *
+ * resolves the server name first if this is the first connection, then
+ * starts the first attempt.
+ *
+ * \param c the connection
+ *
+ * \return 0 on success, -1 if no address could be tried (the requests are failed)
+ *
+ */
+
+static int conn_start(struct smc_conn *c){
+    c->connect_begin = smc_now_us();
+    c->resolve_us = 0;
+    c->connect_traced = 0;
+    if(c->addrs == NULL && conn_resolve(c) == -1){
+        return -1;
+    }
+    if(c->addrs != NULL){
+        c->resolve_us = smc_now_us() - c->connect_begin;
+    }
+    c->next_addr = 0;
+    c->attempts = 0;
+    c->connect_err = 0;
+    c->connect_deadline = c->opts.connect_timeout_ms > 0 ? now_ms() + c->opts.connect_timeout_ms : 0;
+    c->state = CONN_CONNECTING;
+    return conn_attempt(c);
+}
+
+/**
+ *
+ * \brief resolves the server name and decides the order of the addresses
+ *
+ * getaddrinfo() sorts the addresses by preference (RFC 6724). As RFC 8305
+ * section 4 asks, the families are interleaved from there, so a dead IPv6
+ * network costs at most one attempt delay before IPv4 is tried.
+ *
+ * \param c the connection
+ *
+ * \return 0 on success, -1 on error (the requests are failed)
+ *
+ */
+
+static int conn_resolve(struct smc_conn *c){
+    struct addrinfo hints;
+    struct addrinfo *same;
+    struct addrinfo *other;
+    int first;
+    size_t n = 0;
+    int err;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if((err = getaddrinfo(c->server, c->port, &hints, &c->addrs)) != 0){
+        c->addrs = NULL;
+        conn_fail(c, "Could not obtain address information: %s", gai_strerror(err));
+        return -1;
+    }
+
+    for(c->addr_count = 0, same = c->addrs; same != NULL; same = same->ai_next){
+        c->addr_count++;
+    }
+    free(c->order);
+    free(c->attempt);
+    c->order = malloc(c->addr_count * sizeof(*c->order));
+    c->attempt = malloc(c->addr_count * sizeof(*c->attempt));
+    if(c->order == NULL || c->attempt == NULL){
+        freeaddrinfo(c->addrs);
+        c->addrs = NULL;
+        conn_fail(c, "No memory for the addresses of the server");
+        return -1;
+    }
+
+    first = c->addrs->ai_family;
+    same = other = c->addrs;
+    while(n < c->addr_count){
+        while(same != NULL && same->ai_family != first){
+            same = same->ai_next;
+        }
+        if(same != NULL){
+            c->order[n++] = same;
+            same = same->ai_next;
+        }
+        while(other != NULL && other->ai_family == first){
+            other = other->ai_next;
+        }
+        if(other != NULL){
+            c->order[n++] = other;
+            other = other->ai_next;
+        }
+    }
+    for(n = 0; n < c->addr_count; n++){
+        c->attempt[n].fd = -1;
+        c->attempt[n].events = POLLOUT;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief starts a connect() to the next address
+ *
+ * addresses that fail right away are skipped.
+ *
+ * \param c the connection
+ *
+ * \return 0 on success, -1 if no attempt is left (the requests are failed)
+ *
+ */
+
+static int conn_attempt(struct smc_conn *c){
+    while(c->next_addr < c->addr_count){
+        size_t i = c->next_addr++;
+        struct addrinfo *ai = c->order[i];
+        int fd;
+
+        if((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol)) == -1){
+            c->connect_err = errno;
+            continue;
+        }
+        c->attempt[i].fd = fd;
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0){
+            return conn_won(c, i);
+        }
+        if(errno == EINPROGRESS){
+            c->attempts++;
+            c->next_attempt = now_ms() + (c->opts.attempt_delay_ms > 0 ? c->opts.attempt_delay_ms : SMC_ATTEMPT_DELAY_MS);
+            c->fd = fd;
+            return 0;
+        }
+        c->connect_err = errno;
+        close(fd);
+        c->attempt[i].fd = -1;
+    }
+    if(c->attempts == 0){
+        conn_fail(c, "Could not connect: %s", strerror(c->connect_err));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief looks after the racing connect attempts
+ *
+ * \param c the connection
+ *
+ * \return 1 if the state changed and the next step may make progress, 0 otherwise
+ *
+ */
+
+static int conn_connecting(struct smc_conn *c){
+    if(poll(c->attempt, c->next_addr, 0) > 0){
+        for(size_t i = 0; i < c->next_addr; i++){
+            int err;
+            socklen_t err_len = sizeof(err);
+
+            //the socket turns writable once connect() is through, successful or not
+            if(c->attempt[i].fd == -1 || c->attempt[i].revents == 0){
+                continue;
+            }
+            if(getsockopt(c->attempt[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1){
+                err = errno;
+            }
+            if(err == 0){
+                return conn_won(c, i) == 0;
+            }
+            c->connect_err = err;
+            close(c->attempt[i].fd);
+            c->attempt[i].fd = -1;
+            c->attempts--;
+        }
+    }
+
+    if(c->connect_deadline != 0 && now_ms() >= c->connect_deadline){
+        conn_fail(c, "Could not connect: %s", strerror(ETIMEDOUT));
+        return 0;
+    }
+    //a failed attempt starts the next address right away, otherwise the attempt delay does
+    if(c->next_addr < c->addr_count && (c->attempts == 0 || now_ms() >= c->next_attempt)){
+        return conn_attempt(c) == 0;
+    }
+    if(c->attempts == 0){
+        conn_fail(c, "Could not connect: %s", strerror(c->connect_err));
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief keeps the connection that got through and drops the other attempts
+ *
+ * \param c the connection
+ * \param i index of the winner in c->attempt
+ *
+ * \return see conn_established()
+ *
+ */
+
+static int conn_won(struct smc_conn *c, size_t i){
+    c->fd = c->attempt[i].fd;
+    for(size_t k = 0; k < c->next_addr; k++){
+        if(k != i && c->attempt[k].fd != -1){
+            close(c->attempt[k].fd);
+        }
+        c->attempt[k].fd = -1;
+    }
+    c->attempts = 0;
+    return conn_established(c);
+}
+
+/**
+ *
+ * \brief goes on with a connected socket
+ *
+ * \param c the connection
+ *
+ * \return 0 on success, -1 on error (the requests are failed)
+ *
+ */
+
+static int conn_established(struct smc_conn *c){
+    c->version = 0;
+    c->send = NULL;
+    c->rx_req = NULL;
+    if(c->keepalive){
+        c->state = CONN_HELLO;
+        c->hello_done = 0;
+        return 0;
+    }
+    smc_receiver_destroy(&c->rx);
+    smc_receiver_init(&c->rx, 0, c->opts.files, c->dir_fd, c->cache_fd, c->writer);
+    c->connect_us = smc_now_us() - c->connect_begin - c->resolve_us;
+    c->state = CONN_OPEN;
+    c->send = c->head;
+    c->send_off = 0;
+    c->body_sent = 0;
+    return 0;
+}
+
+/**
+ *
+ * \brief makes as much progress as possible without blocking
+ *
+ * \param c the connection
+ *
+ * \return 1 if the state changed and the next step may make progress, 0 otherwise
+ *
+ */
+
+static int conn_step(struct smc_conn *c){
+    ssize_t n;
+
+    switch(c->state){
+    case CONN_IDLE:
+        //a plain request is done, the next one needs a connection of its own
+        if(c->pending > 0 && conn_start(c) == 0){
+            return 1;
+        }
+        return 0;
+
+    case CONN_CONNECTING:
+        return conn_connecting(c);
+
+    case CONN_HELLO:
+        n = send(c->fd, PROTO_HELLO(c->opts.protocol) + c->hello_done, PROTO_HELLO_LEN - c->hello_done, MSG_NOSIGNAL);
+        if(n == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+                return 0;
+            }
+            conn_fail(c, "Error when writing to socket: %s", strerror(errno));
+            return 0;
+        }
+        if((c->hello_done += n) == PROTO_HELLO_LEN){
+            c->state = CONN_ACK;
+            c->hello_done = 0;
+            c->ack_deadline = now_ms() + KEEPALIVE_ACK_TIMEOUT_MS;
+            return 1;
+        }
+        return 0;
+
+    case CONN_ACK:
+        n = recv(c->fd, c->ack + c->hello_done, PROTO_HELLO_LEN - c->hello_done, 0);
+        if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+            if(now_ms() < c->ack_deadline){
+                return 0;
+            }
+            //a server that answered part of it knows the hello, it is broken rather than old
+            if(c->hello_done > 0){
+                conn_fail(c, "Incomplete keep-alive acknowledgement from server");
+                return 0;
+            }
+        }else if(n == -1){
+            conn_fail(c, "Error when reading from socket: %s", strerror(errno));
+            return 0;
+        }else if(n == 0){
+            conn_fail(c, "Connection closed before the keep-alive acknowledgement");
+            return 0;
+        }else if((c->hello_done += n) < PROTO_HELLO_LEN){
+            return 0;
+        }else if(PROTO_HELLO_VERSION(c->ack) > 0 && PROTO_HELLO_VERSION(c->ack) <= c->opts.protocol){
+            c->version = PROTO_HELLO_VERSION(c->ack);
+            smc_receiver_destroy(&c->rx);
+            smc_receiver_init(&c->rx, c->version, c->opts.files, c->dir_fd, c->cache_fd, c->writer);
+            c->connect_us = smc_now_us() - c->connect_begin - c->resolve_us;
+            c->state = CONN_OPEN;
+            c->send = c->head;
+            c->send_off = 0;
+            c->body_sent = 0;
+            return 1;
+        }
+        //no answer in time or a full one that is no acknowledgement:
+        //the server took the hello for a plain request, start over without it
+        close(c->fd);
+        c->fd = -1;
+        c->state = CONN_IDLE;
+        c->keepalive = 0;
+        return 1;
+
+    case CONN_OPEN:
+        if(c->send != NULL && conn_send(c) == -1){
+            return 0;
+        }
+        return conn_recv(c);
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief sends queued requests until the socket is full
+ *
+ * \param c the connection
+ *
+ * \return 0 on success, -1 on error (the requests are failed)
+ *
+ */
+
+static int conn_send(struct smc_conn *c){
+    while(c->send != NULL){
+        struct smc_request *req = c->send;
+        size_t hdr_len = c->version > 0 ? PROTO_FRAME_HEADER : 0;
+        int rc;
+
+        if(c->send_off < hdr_len + req->text_len + req->message_len){
+            const char *base[3] = {(const char *)&c->frame_hdr, req->text, req->message};
+            size_t len[3] = {hdr_len, req->text_len, req->message_len};
+            size_t skip = c->send_off;
+            struct iovec iov[3];
+            struct msghdr msg;
+            ssize_t n;
+
+            if(c->send_off == 0){
+                c->frame_hdr = htonl((uint32_t)(req->text_len + req->message_len + (req->body_len > 0 ? (size_t)req->body_len : 0)));
+                if(req->trace != NULL && req->trace->send_begin == 0){
+                    req->trace->send_begin = smc_now_us();
+                    //the first request on a connection waited for it to be set up
+                    if(!c->connect_traced){
+                        req->trace->resolve_us = c->resolve_us;
+                        req->trace->connect_us = c->connect_us;
+                    }
+                }
+                c->connect_traced = 1;
+            }
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            //frame header, header lines and message, without what a partial send already took
+            for(int i = 0; i < 3; i++){
+                if(skip >= len[i]){
+                    skip -= len[i];
+                    continue;
+                }
+                iov[msg.msg_iovlen].iov_base = (char *)base[i] + skip;
+                iov[msg.msg_iovlen++].iov_len = len[i] - skip;
+                skip = 0;
+            }
+
+            if((n = sendmsg(c->fd, &msg, MSG_NOSIGNAL)) == -1){
+                if(errno == EINTR){
+                    continue;
+                }
+                if(errno == EAGAIN || errno == EWOULDBLOCK){
+                    return 0;
+                }
+                conn_fail(c, "Error when writing to socket: %s", strerror(errno));
+                return -1;
+            }
+            c->send_off += n;
+            continue;
+        }
+
+        if(req->body_fd != -1 && (rc = send_body(c, req)) != 1){
+            return rc;
+        }
+        if(req->trace != NULL){
+            req->trace->send_end = smc_now_us();
+        }
+
+        c->send = req->next;
+        c->send_off = 0;
+        c->body_sent = 0;
+        //shutdown writing, 1 -> further sends are disallowed. a frame ends by its length
+        if(c->version == 0){
+            c->send = NULL;
+            if(shutdown(c->fd, 1)){
+                conn_fail(c, "Error when shutting down socket for writing: %s", strerror(errno));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief sends the message of a request from its body_fd
+ *
+ * uses sendfile(), which moves file pages to the socket inside the kernel.
+ * Inputs sendfile() does not support, like pipes on older kernels, are moved
+ * with splice(); anything else (e.g. a terminal) is copied with read() and
+ * send(). A frame never gets more than the length it announced.
+ *
+ * \param c the connection
+ * \param req the request being sent
+ *
+ * \return 1 when the message is sent, 0 if the socket is full, -1 on error (the requests are failed)
+ *
+ */
+
+static int send_body(struct smc_conn *c, struct smc_request *req){
+    for(;;){
+        size_t want = req->body_len < 0 || req->body_len - c->body_sent > MAX_SENDFILE_SIZE ? MAX_SENDFILE_SIZE : (size_t)(req->body_len - c->body_sent);
+        ssize_t n;
+
+        if(c->copy_off < c->copy_len){
+            n = send(c->fd, c->copy_buf + c->copy_off, c->copy_len - c->copy_off, MSG_NOSIGNAL);
+            if(n > 0){
+                c->copy_off += n;
+                c->body_sent += n;
+                continue;
+            }
+        }else if(want == 0){
+            return 1;
+        }else if(req->method == BODY_SENDFILE){
+            n = sendfile(c->fd, req->body_fd, NULL, want);
+        }else if(req->method == BODY_SPLICE){
+            n = splice(req->body_fd, NULL, c->fd, NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        }else{
+            if(c->copy_buf == NULL && (c->copy_buf = malloc(MAX_CHUNK_SIZE)) == NULL){
+                conn_fail(c, "No memory for sending the message");
+                return -1;
+            }
+            while((n = read(req->body_fd, c->copy_buf, want < MAX_CHUNK_SIZE ? want : MAX_CHUNK_SIZE)) == -1 && errno == EINTR){
+            }
+            if(n > 0){
+                c->copy_off = 0;
+                c->copy_len = n;
+                continue;
+            }
+            if(n == -1){
+                conn_fail(c, "Reading message failed: %s", strerror(errno));
+                return -1;
+            }
+        }
+
+        if(n > 0){
+            c->body_sent += n;
+            continue;
+        }
+        if(n == 0){
+            if(req->body_len < 0){
+                return 1;
+            }
+            conn_fail(c, "Message ended before its announced length");
+            return -1;
+        }
+        if(errno == EINTR){
+            continue;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            return 0;
+        }
+        if(c->body_sent == 0 && req->method != BODY_COPY && (errno == EINVAL || errno == ENOSYS)){
+            req->method++;
+            continue;
+        }
+        conn_fail(c, "Sending message failed: %s", strerror(errno));
+        return -1;
+    }
+}
+
+/**
+ *
+ * \brief reads responses of the requests sent so far
+ *
+ * \param c the connection
+ *
+ * \return 1 if a plain connection was closed after its response, 0 otherwise
+ *
+ */
+
+static int conn_recv(struct smc_conn *c){
+    while(c->head != NULL && (c->head != c->send || c->send_off > 0)){
+        int rc;
+
+        if(c->rx_req != c->head){
+            c->rx_req = c->head;
+            smc_receiver_start(&c->rx, &c->head->cb, c->head->arg);
+            c->rx.trace = c->head->trace;
+        }
+        if((rc = smc_receive(&c->rx, c->fd)) == 0){
+            return 0;
+        }
+        if(rc == -1){
+            conn_fail(c, "%s", c->rx.error);
+            return 0;
+        }
+
+        if(c->rx.corrupt > 0){
+            snprintf(c->error, sizeof(c->error), "%s", c->rx.error);
+        }
+        complete(c, c->rx.corrupt > 0 ? SMC_RESULT_CHECKSUM : 0);
+        if(c->version == 0){
+            close(c->fd);
+            c->fd = -1;
+            c->state = CONN_IDLE;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief drops the socket, the requests stay queued
+ *
+ * \param c the connection
+ *
+ */
+
+static void conn_reset(struct smc_conn *c){
+    if(c->state == CONN_CONNECTING){
+        for(size_t i = 0; i < c->next_addr; i++){
+            if(c->attempt[i].fd != -1){
+                close(c->attempt[i].fd);
+                c->attempt[i].fd = -1;
+            }
+        }
+        c->attempts = 0;
+    }else if(c->fd != -1){
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->state = CONN_IDLE;
+    c->send = NULL;
+    c->send_off = 0;
+    c->body_sent = 0;
+    c->copy_off = c->copy_len = 0;
+    c->rx_req = NULL;
+}
+
+/**
+ *
+ * \brief records an error, drops the socket and fails all outstanding requests
+ *
+ * \param c the connection
+ * \param format printf() format of the message
+ *
+ */
+
+static void conn_fail(struct smc_conn *c, const char *format, ...){
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(c->error, sizeof(c->error), format, args);
+    va_end(args);
+
+    conn_reset(c);
+    //a callback may submit new requests, they are not failed
+    for(long n = c->pending; n > 0; n--){
+        complete(c, -1);
+    }
+}
+
+/**
+ *
+ * \brief removes the oldest request and reports its result
+ *
+ * \param c the connection
+ * \param result 0 on success, -1 on error
+ *
+ */
+
+static void complete(struct smc_conn *c, int result){
+    struct smc_request *req = c->head;
+
+    if((c->head = req->next) == NULL){
+        c->tail = NULL;
+    }
+    if(c->rx_req == req){
+        c->rx_req = NULL;
+    }
+    c->pending--;
+    if(req->trace != NULL){
+        req->trace->end = smc_now_us();
+        req->trace->result = result;
+        req->trace->version = c->version;
+        req->cb.trace(req->arg, req->trace);
+    }
+    if(req->cb.done != NULL){
+        req->cb.done(req->arg, result);
+    }
+    free(req->trace);
+    free(req->text);
+    free(req->copy);
+    free(req);
+}
+
+/**
+ *
+ * \brief monotonic clock in microseconds, the time base of struct smc_trace
+ *
+ * \return current time in microseconds
+ *
+ */
+
+long long smc_now_us(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ *
+ * \brief monotonic clock in milliseconds
+ *
+ * \return current time in milliseconds
+ *
+ */
+
+static long long now_ms(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * =================================================================== eof ==
+ */
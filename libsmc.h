@@ -0,0 +1,276 @@
+/**
+ * @file libsmc.h
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * libsmc - client library for the simple message protocol
+ *
+ * A connection object posts messages to one server without blocking:
+ *
+ *     struct smc_conn *conn = smc_open("localhost", "5000", &opts);
+ *     smc_submit(conn, &msg, &callbacks, ctx);
+ *     while (smc_poll(conn, -1) > 0)
+ *         ;
+ *     smc_close(conn);
+ *
+ * Requests are queued by smc_submit() and carried out by smc_poll(), which
+ * reports the status and the files of every response through the callbacks.
+ * With keep-alive all requests go pipelined over one connection, otherwise
+ * one connection per request is used, one after the other. The addresses of
+ * the server are connected to in parallel, staggered as described in RFC 8305
+ * (happy eyeballs). Files can be written by a background thread so a slow
+ * disk does not hold up the socket, see smc_writer.c. Programs with a poll
+ * loop of their own wait up to smc_timeout() for smc_events() on smc_fd() and
+ * call smc_poll() with a timeout of 0.
+ *
+ * The incremental response parser and the receiver below are the building
+ * blocks of the connection and are used on their own by the load generator
+ * and the benchmarks.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+#ifndef LIBSMC_H
+#define LIBSMC_H
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "simple_message_protocol.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//time the server gets to acknowledge keep-alive before the connection falls back
+#define KEEPALIVE_ACK_TIMEOUT_MS 1000
+//head start of a connect attempt before the next address is tried, as recommended by RFC 8305
+#define SMC_ATTEMPT_DELAY_MS 250
+
+//size of the receive buffer, also used when splice() is not available
+#define MAX_CHUNK_SIZE 65536
+
+//longest header line of a response the parser accepts
+#define SMC_LINE_MAX 1024
+//longest file name of a response the parser accepts
+#define SMC_NAME_MAX 256
+//longest error message of a connection or receiver
+#define SMC_ERROR_MAX 256
+//result of smc_callbacks.done: response complete, but files failed their checksum and were dropped
+#define SMC_RESULT_CHECKSUM (-2)
+//buffers of the background writer, see smc_options.write_buffers
+#define SMC_WRITE_BUFFERS 64
+//largest file stored through the cache, larger ones are only written atomically
+#define SMC_CACHE_FILE_MAX (4L << 20)
+//files of a response whose timings are traced, see struct smc_trace
+#define SMC_TRACE_FILES 16
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//where the files of a response go
+enum smc_files
+{
+    SMC_FILES_DISK,    //stored under their name, see smc_options.dir
+    SMC_FILES_MEMORY,  //passed complete to smc_callbacks.file
+    SMC_FILES_DISCARD  //only reported
+};
+
+//options of a connection
+struct smc_options
+{
+    int keepalive;         //pipeline requests over one connection, falls back to plain requests
+    int protocol;          //highest protocol version offered with keepalive, 0 = PROTO_VERSION_DEFAULT,
+                           //PROTO_VERSION_CRC verifies every file
+    enum smc_files files;
+    const char *dir;       //directory for SMC_FILES_DISK, NULL = working directory
+    int connect_timeout_ms; //give up connecting after this, 0 = when the kernel does
+    int attempt_delay_ms;  //head start of each address, 0 = SMC_ATTEMPT_DELAY_MS
+    long write_buffers;    //SMC_FILES_DISK on a writer thread with this many MAX_CHUNK_SIZE buffers, 0 = inline
+    int sync;              //fdatasync() the files of a response before it is done, implies a writer
+    const char *cache_dir; //content addressed cache for SMC_FILES_DISK, NULL = none,
+                           //takes precedence over the writer, see smc_response.c
+};
+
+//a message to post, copied by smc_submit() unless borrowed
+struct smc_message
+{
+    const char *user;
+    const char *message;   //ignored with body_fd
+    const char *img_url;   //may be NULL
+    int body_fd;           //message is read from here, -1 to send message
+    int borrow;            //message is sent from where it is, not copied; it has to stay valid until the request is done
+};
+
+//a file of a traced response
+struct smc_trace_file
+{
+    char name[SMC_NAME_MAX];
+    long len;
+    long long begin;       //header received
+    long long end;         //content received and stored, or queued with a writer thread
+};
+
+//where the time of a request went, all times in microseconds of smc_now_us()
+struct smc_trace
+{
+    long long submit;      //smc_submit()
+    long long resolve_us;  //getaddrinfo() this request waited for, 0 = addresses known
+    long long connect_us;  //connect() and keep-alive handshake it waited for, 0 = open connection
+    long long send_begin;  //first byte of the request written, 0 = never
+    long long send_end;    //request completely written, 0 = never
+    long long first_byte;  //first byte of the response read, 0 = never
+    long long end;         //response complete or failed
+    int result;            //as passed to smc_callbacks.done
+    int version;           //protocol version of the connection, 0 = plain
+    int files;             //files of the response, the first SMC_TRACE_FILES are in file
+    struct smc_trace_file file[SMC_TRACE_FILES];
+};
+
+//called by smc_poll() for the response of a request, every member may be NULL
+struct smc_callbacks
+{
+    void (*status)(void *arg, long status);
+    //data is the content with SMC_FILES_MEMORY and NULL otherwise
+    void (*file)(void *arg, const char *name, const char *data, long len);
+    //result 0: response complete, -1: failed, SMC_RESULT_CHECKSUM, see smc_error()
+    void (*done)(void *arg, int result);
+    //timings of the request, called right before done; requests are only timed if set
+    void (*trace)(void *arg, const struct smc_trace *trace);
+};
+
+//a connection, see libsmc.c
+struct smc_conn;
+//a background file writer, see smc_writer.c
+struct smc_writer;
+
+//what the response parser found
+enum smc_event_type
+{
+    SMC_EVENT_NEED_MORE,  //all input consumed, feed the next fragment
+    SMC_EVENT_STATUS,     //"status=" line or binary status, see status
+    SMC_EVENT_FILE_BEGIN, //"file=" and "len=" lines or binary file header, see name and len
+    SMC_EVENT_FILE_DATA,  //part of the file content, see data and data_len
+    SMC_EVENT_FILE_END,   //file content complete, see has_crc and crc
+    SMC_EVENT_END,        //well formed end of the response
+    SMC_EVENT_ERROR       //malformed response, see error
+};
+
+struct smc_event
+{
+    enum smc_event_type type;
+    long status;
+    const char *name;     //valid until the next file
+    long len;
+    const char *data;     //points into the fragment passed to smc_parse()
+    size_t data_len;
+    int has_crc;          //the response carries checksums, protocol version 3
+    uint32_t crc;         //CRC-32C of the file content announced by the server
+    const char *error;
+};
+
+enum smc_parser_state
+{
+    SMC_PARSE_STATUS, SMC_PARSE_FILE, SMC_PARSE_LEN, SMC_PARSE_BODY, SMC_PARSE_ERROR,
+    SMC_PARSE_BIN_HEADER, SMC_PARSE_BIN_FILE, SMC_PARSE_BIN_CRC
+};
+
+//incremental response parser, see smc_parser.c
+struct smc_parser
+{
+    enum smc_parser_state state;
+    long body_left;                //bytes of the current file still to come
+    size_t line_len;               //bytes of the current header line so far
+    int binary;                    //protocol version 2 response
+    int checksum;                  //protocol version 3, a checksum follows every file
+    unsigned long files_left;      //files of a binary response still to come
+    char line[SMC_LINE_MAX + 1];
+    char name[SMC_NAME_MAX];
+    const char *error;
+};
+
+//reads responses from a descriptor and stores their files, see smc_response.c
+struct smc_receiver
+{
+    struct smc_parser parser;
+    int version;                   //0: response ends with end of file, else framed
+    enum smc_files files;
+    int dir_fd;                    //SMC_FILES_DISK goes here
+    int cache_fd;                  //cache directory, -1 = none
+    struct smc_writer *writer;     //writes SMC_FILES_DISK if not NULL
+    char tmp_name[64];             //temporary file being written, "" = none
+    unsigned long tmp_seq;
+    uint32_t crc;                  //of the current file so far
+    int corrupt;                   //files of the response dropped for their checksum
+    const struct smc_callbacks *cb;
+    void *arg;
+    struct smc_trace *trace;       //of the current response, NULL = not timed
+    size_t hdr_len;                //bytes of the frame header so far
+    char hdr[PROTO_FRAME_HEADER];
+    long frame_left;               //bytes of the frame not yet parsed
+    int ending;                    //input of the response complete, draining the parser
+    int eof;
+    int file_fd;                   //current file with SMC_FILES_DISK
+    char *mem;                     //current file with SMC_FILES_MEMORY
+    long file_len;
+    long file_have;
+    int pipe_fd[2];                //for splice(), created on first use
+    int no_splice;
+    size_t off;                    //unparsed part of buf
+    size_t len;
+    const char *error;
+    char error_buf[SMC_ERROR_MAX];
+    char buf[MAX_CHUNK_SIZE];
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+struct smc_conn *smc_open(const char *server, const char *port, const struct smc_options *opts);
+int smc_submit(struct smc_conn *conn, const struct smc_message *msg, const struct smc_callbacks *cb, void *arg);
+int smc_poll(struct smc_conn *conn, int timeout_ms);
+int smc_fd(const struct smc_conn *conn);
+short smc_events(const struct smc_conn *conn);
+int smc_timeout(const struct smc_conn *conn);
+long smc_pending(const struct smc_conn *conn);
+int smc_version(const struct smc_conn *conn);
+const char *smc_error(const struct smc_conn *conn);
+void smc_close(struct smc_conn *conn);
+char *smc_build_request(const char *user, const char *message, const char *img_url, size_t *len);
+long long smc_now_us(void);
+
+void smc_receiver_init(struct smc_receiver *r, int version, enum smc_files files, int dir_fd, int cache_fd, struct smc_writer *writer);
+void smc_receiver_start(struct smc_receiver *r, const struct smc_callbacks *cb, void *arg);
+int smc_receive(struct smc_receiver *r, int fd);
+void smc_receiver_destroy(struct smc_receiver *r);
+int smc_write_all(int fd, const char *buf, size_t len);
+
+struct smc_writer *smc_writer_create(long buffers, int sync);
+int smc_writer_write(struct smc_writer *w, int fd, const char *data, size_t len);
+int smc_writer_close(struct smc_writer *w, int fd);
+int smc_writer_drain(struct smc_writer *w);
+const char *smc_writer_error(struct smc_writer *w);
+void smc_writer_destroy(struct smc_writer *w);
+
+void smc_parser_init(struct smc_parser *p, int version);
+size_t smc_parse(struct smc_parser *p, const char *buf, size_t len, struct smc_event *ev);
+void smc_parser_finish(struct smc_parser *p, struct smc_event *ev);
+long smc_parser_body_left(const struct smc_parser *p);
+void smc_parser_skip(struct smc_parser *p, long n);
+
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
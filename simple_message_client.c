@@ -18,50 +18,62 @@
  * -------------------------------------------------------------- includes --
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <simple_message_client_commandline_handling.h>
 #include <sys/types.h>
-#include <sys/socket.h>
 #include <string.h>
 #include <stdlib.h>
-#include <netdb.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "simple_message_client.h"
+#include "simple_message_protocol.h"
 
 
 /*
  * --------------------------------------------------------------- defines --
  */
-#define MAX_CHUNK_SIZE 256
 
 /*
  * -------------------------------------------------------------- typedefs --
  */
+//what the callbacks learn about the request
+struct post_result
+{
+    int result;  //0 response complete, -1 failed
+    int files;   //files received so far
+    const char *user;  //for the trace
+};
 
 /*
  * --------------------------------------------------------------- globals --
  */
-/*
- * --------------------------------------------------------------- static --
- */
+//programm arguments
+const char* sprogram_arg0 = NULL;
+
 //indicates the verbose output
-static int verbose = 0;
+int verbose = 0;
 
-//programm arguments
-static const char* sprogram_arg0 = NULL;
+const char *const trace_phase_names[TRACE_PHASES] = {"dns", "connect", "queue", "send", "ttfb", "receive", "total"};
 
 /*
  * ------------------------------------------------------------- functions --
  */
 static void usage(FILE *stream, const char *name, int exit_code);
-static int sendall(int s, char *buf, int *len);
-static void verbose_printf(int verbosity, const char *format, ...);
-static int send_request(int socket_fd, const char *user, const char *message, const char *img_url);
-static int write_file(char* recv_file_name, FILE *recv_fd, int file_len);
+static void print_status(void *arg, long status);
+static void print_file(void *arg, const char *name, const char *data, long len);
+static void post_done(void *arg, int result);
+static void print_trace(void *arg, const struct smc_trace *trace);
+static void print_json_string(const char *s);
+static char *read_message_file(const char *path);
+static int extract_options(int argc, const char *argv[], const char *rest[], struct client_options *opts);
+static double parse_double(const char *name, const char *arg, double min);
 
 /**
  * \brief This is the main entry point for any C program.
@@ -72,10 +84,10 @@ static int write_file(char* recv_file_name, FILE *recv_fd, int file_len);
  * \return returns success or error
  * \retval EXIT_SUCCESS returned on success
  * \retval EXIT_FAILURE returned on error
+ * \retval EXIT_CHECKSUM returned if a received file failed its checksum
  */
 int main(int argc, const char *argv[])
 {
-    int socket_fd;
     int state;     //for checking several return values
     
     const char* server;
@@ -84,258 +96,219 @@ int main(int argc, const char *argv[])
     const char* message;
     const char* image_url;
 
-    void *ip_src;
-    int ipv;
-    char ip_dst[INET6_ADDRSTRLEN];    
+    struct client_options copts;
+    const char *smc_argv[argc + 3];
+    char *body = NULL;
+    struct smc_options lib_opts;
+    struct smc_message msg;
+    struct smc_callbacks callbacks = {print_status, print_file, post_done, NULL};
+    struct post_result result = {-1, 0, NULL};
+    struct smc_conn *conn;
     
     sprogram_arg0 = argv[0];
 
-    smc_parsecommandline(argc, argv, usage, &server, &port, &user, &message, &image_url, &verbose);
+    //our own options first, smc_parsecommandline() rejects options it does not know
+    argc = extract_options(argc, argv, smc_argv, &copts);
+    smc_parsecommandline(argc, smc_argv, usage, &server, &port, &user, &message, &image_url, &verbose);
     verbose_printf(verbose, "[%s, %s(), line %d]: Using the following options: server=\"%s\" port=\"%s\", user=\"%s\", img_url=\"%s\", message=\"%s\"\n", __FILE__, __func__, __LINE__, server, port, user, image_url, message);
-    
-    struct addrinfo hints;
-    struct addrinfo *servinfo;
-    struct addrinfo *loop_serverinfo;  // will point to the results
 
-    memset(&hints, 0, sizeof hints); // make sure the struct is empty
-    hints.ai_family = AF_UNSPEC;     // don't care IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // TCP stream sockets
-    
-    if ((state = getaddrinfo(server, port, &hints, &servinfo)) != 0) {
-        fprintf(stderr, "%s: Could not obtain address information: %s\n", sprogram_arg0, gai_strerror(state));
-        return EXIT_FAILURE;
-    }  
-        
-    //get ip or ipv6 address
-    for(loop_serverinfo = servinfo; loop_serverinfo != NULL; loop_serverinfo = loop_serverinfo->ai_next) {
-
-        if (loop_serverinfo->ai_family == AF_INET) {
-            struct sockaddr_in *ipv4 = (struct sockaddr_in *)loop_serverinfo->ai_addr;
-            ip_src = &(ipv4->sin_addr);
-            ipv = 4;
-        } else {
-            struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *)loop_serverinfo->ai_addr;
-            ip_src = &(ipv6->sin6_addr);
-            ipv = 6;
+    if(copts.load){
+        size_t request_len;
+        char *request;
+
+        //every request of the load generator sends the same body, so read it once
+        if(copts.message_file != NULL && (message = body = read_message_file(copts.message_file)) == NULL){
+            return EXIT_FAILURE;
         }
-        /* convert the IP to a string and print it: */
-        if ((inet_ntop(loop_serverinfo->ai_family, ip_src, ip_dst, sizeof ip_dst)) == NULL) {
-            fprintf(stderr, "%s: Could not convert IP to string: %s\n", sprogram_arg0, strerror(errno));
+        request = smc_build_request(user, message, image_url, &request_len);
+        free(body);
+        if(request == NULL){
+            fprintf(stderr, "%s: malloc() for message to send failed.\n", sprogram_arg0);
             return EXIT_FAILURE;
         }
+        state = run_load(server, port, request, request_len, &copts.load_opts);
+        free(request);
+        return state;
+    }
 
-        verbose_printf(verbose, "[%s, %s(), line %d]: Obtained IPv%d address %s, port number %s for server %s and port %s\n", __FILE__, __func__, __LINE__, ipv, ip_dst, port, server, port);
-        
-        socket_fd = socket(loop_serverinfo->ai_family, loop_serverinfo->ai_socktype, loop_serverinfo->ai_protocol);
-        
-        if(socket_fd == -1){
-            verbose_printf(verbose, "[%s, %s(), line %d]: %s\n", __FILE__, __func__, __LINE__, strerror(errno));
-	    continue;
-        }
+    if(copts.batch != NULL){
+        struct batch_options batch_opts;
+
+        batch_opts.path = copts.batch;
+        batch_opts.ordered = copts.ordered;
+        batch_opts.connections = copts.load_opts.connections;
+        batch_opts.window = copts.load_opts.pipeline;
+        batch_opts.keepalive = copts.keepalive;
+        batch_opts.protocol = copts.protocol;
+        batch_opts.connect_timeout_ms = (int)(copts.connect_timeout * 1000);
+        batch_opts.trace = copts.trace;
+        return run_batch(server, port, user, image_url, &batch_opts);
+    }
 
-        verbose_printf(verbose, "[%s, %s(), line %d]: Created IPv%d socket\n", __FILE__, __func__, __LINE__, ipv);
+    memset(&lib_opts, 0, sizeof(lib_opts));
+    lib_opts.keepalive = copts.keepalive;
+    lib_opts.protocol = copts.protocol;
+    lib_opts.files = SMC_FILES_DISK;
+    lib_opts.connect_timeout_ms = (int)(copts.connect_timeout * 1000);
+    lib_opts.write_buffers = copts.write_buffers;
+    lib_opts.sync = copts.sync;
+    lib_opts.cache_dir = copts.cache_dir;
+    msg.user = user;
+    msg.message = message;
+    msg.img_url = image_url;
+    msg.body_fd = -1;
+    //argv and the message read from a file outlive the request, sent without a copy
+    msg.borrow = 1;
+    result.user = user;
+    if(copts.trace){
+        callbacks.trace = print_trace;
+    }
 
-        if(connect(socket_fd, loop_serverinfo->ai_addr, loop_serverinfo->ai_addrlen) < 0){
-            verbose_printf(verbose, "[%s, %s(), line %d]: %s\n", __FILE__, __func__, __LINE__,strerror(errno));
-            close(socket_fd);
-            continue;
+    if(copts.message_file != NULL){
+        int from_stdin = strcmp(copts.message_file, "-") == 0;
+        struct stat st;
+
+        //a frame needs the length up front, only regular files can be streamed then
+        if(copts.keepalive && (from_stdin ? fstat(STDIN_FILENO, &st) : stat(copts.message_file, &st)) == 0 && !S_ISREG(st.st_mode)){
+            if((msg.message = body = read_message_file(copts.message_file)) == NULL){
+                return EXIT_FAILURE;
+            }
+        }else if((msg.body_fd = from_stdin ? STDIN_FILENO : open(copts.message_file, O_RDONLY | O_CLOEXEC)) == -1){
+            fprintf(stderr, "%s: Could not open \"%s\": %s\n", sprogram_arg0, copts.message_file, strerror(errno));
+            return EXIT_FAILURE;
         }
-        
-        verbose_printf(verbose, "[%s, %s(), line %d]: Connected to port %s (%s) of server %s (%s)\n", __FILE__, __func__, __LINE__, port, port, server, ip_dst );
-        break; //success
     }
 
-    freeaddrinfo(servinfo); // free the linked-list, no longer needed
-
-    if(loop_serverinfo == NULL){
-        fprintf(stderr, "%s: Could not connect\n", sprogram_arg0);
-	//socket is not open here, so do not close it
-        return EXIT_FAILURE;
+    if((conn = smc_open(server, port, &lib_opts)) == NULL || smc_submit(conn, &msg, &callbacks, &result) == -1){
+        fprintf(stderr, "%s: Could not set up the request: %s\n", sprogram_arg0, strerror(errno));
+    }else{
+        verbose_printf(verbose, "[%s, %s(), line %d]: Going to send the request for user \"%s\"\n", __FILE__, __func__, __LINE__, user);
+        while((state = smc_poll(conn, -1)) > 0){
+        }
+        if(state == -1){
+            fprintf(stderr, "%s: poll() failed: %s\n", sprogram_arg0, strerror(errno));
+        }else if(result.result != 0){
+            fprintf(stderr, "%s: %s\n", sprogram_arg0, smc_error(conn));
+        }else{
+            verbose_printf(verbose, "[%s, %s(), line %d]: Response complete, keep-alive protocol version %d\n", __FILE__, __func__, __LINE__, smc_version(conn));
+            if(copts.protocol >= PROTO_VERSION_CRC && smc_version(conn) < PROTO_VERSION_CRC){
+                fprintf(stderr, "%s: The server does not send checksums, files were not verified\n", sprogram_arg0);
+            }
+        }
     }
-      
-    if(send_request(socket_fd, user, message, image_url) == -1){
-        fprintf(stderr, "%s: Error when writing to socket\n", sprogram_arg0);
-        close(socket_fd);
-        return EXIT_FAILURE;
+
+    smc_close(conn);
+    if(msg.body_fd > STDIN_FILENO){
+        close(msg.body_fd);
     }
-   
-    verbose_printf(verbose, "[%s, %s(), line %d]: Sent request user=\"%s\", img_url=\"%s\", message=\"%s\" \n", __FILE__, __func__, __LINE__, user, image_url, message);
-   
-    //shutdown writing, 1 -> further sends are disallowed
-    if(shutdown(socket_fd, 1)){
-        fprintf(stderr, "%s: Error when shutting down socket for writing: %s\n", sprogram_arg0, strerror(errno));
-        close(socket_fd);
-        return EXIT_FAILURE;
+    free(body);
+    if(result.result == SMC_RESULT_CHECKSUM){
+        return EXIT_CHECKSUM;
     }
-    verbose_printf(verbose, "[%s, %s(), line %d]: Closed write part of socket\n", __FILE__, __func__, __LINE__);
-    
-    
-    //read starts here
+    return result.result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    char* line = NULL, *pch = NULL;
-    char *recv_file_name = NULL;//, *recv_img_name = NULL;
-    size_t allocated_size;
-    
-    long file_len = 0;//, img_len = 0;
-    long status;
-    
-    FILE *recv_fd;
-    recv_fd = fdopen(socket_fd,"r");
-    
-    if (recv_fd == NULL) {
-       fprintf(stderr, "%s: Error when shutting down socket for writing: %s\n", sprogram_arg0, strerror(errno));
-       close(socket_fd); 
-       return EXIT_FAILURE;
-    }
-    
-    //get status=...
-    //get len=...
-    if(getline(&line, &allocated_size, recv_fd) == -1){
-        fprintf(stderr, "%s: Error when getting line for \"status=\"\n", sprogram_arg0);
-        fclose(recv_fd);
-        close(socket_fd); 
-        free(line);
-        return EXIT_FAILURE;
+/**
+ *
+ * \brief reports the status of the response, callback of libsmc
+ *
+ * \param arg the struct post_result of main()
+ * \param status the status sent by the server
+ *
+ */
+
+static void print_status(void *arg, long status){
+    (void)arg;
+    verbose_printf(verbose, "[%s, %s(), line %d]: Obtained status information \"%ld\" from server\n", __FILE__, __func__, __LINE__, status);
+}
+
+/**
+ *
+ * \brief reports a file of the response, callback of libsmc
+ *
+ * \param arg the struct post_result of main()
+ * \param name name of the file, stored in the working directory
+ * \param data NULL, the file is on disk
+ * \param len length of the file
+ *
+ */
+
+static void print_file(void *arg, const char *name, const char *data, long len){
+    struct post_result *result = arg;
+
+    (void)data;
+    verbose_printf(verbose, "[%s, %s(), line %d]:  Processed file %d (%s, \"%s\", %ld bytes) in server response\n", __FILE__, __func__, __LINE__,
+                   result->files, result->files == 0 ? "mandatory" : "optional", name, len);
+    result->files++;
+}
+
+/**
+ *
+ * \brief records the result of the request, callback of libsmc
+ *
+ * \param arg the struct post_result of main()
+ * \param result 0 if the response is complete, -1 on error
+ *
+ */
+
+static void post_done(void *arg, int result){
+    ((struct post_result *)arg)->result = result;
+}
+
+/**
+ *
+ * \brief prints the timings of the request as one line of JSON, callback of libsmc
+ *
+ * \param arg the struct post_result of main()
+ * \param trace the timings
+ *
+ */
+
+static void print_trace(void *arg, const struct smc_trace *trace){
+    struct post_result *result = arg;
+    long long us[TRACE_PHASES];
+
+    trace_phases(trace, us);
+    printf("{\"user\":");
+    print_json_string(result->user);
+    printf(",\"result\":\"%s\",\"protocol\":%d", trace->result == 0 ? "ok" : trace->result == SMC_RESULT_CHECKSUM ? "checksum" : "failed", trace->version);
+    for(int i = 0; i < TRACE_PHASES; i++){
+        printf(",\"%s_us\":%lld", trace_phase_names[i], us[i]);
     }
-        
-    //set pch to the file length
-    pch = strstr(line, "status=");
-    if((pch == NULL)){
-        fprintf(stderr, "%s: Could not find \"status=\".\n", sprogram_arg0);
-        fclose(recv_fd);
-        close(socket_fd); 
-        free(line);
-        return EXIT_FAILURE;        
+    printf(",\"files\":[");
+    for(int i = 0; i < trace->files && i < SMC_TRACE_FILES; i++){
+        const struct smc_trace_file *file = &trace->file[i];
+
+        printf("%s{\"name\":", i > 0 ? "," : "");
+        print_json_string(file->name);
+        printf(",\"bytes\":%ld,\"us\":%lld}", file->len, file->end > 0 ? file->end - file->begin : -1);
     }
-        
-    verbose_printf(verbose, "[%s, %s(), line %d]: Obtained response \"%s\" from server\n", __FILE__, __func__, __LINE__, line);
-        
-    pch = pch + strlen("status=");     //point to length
-    status = strtol(pch, NULL, 10);
-    
-    if((file_len == LONG_MIN || file_len == LONG_MAX) && errno == ERANGE){
-        fprintf(stderr, "%s: Could not convert status \"status=\" to long.\n", sprogram_arg0);
-        fclose(recv_fd);
-        close(socket_fd); 
-        free(line);
-        return EXIT_FAILURE;          
-    }        
-    
-    verbose_printf(verbose, "[%s, %s(), line %d]: Obtained status information \"%ld\" from server\n", __FILE__, __func__, __LINE__, status);
-        
-    
-    //get file=...
-    
-    int rcvd_file_counter = 0;
-    
-    while(getline(&line, &allocated_size, recv_fd) != -1){ //check for error
-            
-        //set pch to the filename
-        pch = strstr(line, "file=");
-
-        if((pch == NULL)){
-            fprintf(stderr, "%s: Could not find \"file=\".\n", sprogram_arg0);        
-            fclose(recv_fd);
-            close(socket_fd);
-            free(line);
-            return EXIT_FAILURE;        
-        }
-        verbose_printf(verbose, "[%s, %s(), line %d]: Obtained response \"%s\" from server\n", __FILE__, __func__, __LINE__, line);
-        
-        
-        pch = pch + strlen("file=");     //point to filename
-
-        recv_file_name = (char*)malloc((strchr(pch,'\n')-pch+1));
-        if(recv_file_name == NULL){
-            fprintf(stderr, "%s: malloc() for file name failed.\n", sprogram_arg0);        
-            fclose(recv_fd);
-            close(socket_fd); 
-            free(line);
-            return EXIT_FAILURE;
-        }   
-        
-        strncpy(recv_file_name, pch, (strchr(pch,'\n')-pch+1));
-        recv_file_name[(strchr(pch,'\n')-pch)] = '\0'; //do we need this?    
-        
-        verbose_printf(verbose, "[%s, %s(), line %d]: Wellformed server response \"%s\".\n", __FILE__, __func__, __LINE__, recv_file_name);
-        
-        //get len=...
-        if(getline(&line, &allocated_size, recv_fd) == -1){
-            fprintf(stderr, "%s: Error when getting line for \"len=\"\n", sprogram_arg0);
-            fclose(recv_fd);
-            close(socket_fd); 
-            free(line);
-            free(recv_file_name);
-            return EXIT_FAILURE;
-        }
-        
-        //set pch to the file length
-        pch = strstr(line, "len=");
-        if((pch == NULL)){
-            fprintf(stderr, "%s: Could not find \"len=\".\n", sprogram_arg0);
-            fclose(recv_fd);
-            close(socket_fd); 
-            free(line);
-            free(recv_file_name);
-            return EXIT_FAILURE;        
-        }
-        
-        verbose_printf(verbose, "[%s, %s(), line %d]: Obtained response \"%s\" from server\n", __FILE__, __func__, __LINE__, line);
-        
+    printf("]}\n");
+    fflush(stdout);
+}
 
-        pch = pch + strlen("len=");     //point to length
-        
-        file_len = strtol(pch, NULL, 10);
-        if((file_len == LONG_MIN || file_len == LONG_MAX) && errno == ERANGE){
-            fprintf(stderr, "%s: Could not convert \"len=\" to long.\n", sprogram_arg0);
-            fclose(recv_fd);
-            close(socket_fd);
-            free(line);
-            free(recv_file_name);
-            return EXIT_FAILURE;          
-        }    
-        
-        verbose_printf(verbose, "[%s, %s(), line %d]: Wellformed server response \"%d\".\n", __FILE__, __func__, __LINE__, file_len);
-        
+/**
+ *
+ * \brief prints a string as a JSON string literal
+ *
+ * \param s the string
+ *
+ */
 
-        if(write_file(recv_file_name, recv_fd, file_len) == EXIT_FAILURE){
-            fprintf(stderr, "%s: Could not write file.\n", sprogram_arg0);
-            fclose(recv_fd);
-            close(socket_fd);
-            free(line);
-            free(recv_file_name);
-            return EXIT_FAILURE;  
-        }
-        free(recv_file_name);
-        
-        if(rcvd_file_counter > 0){
-            verbose_printf(verbose, "[%s, %s(), line %d]:  Processed file %d (optional) in server response\n", __FILE__, __func__, __LINE__, rcvd_file_counter);
-        }else{
-            if(rcvd_file_counter == 0){
-                verbose_printf(verbose, "[%s, %s(), line %d]:  Processed file %d (mandatory) in server response\n", __FILE__, __func__, __LINE__, rcvd_file_counter);                
-            }
-        }
+static void print_json_string(const char *s){
+    putchar('"');
+    for(; *s != '\0'; s++){
+        unsigned char c = *s;
 
-        if(rcvd_file_counter == (INT_MAX)){
-            fprintf(stderr, "%s: Received too many files\n", sprogram_arg0);
-            fclose(recv_fd);
-            close(socket_fd);
-            free(line);
-            return EXIT_FAILURE;          
+        if(c == '"' || c == '\\'){
+            printf("\\%c", c);
+        }else if(c < 0x20){
+            printf("\\u%04x", c);
+        }else{
+            putchar(c);
         }
-        
-        rcvd_file_counter++;
     }
-    fclose(recv_fd);
-    verbose_printf(verbose, "[%s, %s(), line %d]: Closed filedescriptor\n", __FILE__, __func__, __LINE__);
-    
-    close(socket_fd);
-    verbose_printf(verbose, "[%s, %s(), line %d]: Closed socket\n", __FILE__, __func__, __LINE__, recv_file_name);
-    
-    free(line);
-    //free(recv_img_name);
-
-    return  EXIT_SUCCESS;
+    putchar('"');
 }
 
 /**
@@ -360,7 +333,40 @@ static void usage(FILE *stream, const char *name, int exit_code) {
         -i, --image <URL>       URL pointing to an image of the posting user\n\
         -m, --message <message> message to be added to the bulletin board\n\
         -v, --verbose           verbose output\n\
-        -h, --help\n", name) < 0){
+        -h, --help\n\
+        --message-file <file>   send the content of file (\"-\" for stdin) as message instead of -m\n\
+        --keepalive             use a keep-alive connection, falls back to plain requests\n\
+        --protocol <n>          highest protocol version offered with --keepalive, 1 = text,\n\
+                                2 = binary responses, 3 = binary with checksums (default %d)\n\
+        --checksum              verify every received file with a CRC-32C sent by the server,\n\
+                                same as --keepalive --protocol 3; exits with %d on a mismatch\n\
+        --connect-timeout <seconds> give up connecting after the given time, the addresses of\n\
+                                the server are tried in parallel (default: as long as TCP tries)\n\
+        --write-buffers <n>     write the received files on a background thread with n buffers\n\
+                                of 64 KB, so a slow disk does not hold up the connection\n\
+        --sync                  fdatasync() the received files before reporting success,\n\
+                                on the background thread (with %d buffers by default)\n\
+        --cache <dir>           keep the received files in dir by content; a file that is\n\
+                                already there is hard linked instead of written again, every\n\
+                                file is replaced atomically (overrides --write-buffers)\n\
+        --trace                 time the phases of the request (dns, connect, queue, send,\n\
+                                ttfb, receive, total and every file) and print them as JSON;\n\
+                                aggregated per phase with --batch, connect and ttfb with --load\n\
+        load generator:\n\
+        --load                  post the message repeatedly and report throughput and latency\n\
+        --connections <n>       concurrent connections (default %d)\n\
+        --requests <n>          requests in total (default %d, unlimited with --duration)\n\
+        --duration <seconds>    run for the given time\n\
+        --rate <n>              target requests per second (default as fast as possible)\n\
+        --pipeline <n>          requests in flight per keep-alive connection (default %d)\n\
+        batch posting:\n\
+        --batch <file>          post one message per line of file (\"-\" for stdin), given as\n\
+                                user<TAB>image URL<TAB>message, empty fields take -u and -i,\n\
+                                \\n, \\t and \\\\ in the message stand for newline, tab and\n\
+                                backslash; uses --connections and --pipeline, prints the\n\
+                                result of every record\n\
+        --ordered               post the records of each user in input order\n", name,
+        PROTO_VERSION_DEFAULT, EXIT_CHECKSUM, SMC_WRITE_BUFFERS, LOAD_DEFAULT_CONNECTIONS, LOAD_DEFAULT_REQUESTS, LOAD_DEFAULT_PIPELINE) < 0){
         
         fprintf(stderr, "%s: Writing to stdout failed.\n", sprogram_arg0);
     }
@@ -370,194 +376,212 @@ static void usage(FILE *stream, const char *name, int exit_code) {
 
 /**
  *
- * \brief prepares and sends a request
- *
- * assembles the message for the request depending on the passed parameters
- * and writes it to the passed socked_fd. 
+ * \brief reads a whole message file into memory
  *
- * \param socket_fd
- * \param user user to send
- * \param message message to send
- * \param img_url the url of the image. this can be null.
+ * \param path the file, "-" for stdin
  *
- * \return returns success or error
- * \retval EXIT_SUCCESS returned on success
- * \retval EXIT_FAILURE returned on error
+ * \return the message allocated with malloc() or NULL on error
  *
  */
 
-static int send_request(int socket_fd, const char *user, const char *message, const char *img_url){
-    int len;            //length of the message to send
-    char* conc_message; //message to send
-    
-    // calculate message size
-    if (img_url) {
-	//with img_url
-        len = strlen("user=") + strlen(user) + strlen("\nimg=") + strlen(img_url) + strlen("\n") + strlen(message);
-    }else {
-	//no img_url
-	len = strlen("user=") + strlen(user) + strlen("\n") + strlen(message);
-    }
-    
-    conc_message = (char*) malloc(len+1);
-    
-    if (conc_message == NULL) {
-        fprintf(stderr, "%s: malloc() for message to send failed.\n", sprogram_arg0);
-	return EXIT_FAILURE;
+static char *read_message_file(const char *path){
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char *message = NULL;
+    size_t size = 0;
+    FILE *mem;
+
+    if (f == NULL) {
+        fprintf(stderr, "%s: Could not open \"%s\": %s\n", sprogram_arg0, path, strerror(errno));
+        return NULL;
     }
-    
-    //build message
-    if (img_url == NULL) {
-	//no image
-	if(sprintf(conc_message, "user=%s\n%s", user, message) < 0){
-            fprintf(stderr, "%s: Writing message failed.\n", sprogram_arg0);
-            free(conc_message);
-            return EXIT_FAILURE;
-        }
-    } 
-    else {
-	// with image
-	if(sprintf(conc_message, "user=%s\nimg=%s\n%s", user, img_url, message) < 0){
-            fprintf(stderr, "%s: Writing message failed.\n", sprogram_arg0);
-            free(conc_message);
-            return EXIT_FAILURE;
+    if ((mem = open_memstream(&message, &size)) == NULL) {
+        fprintf(stderr, "%s: open_memstream() failed: %s\n", sprogram_arg0, strerror(errno));
+        if (f != stdin) {
+            fclose(f);
         }
+        return NULL;
     }
-	
-    verbose_printf(verbose, "[%s, %s(), line %d]: Going to send the following message consisting of %d bytes ...\n%s\n", __FILE__, __func__, __LINE__, len, conc_message);
-    
-    if (sendall(socket_fd, conc_message, &len) == -1) {
-        fprintf(stderr, "%s: Writing message failed.\n", __FILE__);
-        free(conc_message);
-        return EXIT_FAILURE;
+
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        fwrite(buf, 1, n, mem);
     }
-    
-    free(conc_message);
-    
-    return 0;
+    if (ferror(f) || fclose(mem) != 0) {
+        fprintf(stderr, "%s: Reading \"%s\" failed\n", sprogram_arg0, path);
+        free(message);
+        message = NULL;
+    }
+    if (f != stdin) {
+        fclose(f);
+    }
+    return message;
 }
 
 /**
  *
- * \brief writes all the passed data in the buffer to passed socket
+ * \brief takes the load generator options out of the command line
  *
- * writes all the data from the buffer, so that there is nothing left.
- * this one is taken from beej's guide to network programming
- * https://beej.us/guide/bgnet/output/html/singlepage/bgnet.html#sendall
+ * smc_parsecommandline() rejects unknown options, so --load, --connections,
+ * --requests, --duration, --rate, --message-file, --connect-timeout, --batch,
+ * --ordered, --write-buffers, --sync, --cache, --checksum and --trace (as "--opt
+ * value" or "--opt=value") are handled here and everything else is copied to
+ * rest for it.
  *
- * \param s socket to write the data to
- * \param buf data that has to be written
- * \param len number of bytes to write
+ * \param argc the number of arguments
+ * \param argv the arguments
+ * \param rest receives the remaining arguments, must hold argc + 3 entries
+ * \param opts receives the options found
  *
- * \return returns success or error
- * \retval -1 returned on error
- * \retval 0 retruned on success
+ * \return the number of arguments left in rest
  *
  */
 
-static int sendall(int s, char *buf, int *len)
-{
-    int total = 0;        // how many bytes we've sent
-    int bytesleft = *len; // how many we have left to send
-    int n;
-
-    while(total < *len) {
-        n = send(s, buf+total, bytesleft, 0);
-        if (n == -1) { break; }
-        total += n;
-        bytesleft -= n;
+static int extract_options(int argc, const char *argv[], const char *rest[], struct client_options *opts){
+    static const char *const names[] = {"--connections", "--requests", "--duration", "--rate", "--pipeline", "--protocol", "--message-file", "--connect-timeout", "--batch", "--write-buffers", "--cache"};
+    int rest_count = 0;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->load_opts.connections = LOAD_DEFAULT_CONNECTIONS;
+    opts->load_opts.requests = -1;
+    opts->load_opts.pipeline = LOAD_DEFAULT_PIPELINE;
+    opts->protocol = opts->load_opts.protocol = PROTO_VERSION_DEFAULT;
+
+    for(int i = 0; i < argc; i++){
+        const char *value = NULL;
+        size_t k;
+
+        if(i > 0 && strcmp(argv[i], "--load") == 0){
+            opts->load = 1;
+            continue;
+        }
+        if(i > 0 && strcmp(argv[i], "--keepalive") == 0){
+            opts->keepalive = opts->load_opts.keepalive = 1;
+            continue;
+        }
+        if(i > 0 && strcmp(argv[i], "--ordered") == 0){
+            opts->ordered = 1;
+            continue;
+        }
+        if(i > 0 && strcmp(argv[i], "--checksum") == 0){
+            opts->keepalive = opts->load_opts.keepalive = 1;
+            opts->protocol = opts->load_opts.protocol = PROTO_VERSION_CRC;
+            continue;
+        }
+        if(i > 0 && strcmp(argv[i], "--sync") == 0){
+            opts->sync = 1;
+            continue;
+        }
+        if(i > 0 && strcmp(argv[i], "--trace") == 0){
+            opts->trace = opts->load_opts.trace = 1;
+            continue;
+        }
+
+        for(k = 0; i > 0 && k < sizeof(names) / sizeof(names[0]); k++){
+            size_t name_len = strlen(names[k]);
+
+            if(strncmp(argv[i], names[k], name_len) != 0){
+                continue;
+            }
+            if(argv[i][name_len] == '='){
+                value = argv[i] + name_len + 1;
+                break;
+            }
+            if(argv[i][name_len] == '\0'){
+                if(i + 1 >= argc){
+                    usage(stderr, argv[0], EXIT_FAILURE);
+                }
+                value = argv[++i];
+                break;
+            }
+        }
+
+        if(value == NULL){
+            rest[rest_count++] = argv[i];
+            continue;
+        }
+
+        switch(k){
+        case 0:
+            opts->load_opts.connections = (long)parse_double(names[k], value, 1);
+            break;
+        case 1:
+            opts->load_opts.requests = (long)parse_double(names[k], value, 1);
+            break;
+        case 2:
+            opts->load_opts.duration = parse_double(names[k], value, 0);
+            break;
+        case 3:
+            opts->load_opts.rate = parse_double(names[k], value, 0);
+            break;
+        case 4:
+            opts->load_opts.pipeline = (long)parse_double(names[k], value, 1);
+            break;
+        case 5:
+            opts->protocol = opts->load_opts.protocol = (int)parse_double(names[k], value, PROTO_VERSION_TEXT);
+            if(opts->protocol > PROTO_VERSION_MAX){
+                fprintf(stderr, "%s: --protocol must be at most %d\n", sprogram_arg0, PROTO_VERSION_MAX);
+                usage(stderr, argv[0], EXIT_FAILURE);
+            }
+            break;
+        case 6:
+            opts->message_file = value;
+            break;
+        case 7:
+            opts->connect_timeout = parse_double(names[k], value, 0.001);
+            break;
+        case 8:
+            opts->batch = value;
+            break;
+        case 9:
+            opts->write_buffers = (long)parse_double(names[k], value, 2);
+            break;
+        default:
+            opts->cache_dir = value;
+            break;
+        }
     }
 
-    *len = total; // return number actually sent here
+    //smc_parsecommandline() insists on -m, the message file or the batch replaces it
+    if(opts->message_file != NULL || opts->batch != NULL){
+        memmove(&rest[3], &rest[1], (rest_count - 1) * sizeof(rest[0]));
+        rest[1] = "-m";
+        rest[2] = "";
+        rest_count += 2;
+    }
+    rest[rest_count] = NULL;
 
-    return n==-1?-1:0; // return -1 on failure, 0 on success
-} 
+    //a fixed duration runs until the time is up unless a request count is given too
+    if(opts->load_opts.requests < 0){
+        opts->load_opts.requests = opts->load_opts.duration > 0 ? 0 : LOAD_DEFAULT_REQUESTS;
+    }
+
+    return rest_count;
+}
 
 /**
  *
- * \brief reads data from passed file descriptor and writes it to a file
+ * \brief converts an option value to a number, terminates the process on invalid input
  *
- * reads data from recv_fd in chunks and writes it to a file named recv_file_name
- * chunkwise.
+ * \param name name of the option, for the error message
+ * \param arg value of the option
+ * \param min smallest accepted value
  *
- * \param recv_file_name name of the file to write the data to
- * \param recv_fd file descriptor the data is read from
- * \param file_len expected length of the data to read and write
- *
- * \return void
- * \retval void
+ * \return the value
  *
  */
 
-static int write_file(char* recv_file_name, FILE *recv_fd, int file_len){
-    char buf[MAX_CHUNK_SIZE];
-    FILE *f;
-    int chunk_number = file_len / MAX_CHUNK_SIZE;
-    int last_chunk = file_len - ( MAX_CHUNK_SIZE * chunk_number);
-    
-    verbose_printf(verbose, "[%s, %s(), line %d]: Opening file \"%s\" for writing of %d bytes in %d chucks @%d bytes and a last remainder chunk @%d bytes ...\n", __FILE__, __func__, __LINE__, recv_file_name, file_len, chunk_number, MAX_CHUNK_SIZE, last_chunk);
-    
-    f = fopen(recv_file_name, "w+");
-    
-    if (f == NULL)
-    {
-        fprintf(stderr, "%s: Opening file failed.\n", sprogram_arg0);
-        return EXIT_FAILURE;
-    }
-    
-    verbose_printf(verbose, "[%s, %s(), line %d]: Opened file \"%s\" for writing of %d bytes in %d chucks @%d bytes and a last remainder chunk @%d bytes ...\n", __FILE__, __func__, __LINE__, recv_file_name, file_len, chunk_number, MAX_CHUNK_SIZE, last_chunk);
-    
-    int bytes_written= 0;
-    int bytes_read = 0;
-    
-    int read_chunk_size = 0;
-    int write_chunk_size = 0;
-    
-    for(int i = 0; i <= chunk_number; i++){
-    //while(bytes_read != file_len && bytes_written != file_len){
-        
-        if(file_len - bytes_read > MAX_CHUNK_SIZE){ // >=????
-            read_chunk_size = MAX_CHUNK_SIZE;
-        }else{
-            read_chunk_size = file_len - bytes_read;
-        }
-        
-        read_chunk_size = fread(buf,sizeof(char),read_chunk_size, recv_fd);
-        
-        if (read_chunk_size == 0) {
-            fprintf(stderr, "%s: Cannot read from socket\n", sprogram_arg0);
-            if(fclose(f)){
-                fprintf(stderr, "%s: Closing file failed: %s.\n", sprogram_arg0, strerror(errno));
-                return EXIT_FAILURE;    
-            }
-            return EXIT_FAILURE;
-        }
-        
-        write_chunk_size = fwrite(buf, sizeof(char), read_chunk_size, f);
-        
-        if(read_chunk_size != write_chunk_size){
-            fprintf(stderr, "%s: Writing file failed.\n", sprogram_arg0);
-            if(fclose(f)){
-                fprintf(stderr, "%s: Closing file failed: %s.\n", sprogram_arg0, strerror(errno));
-                return EXIT_FAILURE;    
-            }
-            return EXIT_FAILURE;
-        }
-        
-        bytes_read += read_chunk_size;
-        bytes_written += write_chunk_size;
+static double parse_double(const char *name, const char *arg, double min){
+    char *end;
+    double value;
 
-        verbose_printf(verbose, "[%s, %s(), line %d]: Copied chunk %d @%d bytes ...\n", __FILE__, __func__, __LINE__, i, write_chunk_size);
-        
+    errno = 0;
+    value = strtod(arg, &end);
+    if(end == arg || *end != '\0' || errno == ERANGE || !(value >= min && value <= LONG_MAX)){
+        fprintf(stderr, "%s: Invalid value \"%s\" for %s\n", sprogram_arg0, arg, name);
+        usage(stderr, sprogram_arg0, EXIT_FAILURE);
     }
-    
-    if(fclose(f)){
-        fprintf(stderr, "%s: Closing file \"%s\" failed \n", sprogram_arg0, recv_file_name);
-        return EXIT_FAILURE;    
-    }
-    verbose_printf(verbose, "[%s, %s(), line %d]: Closed file \"%s\"\n", __FILE__, __func__, __LINE__, recv_file_name);
-    
-    return EXIT_SUCCESS;
+    return value;
 }
 
 /**
@@ -574,7 +598,7 @@ static int write_file(char* recv_file_name, FILE *recv_fd, int file_len){
  * \retval void
  *
  */
-static void verbose_printf(int verbosity, const char *format, ...)
+void verbose_printf(int verbosity, const char *format, ...)
 {
     // va_list is a special type that allows hanlding of variable
     // length parameter list
@@ -594,6 +618,42 @@ static void verbose_printf(int verbosity, const char *format, ...)
     }
 }
 
+/**
+ *
+ * \brief splits the timings of a request into its phases
+ *
+ * phases the request never reached are 0, "total" always counts.
+ *
+ * \param trace the timings reported by libsmc
+ * \param us receives the length of every phase in microseconds
+ *
+ */
+
+void trace_phases(const struct smc_trace *trace, long long us[TRACE_PHASES])
+{
+    long long sent = trace->send_end > 0 ? trace->send_end : trace->end;
+
+    us[TRACE_DNS] = trace->resolve_us;
+    us[TRACE_CONNECT] = trace->connect_us;
+    us[TRACE_QUEUE] = 0;
+    us[TRACE_SEND] = 0;
+    us[TRACE_TTFB] = 0;
+    us[TRACE_RECEIVE] = 0;
+    if(trace->send_begin > 0){
+        us[TRACE_QUEUE] = trace->send_begin - trace->submit - trace->resolve_us - trace->connect_us;
+        us[TRACE_SEND] = sent - trace->send_begin;
+    }
+    //a server may answer before a long request body is sent completely
+    if(trace->first_byte > 0){
+        us[TRACE_TTFB] = trace->first_byte > sent ? trace->first_byte - sent : 0;
+        us[TRACE_RECEIVE] = trace->end - (trace->first_byte > sent ? trace->first_byte : sent);
+    }
+    if(us[TRACE_QUEUE] < 0){
+        us[TRACE_QUEUE] = 0;
+    }
+    us[TRACE_TOTAL] = trace->end - trace->submit;
+}
+
 /*
  * =================================================================== eof ==
  */
@@ -0,0 +1,126 @@
+/**
+ * @file simple_message_client.h
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Client - shared declarations
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+#ifndef SIMPLE_MESSAGE_CLIENT_H
+#define SIMPLE_MESSAGE_CLIENT_H
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "libsmc.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//exit status if a received file failed its checksum, see --checksum
+#define EXIT_CHECKSUM 3
+
+//default number of concurrent connections of the load generator
+#define LOAD_DEFAULT_CONNECTIONS 10
+//default number of requests of the load generator without --duration
+#define LOAD_DEFAULT_REQUESTS 1000
+//default number of outstanding requests per keep-alive connection of the load generator
+#define LOAD_DEFAULT_PIPELINE 1
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//options of the load generator (--load)
+struct load_options
+{
+    long connections; //concurrent connections
+    long requests;    //requests in total, 0 = unlimited
+    double duration;  //seconds to run, 0 = until all requests are done
+    double rate;      //target requests per second, 0 = as fast as possible
+    int keepalive;    //reuse connections with framed requests
+    long pipeline;    //outstanding requests per connection with keepalive
+    int protocol;     //highest protocol version offered with keepalive
+    int trace;        //report connect time and time to first byte as well
+};
+
+//options not handled by smc_parsecommandline()
+struct client_options
+{
+    int load;
+    int keepalive;
+    int protocol;             //--protocol, highest version offered with --keepalive
+    struct load_options load_opts;
+    const char *message_file; //--message-file, "-" for stdin
+    double connect_timeout;   //--connect-timeout in seconds, 0 = none
+    const char *batch;        //--batch, "-" for stdin
+    int ordered;              //--ordered
+    long write_buffers;       //--write-buffers, 0 = write on the receiving thread
+    int sync;                 //--sync
+    const char *cache_dir;    //--cache
+    int trace;                //--trace
+};
+
+//options of batch posting (--batch)
+struct batch_options
+{
+    const char *path;       //records, "-" for stdin
+    int ordered;            //records of one user stay in input order
+    long connections;       //concurrent connections
+    long window;            //outstanding records per connection
+    int keepalive;
+    int protocol;
+    int connect_timeout_ms;
+    int trace;              //print the phases of the records aggregated
+};
+
+//phases of a traced request, see trace_phases()
+enum trace_phase
+{
+    TRACE_DNS,      //getaddrinfo()
+    TRACE_CONNECT,  //connect() and keep-alive handshake
+    TRACE_QUEUE,    //waiting behind earlier requests of the connection
+    TRACE_SEND,     //writing the request
+    TRACE_TTFB,     //request sent until the first byte of the response, the server at work
+    TRACE_RECEIVE,  //first byte until the response is complete and its files are stored
+    TRACE_TOTAL,    //smc_submit() until done
+    TRACE_PHASES
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+//program name for error messages
+extern const char *sprogram_arg0;
+//verbose output requested with -v
+extern int verbose;
+//names of enum trace_phase, as printed
+extern const char *const trace_phase_names[TRACE_PHASES];
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+void verbose_printf(int verbosity, const char *format, ...);
+void trace_phases(const struct smc_trace *trace, long long us[TRACE_PHASES]);
+int run_load(const char *server, const char *port, const char *request, size_t request_len, const struct load_options *opts);
+int run_batch(const char *server, const char *port, const char *user, const char *img_url, const struct batch_options *opts);
+
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,89 @@
+/**
+ * @file simple_message_protocol.h
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Wire format shared by client and server
+ *
+ * Plain mode (default): the client sends one request, shuts down its sending
+ * side and reads the response until the server closes the connection.
+ *
+ * Keep-alive mode: the client opens with the hello of the highest protocol
+ * version it speaks and the server answers with the hello of the version it
+ * chose, at most the offered one. Afterwards requests and responses are frames
+ * of a PROTO_FRAME_HEADER byte length in network byte order followed by that
+ * many bytes, at most PROTO_FRAME_MAX for a request. Requests may be
+ * pipelined, responses come back in order. Closing the connection after a
+ * complete frame ends the session. A server that does
+ * not answer the hello does not speak keep-alive, the client then falls back
+ * to plain mode on a new connection.
+ *
+ * Version 1 frames carry the plain mode request and response. Version 2
+ * frames carry the plain mode request and a binary response, all numbers in
+ * network byte order:
+ *
+ *     int32 status, uint32 file count
+ *     uint16 name length, uint64 content length, name, content   (per file)
+ *
+ * so the client reads fixed-width fields instead of scanning text lines.
+ * Version 3 frames are version 2 frames with a uint32 CRC-32C (see crc32c.h)
+ * of the content after every file, so truncated or corrupted files are
+ * detected while they are received. Clients only offer it when asked to.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+#ifndef SIMPLE_MESSAGE_PROTOCOL_H
+#define SIMPLE_MESSAGE_PROTOCOL_H
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//a plain request starts with "user=", never with a NUL byte
+#define PROTO_HELLO_PREFIX "\0SMP/"
+#define PROTO_HELLO_PREFIX_LEN (sizeof(PROTO_HELLO_PREFIX) - 1)
+#define PROTO_HELLO_V1 PROTO_HELLO_PREFIX "1\n"
+#define PROTO_HELLO_V2 PROTO_HELLO_PREFIX "2\n"
+#define PROTO_HELLO_V3 PROTO_HELLO_PREFIX "3\n"
+#define PROTO_HELLO_LEN (sizeof(PROTO_HELLO_V1) - 1)
+#define PROTO_HELLO(version) \
+    ((version) >= PROTO_VERSION_CRC ? PROTO_HELLO_V3 : (version) >= PROTO_VERSION_BINARY ? PROTO_HELLO_V2 : PROTO_HELLO_V1)
+//version of a received hello, 0 if it is none
+#define PROTO_HELLO_VERSION(hello) \
+    (memcmp((hello), PROTO_HELLO_PREFIX, PROTO_HELLO_PREFIX_LEN) == 0 && (hello)[PROTO_HELLO_LEN - 1] == '\n' && \
+     (hello)[PROTO_HELLO_PREFIX_LEN] >= '1' && (hello)[PROTO_HELLO_PREFIX_LEN] <= '9' ? (hello)[PROTO_HELLO_PREFIX_LEN] - '0' : 0)
+
+#define PROTO_VERSION_TEXT 1
+#define PROTO_VERSION_BINARY 2
+#define PROTO_VERSION_CRC 3
+#define PROTO_VERSION_MAX PROTO_VERSION_CRC
+//offered by clients unless asked for more
+#define PROTO_VERSION_DEFAULT PROTO_VERSION_BINARY
+
+//status of the plain response a server at its limit turns a connection away with, the request was not served
+#define PROTO_STATUS_BUSY 503
+//status of a binary response whose business logic output was no valid response, the session goes on
+#define PROTO_STATUS_ERROR 500
+
+//length prefix of every frame, uint32_t in network byte order
+#define PROTO_FRAME_HEADER 4
+//largest request frame a server accepts, a longer one ends the session
+#define PROTO_FRAME_MAX (64u << 20)
+//version 2 response header: int32 status, uint32 file count
+#define PROTO_BIN_HEADER 8
+//version 2 file header: uint16 name length, uint64 content length
+#define PROTO_BIN_FILE_HEADER 10
+//version 3 file trailer: uint32 CRC-32C of the content
+#define PROTO_BIN_FILE_TRAILER 4
+
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
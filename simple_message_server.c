@@ -31,33 +31,46 @@
 #include <limits.h>
 #include <stdarg.h>
 #include <getopt.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 
-/*
- * --------------------------------------------------------------- defines --
- */
-
-#define BL_NAME "simple_message_server_logic"
-#define BL_PATH "/usr/local/bin/simple_message_server_logic"
-#define UNUSED(x) (void)(x)
+#include "simple_message_server.h"
+#include "simple_message_protocol.h"
 
 /*
  * --------------------------------------------------------------- globals --
  */
 
+extern char **environ;
+
 //programm arguments
 static const char *sprogram_arg0 = NULL;
 
+//warm pool, only used with LAUNCH_POOL
+static struct worker_pool spool;
+
+//plugin worker threads, only used with LAUNCH_PLUGIN
+static struct plugin_host splugin;
+
+//signalfd of SIGCHLD, only used with REAP_SIGNALFD
+static int sreap_fd = -1;
+
 /*
  * ------------------------------------------------------------- functions --
  */
 
 void print_usage(void);
 void print_err(const char *fmt, ...);
-void parse_commandline(int argc, const char *argv[], long *port);
-int create_socket(long port);
-int create_new_child(int sockfd);
-int register_handler(void);
+void parse_commandline(int argc, const char *argv[], struct server_options *opts);
+long parse_number(const char *arg, long min, long max);
+int create_new_child(int sockfd, const struct server_options *opts);
+int register_handler(enum reap_mode mode);
 void sigchld_handler(int s);
+int wait_for_connection(int sockfd, const struct server_options *opts);
+int plain_request_arrived(int confd);
 
 /**
  *
@@ -75,33 +88,147 @@ void sigchld_handler(int s);
 int main(int argc, const char *argv[])
 {
     int socketfd;
-    long port = -1;
+    struct server_options opts = {
+        .port = -1,
+        .mode = LAUNCH_EXEC,
+        .pool_min = POOL_DEFAULT_MIN,
+        .pool_max = -1,
+        .report_interval = 0,
+        .plugin_path = NULL,
+        .plugin_threads = PLUGIN_DEFAULT_THREADS,
+        .backend = BACKEND_BLOCKING,
+        .workers = 0,
+        .cpu_list = NULL,
+        .backlog = LISTEN_BACKLOG,
+        .stats_path = NULL,
+        .resource_log = NULL,
+        .reap = REAP_HANDLER,
+        .max_children = 0,
+        .queue_len = -1,
+    };
 
     //Set Filename
     sprogram_arg0 = argv[0];
 
     //Parse Commandline arguments
-    parse_commandline(argc, argv, &port);
+    parse_commandline(argc, argv, &opts);
+
+    //Shared with every process forked from here on
+    //Admission control counts the children the metrics keep track of
+    if ((opts.stats_path != NULL || opts.resource_log != NULL || opts.max_children > 0) &&
+        metrics_init(opts.stats_path, opts.resource_log) < 0)
+        exit(EXIT_FAILURE);
+
+    //One SO_REUSEPORT acceptor process per worker, supervised by this process
+    if (opts.workers > 0)
+        return workers_run(&opts) < 0 ? EXIT_FAILURE : 0;
    
    //Create Listening socket
-    socketfd = create_socket(port);
+    socketfd = create_socket(opts.port, opts.backlog, false);
 
+    return serve(socketfd, &opts);
+}
+
+/**
+ *
+ * \brief Serves connections on a listening socket
+ *
+ * Registers the SIGCHLD handler or signalfd, prepares the launch mode and runs the selected
+ * server core. Called by the single server process or by every acceptor worker. The event
+ * loop backends fork their launcher first, the launch mode is prepared in the launcher.
+ *
+ * \param socketfd the listening socket, closed on return
+ * \param opts the parsed command line options
+ *
+ * \return returns success or error
+ * \retval 0 the server core stopped
+ * \retval EXIT_FAILURE the launch mode could not be prepared
+ *
+ */
 
+int serve(int socketfd, const struct server_options *opts)
+{
     //Register Handler to reap all dear processes
-    if (register_handler() < 0)
+    if (register_handler(opts->reap) < 0)
     {
         close(socketfd);
         print_err("Could not register Handler\n");
         exit(EXIT_FAILURE);
     }
 
-    //Loop and accept new connections
-    while (1)
+    //The event loops never fork, the launcher serves its end of the channel like a listening socket
+    if (opts->backend != BACKEND_BLOCKING)
     {
-        if (create_new_child(socketfd) < 0)
-            break;
+        switch (launcher_fork(&socketfd))
+        {
+        case -1:
+            close(socketfd);
+            print_err("Could not start launcher\n");
+            exit(EXIT_FAILURE);
+        case 0:
+            if (opts->backend == BACKEND_EPOLL)
+                epoll_run(socketfd, opts);
+            else
+                uring_run(socketfd, opts);
+            close(socketfd);
+            return 0;
+        }
+    }
+
+    //Fork the warm workers before the first connection arrives
+    if (opts->mode == LAUNCH_POOL && pool_init(&spool, opts->pool_min, opts->pool_max) < 0)
+    {
+        close(socketfd);
+        print_err("Could not create worker pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Limit the children, connections beyond wait or are shed
+    if (opts->max_children > 0 && admission_init(opts->max_children, opts->queue_len) < 0)
+    {
+        close(socketfd);
+        print_err("Could not set up admission control\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Load the business logic plugin and start its worker threads
+    if (opts->mode == LAUNCH_PLUGIN && plugin_init(&splugin, opts->plugin_path, opts->plugin_threads) < 0)
+    {
+        close(socketfd);
+        print_err("Could not load business logic plugin\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Loop and accept new connections, or receive them from the event loop in the launcher
+    if (opts->backend != BACKEND_BLOCKING)
+    {
+        while (1)
+        {
+            if (sreap_fd >= 0 && wait_for_connection(socketfd, opts) < 0)
+                break;
+            if (launcher_accept(socketfd, opts) < 0)
+                break;
+        }
     }
-    
+    else
+    {
+        while (1)
+        {
+            //shed connections (plugin mode without -C) are answered while waiting as well
+            if ((sreap_fd >= 0 || admission_timeout() >= 0) && wait_for_connection(socketfd, opts) < 0)
+                break;
+            if (create_new_child(socketfd, opts) < 0)
+                break;
+            report_accept_rate(opts->report_interval);
+        }
+    }
+
+    if (opts->max_children > 0)
+        admission_destroy();
+    if (opts->mode == LAUNCH_POOL)
+        pool_destroy(&spool);
+    if (opts->mode == LAUNCH_PLUGIN)
+        plugin_destroy(&splugin);
     close(socketfd);
 
     return 0;
@@ -115,31 +242,30 @@ int main(int argc, const char *argv[])
  *
  * \param argc number of arguments
  * \param argv the arguments
- * \param port the port, the server should listen for new connnections
+ * \param opts the options, port is the port the server should listen for new connnections
  *
  * \return void
  * \retval void
  *
  */
 
-void parse_commandline(int argc, const char *argv[], long *port)
+void parse_commandline(int argc, const char *argv[], struct server_options *opts)
 {
     int c;
     char *strtol_end; //for checking several return values
 
-    while ((c = getopt(argc, (char **const)argv, "p:h")) != -1)
+    while ((c = getopt(argc, (char **const)argv, "p:m:n:N:r:l:t:b:w:c:q:s:a:R:C:Q:h")) != -1)
     {
-        *port = 1;
         switch (c)
         {
         case 'p':
-            *port = strtol(optarg, &strtol_end, 10);
+            opts->port = strtol(optarg, &strtol_end, 10);
             if (optarg == strtol_end)
             {
                 print_err("No digits parsed\n");
                 print_usage();
             }
-            else if (*port < 0 || *port > 65535) //strtol returns long LONG_MAX OR LONG_MIN when out of range
+            else if (opts->port < 0 || opts->port > 65535) //strtol returns long LONG_MAX OR LONG_MIN when out of range
             {
                 print_err("Port Out of Range\n");
                 print_usage();
@@ -150,6 +276,84 @@ void parse_commandline(int argc, const char *argv[], long *port)
                 print_usage();
             }
             break;
+        case 'm':
+            if (strcmp(optarg, "exec") == 0)
+                opts->mode = LAUNCH_EXEC;
+            else if (strcmp(optarg, "pool") == 0)
+                opts->mode = LAUNCH_POOL;
+            else if (strcmp(optarg, "plugin") == 0)
+                opts->mode = LAUNCH_PLUGIN;
+            else if (strcmp(optarg, "spawn") == 0)
+                opts->mode = LAUNCH_SPAWN;
+            else
+            {
+                print_err("Unknown launch mode \"%s\"\n", optarg);
+                print_usage();
+            }
+            break;
+        case 'n':
+            opts->pool_min = parse_number(optarg, 1, 4096);
+            break;
+        case 'N':
+            opts->pool_max = parse_number(optarg, 1, 4096);
+            break;
+        case 'r':
+            opts->report_interval = parse_number(optarg, 0, INT_MAX);
+            break;
+        case 'b':
+            if (strcmp(optarg, "blocking") == 0)
+                opts->backend = BACKEND_BLOCKING;
+            else if (strcmp(optarg, "epoll") == 0)
+                opts->backend = BACKEND_EPOLL;
+            else if (strcmp(optarg, "uring") == 0)
+                opts->backend = BACKEND_URING;
+            else
+            {
+                print_err("Unknown backend \"%s\"\n", optarg);
+                print_usage();
+            }
+            break;
+        case 'w':
+            if (strcmp(optarg, "auto") == 0)
+                opts->workers = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+            else
+                opts->workers = parse_number(optarg, 1, 1024);
+            break;
+        case 'c':
+            opts->cpu_list = optarg;
+            break;
+        case 'q':
+            opts->backlog = parse_number(optarg, 1, INT_MAX);
+            break;
+        case 's':
+            opts->stats_path = optarg;
+            break;
+        case 'a':
+            opts->resource_log = optarg;
+            break;
+        case 'R':
+            if (strcmp(optarg, "handler") == 0)
+                opts->reap = REAP_HANDLER;
+            else if (strcmp(optarg, "signalfd") == 0)
+                opts->reap = REAP_SIGNALFD;
+            else
+            {
+                print_err("Unknown reaping mode \"%s\"\n", optarg);
+                print_usage();
+            }
+            break;
+        case 'C':
+            opts->max_children = parse_number(optarg, 1, 4096);
+            break;
+        case 'Q':
+            opts->queue_len = parse_number(optarg, 0, 65536);
+            break;
+        case 'l':
+            opts->plugin_path = optarg;
+            break;
+        case 't':
+            opts->plugin_threads = parse_number(optarg, 1, 1024);
+            break;
         case 'h':
         case '?':
         default:
@@ -157,11 +361,83 @@ void parse_commandline(int argc, const char *argv[], long *port)
             break;
         }
     }
-    if (*port == -1)
+    if (opts->port == -1)
     {
         print_err("Mandatory Option Port is missing");
         print_usage();
     }
+    if (opts->pool_max == -1)
+        opts->pool_max = opts->pool_min * 4 > 4096 ? 4096 : opts->pool_min * 4;
+    if (opts->pool_max < opts->pool_min)
+    {
+        print_err("Pool maximum is smaller than pool minimum\n");
+        print_usage();
+    }
+    if (opts->mode == LAUNCH_PLUGIN && opts->plugin_path == NULL)
+    {
+        print_err("Launch mode plugin needs a shared object (-l)\n");
+        print_usage();
+    }
+    //the workers would wait on relayed sockets only the event loop feeds, which waits on the full queue
+    if (opts->mode == LAUNCH_PLUGIN && opts->backend != BACKEND_BLOCKING)
+    {
+        print_err("Launch mode plugin needs the blocking server core (-b blocking)\n");
+        print_usage();
+    }
+    if (opts->queue_len == -1)
+        opts->queue_len = opts->max_children;
+    //children are counted as they are reaped, which has to wake up the server core
+    if (opts->max_children > 0)
+        opts->reap = REAP_SIGNALFD;
+    if (opts->mode == LAUNCH_PLUGIN && opts->max_children > 0)
+    {
+        print_err("Launch mode plugin starts no children to limit (-C)\n");
+        print_usage();
+    }
+    if (opts->cpu_list != NULL && opts->workers == 0)
+    {
+        print_err("CPU pinning (-c) needs acceptor workers (-w)\n");
+        print_usage();
+    }
+}
+
+/**
+ *
+ * \brief parses a numeric option argument
+ *
+ * Converts the argument to a long and checks its range. Prints Usage if the argument is invalid.
+ *
+ * \param arg the option argument
+ * \param min smallest allowed value
+ * \param max largest allowed value
+ *
+ * \return the parsed value
+ *
+ */
+
+long parse_number(const char *arg, long min, long max)
+{
+    char *strtol_end;
+    long value;
+
+    errno = 0;
+    value = strtol(arg, &strtol_end, 10);
+    if (arg == strtol_end)
+    {
+        print_err("No digits parsed\n");
+        print_usage();
+    }
+    else if (errno == ERANGE || value < min || value > max)
+    {
+        print_err("Argument %s Out of Range [%ld..%ld]\n", arg, min, max);
+        print_usage();
+    }
+    else if (*strtol_end != '\0')
+    {
+        print_err("Argument invalid\n");
+        print_usage();
+    }
+    return value;
 }
 
 /**
@@ -177,7 +453,31 @@ void parse_commandline(int argc, const char *argv[], long *port)
 
 void print_usage()
 {
-    if (fprintf(stdout, "Usage:\nsimple_message_server -p port [-h]\n") < 0)
+    if (fprintf(stdout, "Usage:\nsimple_message_server -p port [-b blocking|epoll|uring] [-m exec|spawn|pool|plugin] [-n min] [-N max] [-l plugin.so] [-t threads]\n"
+                       "\t[-w workers|auto] [-c cpus] [-q backlog] [-r seconds] [-s path] [-a file]\n"
+                       "\t[-R handler|signalfd] [-C children] [-Q queue] [-h]\n"
+                       "\t-b server core: blocking accept loop (default), or an epoll or io_uring event loop\n"
+                       "\t   relaying between client and business logic (uring falls back to epoll)\n"
+                       "\t-m launch mode: fork and exec per connection (default), posix_spawn per plain request,\n"
+                       "\t   pre-forked warm pool or in-process plugin called from worker threads (blocking core only)\n"
+                       "\t-n idle workers the warm pool keeps at least (default %d)\n"
+                       "\t-N idle workers the warm pool may grow to (default 4 * min)\n"
+                       "\t-l shared object exporting the plugin entry point %s()\n"
+                       "\t-t plugin worker threads (default %d)\n"
+                       "\t-w acceptor processes with their own SO_REUSEPORT listener, auto = one per core\n"
+                       "\t-c pin acceptor i to the i-th cpu of the list, e.g. 0-3,6\n"
+                       "\t-q listen backlog (default %d)\n"
+                       "\t-r report the accept rate every given seconds to stderr\n"
+                       "\t-s serve counters and histograms of accept, launch and the children's lifetime and\n"
+                       "\t   resource usage in the Prometheus text format on the unix socket path\n"
+                       "\t-a append wall and CPU time, peak memory, context switches and exit status of\n"
+                       "\t   every request with the peer address to the file\n"
+                       "\t-R reap children in a SIGCHLD handler (default), or block SIGCHLD and reap them\n"
+                       "\t   in batches from a signalfd in the server core\n"
+                       "\t-C business logic processes running at most per acceptor, implies -R signalfd\n"
+                       "\t-Q connections waiting for one of them (default: as many as -C), further\n"
+                       "\t   connections are answered with status %d (busy) and closed\n",
+                POOL_DEFAULT_MIN, PLUGIN_SYMBOL, PLUGIN_DEFAULT_THREADS, LISTEN_BACKLOG, PROTO_STATUS_BUSY) < 0)
     {
         print_err("Could not print usage");
         exit(EXIT_FAILURE);
@@ -190,16 +490,20 @@ void print_usage()
  * \brief Creates the Connect Socket File Descriptor
  *
  * Creates the Socket File Descriptor. Sets the option to reuse local adresses(SO_REUSEADDR).
+ * With reuseport several sockets may be bound to the same port (SO_REUSEPORT), the kernel
+ * spreads incoming connections across them.
  * Binds and starts listening on the first available adresse return from getaddrinfo
  *
  * \param port The Port the socket should be opend on
+ * \param backlog length of the queue of pending connections
+ * \param reuseport whether to set SO_REUSEPORT
  *
  * \return returns successful bound socket file Descriptor, Exits on Failure
  * \retval SUCCESS Connect Socket File Descriptor
  *
  */
 
-int create_socket(long port)
+int create_socket(long port, int backlog, bool reuseport)
 {
 
     struct addrinfo hints, *res, *p;
@@ -241,6 +545,14 @@ int create_socket(long port)
             continue;
         }
 
+        //Share the port with the other acceptors (SO_REUSEPORT)
+        if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0)
+        {
+            close(sockfd);
+            print_err("Set Reuse of Port (SO_REUSEPORT) failed\n");
+            continue;
+        }
+
         //Bind socket
         if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1)
         {
@@ -250,7 +562,7 @@ int create_socket(long port)
         }
 
         //Start listening on the socket
-        if (listen(sockfd, 100) < 0)
+        if (listen(sockfd, backlog) < 0)
         {
             print_err("listening on the bound socket failed.\n");
             close(sockfd);
@@ -275,12 +587,11 @@ int create_socket(long port)
  *
  * \brief Accepts incoming requests and creates the business logic in a new fork
  *
- * Accepts incoming requests for the listening socket. Then tries to fork the process.
- * The parent thread always returns.
- * The newly created fork points stdin and stdout to the connected socket fd and then executes the Businesslogic.
- * Busineslogic is defined in Macros (BL_PATH, BL_NAME). The child forks never returns
+ * Accepts incoming requests for the listening socket (blocking backend) and starts
+ * the business logic with launch_business_logic(). The parent thread always returns.
  *
  * \param sockfd The Listening socket File Descriptor
+ * \param opts the parsed command line options
  *
  * \return Parent process returns. Child processes never return
  * \retval 0 fork successful created
@@ -288,70 +599,332 @@ int create_socket(long port)
  *
  */
 
-int create_new_child(int sockfd)
+int create_new_child(int sockfd, const struct server_options *opts)
 {
     struct sockaddr_storage addr_inf;
     socklen_t len = sizeof(addr_inf);
-    int confd, pid;
+    int confd;
 
     /* wait for incoming requests */
     if ((confd = accept(sockfd, (struct sockaddr *)&addr_inf, &len)) < 0)
     {
         print_err("Accepting new Client failed\n");
+        metrics_accept_failed();
         return 0;
     }
 
     printf("Client accepted\n");
+    metrics_accepted(confd);
+    if (admission_admit(confd) != ADMIT_NOW)
+        return 0;
+
+    return launch_business_logic(sockfd, confd, opts);
+}
+
+/**
+ *
+ * \brief Starts the business logic for a connected socket in the selected launch mode
+ *
+ * Plugin mode queues the socket for a worker thread. Spawn mode starts the business logic
+ * with posix_spawn() once a plain request has started to arrive; a keep-alive hello, or a
+ * connection that sent nothing yet, takes the fork path, whose child serves either kind. Pool mode hands it to an idle warm
+ * worker; if none is available (or in exec mode) it tries to fork the process.
+ * The parent always returns and no longer owns confd.
+ * The newly created fork closes the listening socket and executes the Businesslogic on confd.
+ *
+ * \param sockfd The Listening socket File Descriptor
+ * \param confd the connected socket the business logic reads from and writes to
+ * \param opts the parsed command line options
+ *
+ * \return Parent process returns. Child processes never return
+ * \retval 0 business logic started
+ * \retval -1 fork could not be created
+ *
+ */
+
+int launch_business_logic(int sockfd, int confd, const struct server_options *opts)
+{
+    int pid;
+    //SIGCHLD stays blocked until the child is known to the metrics
+    uint64_t start = metrics_launch_begin();
+
+    /* in-process business logic, no child at all */
+    if (opts->mode == LAUNCH_PLUGIN)
+    {
+        //all threads busy and the queue full, blocking here would stop accepting
+        if (plugin_submit(&splugin, confd) < 0)
+            admission_shed(confd);
+        metrics_launch_end(start, 0, 0);
+        return 0;
+    }
+
+    /* no page table copy, the child shares our memory until it has exec'd */
+    if (opts->mode == LAUNCH_SPAWN && plain_request_arrived(confd))
+    {
+        pid = spawn_business_logic(sockfd, confd);
+        close(confd);
+        metrics_launch_end(start, pid, 1);
+        return pid < 0 ? -1 : 0;
+    }
+
+    /* hand over to a warm worker, fall back to fork on an empty pool */
+    if (opts->mode == LAUNCH_POOL && (pid = pool_handoff(&spool, confd)) > 0)
+    {
+        close(confd);
+        metrics_launch_end(start, pid, 0);
+        pool_refill(&spool);
+        return 0;
+    }
 
     /* fork process */
     if ((pid = fork()) < 0)
     {
         print_err("Forking new Client failed\n");
         close(confd);
+        metrics_launch_end(start, -1, 1);
         return -1;
     }
     //When pid -> newly created child
     if (pid == 0)
     {
+        metrics_launch_child();
+        admission_forked();
 
-        /* point stdin and stdout to newly connected socket */
-        if ((dup2(confd, STDIN_FILENO) == -1) || (dup2(confd, STDOUT_FILENO) == -1))
-        {
-            print_err("Dupping stdin and stdout failed.\n");
-            close(confd);
-            exit(EXIT_FAILURE);
-        }
+        //listening socket and relayed connections of the event loops, a keep-alive child does not exec
+        close_inherited_fds(confd);
 
-        //Close listening socket for forked process
-        if (close(sockfd) != 0)
-        {
-            print_err("Forked process could not close listening Socket.\n");
-            close(confd);
-            exit(EXIT_FAILURE);
-        }
+        start_business_logic(confd);
+    }
 
-        // Close Connect Socket for forked process
-        if (close(confd) != 0)
-        {
-            print_err("Forked process could not close connect socket.\n");
-            exit(EXIT_FAILURE);
-        }
+    //pid > 0 -> parent
+    close(confd);
+    metrics_launch_end(start, pid, 1);
+    if (opts->mode == LAUNCH_POOL)
+        pool_refill(&spool);
+    return 0;
+}
 
-        //Replace Forked Process with business logic
-        if (execl(BL_PATH, BL_NAME, NULL) < 0)
-        {
-            print_err("Could not start server business logic.\n");
-            exit(EXIT_FAILURE);
-        }
+/**
+ *
+ * \brief Executes the business logic on a connected socket
+ *
+ * Points stdin and stdout to the connected socket fd and replaces the process with the
+ * Businesslogic defined in Macros (BL_PATH, BL_NAME). Used by forked children and warm workers.
+ * A keep-alive client is served by keepalive_session() instead, which runs the business
+ * logic once per request. The listening socket has to be closed by the caller. Never returns
+ *
+ * \param confd the connected socket File Descriptor
+ *
+ */
+
+void start_business_logic(int confd)
+{
+    int version;
+    sigset_t chld;
+
+    //the blocked SIGCHLD of REAP_SIGNALFD would survive the exec
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &chld, NULL);
+
+    switch (version = keepalive_detect(confd))
+    {
+    case 0:
+        break;
+    case -1:
+        close(confd);
         exit(EXIT_FAILURE);
+    default:
+        exit(keepalive_session(confd, version, NULL) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
     }
-    else //pid > 0 -> parent
+
+    /* point stdin and stdout to newly connected socket */
+    if ((dup2(confd, STDIN_FILENO) == -1) || (dup2(confd, STDOUT_FILENO) == -1))
     {
+        print_err("Dupping stdin and stdout failed.\n");
         close(confd);
-        return 0;
+        exit(EXIT_FAILURE);
+    }
+
+    // Close Connect Socket for forked process
+    if (close(confd) != 0)
+    {
+        print_err("Forked process could not close connect socket.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //the io_uring core ignores SIGPIPE, the business logic gets the default back
+    signal(SIGPIPE, SIG_DFL);
+
+    //Replace Forked Process with business logic
+    metrics_exec();
+    if (execl(BL_PATH, BL_NAME, NULL) < 0)
+    {
+        print_err("Could not start server business logic.\n");
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ * \brief Starts the business logic with posix_spawn()
+ *
+ * Does the same as a forked child running start_business_logic(), expressed as spawn
+ * file actions. glibc implements posix_spawn() with clone(CLONE_VM|CLONE_VFORK), so
+ * no page tables are copied and the cost stays flat however large the server grows.
+ *
+ * \param sockfd The Listening socket File Descriptor, closed in the business logic
+ * \param confd the connected socket, still owned by the caller
+ *
+ * \return pid of the business logic or failure
+ * \retval -1 the business logic could not be started
+ *
+ */
+
+pid_t spawn_business_logic(int sockfd, int confd)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    char *const argv[] = {BL_NAME, NULL};
+    const sigset_t *launch_mask = metrics_launch_mask();
+    sigset_t mask, pipe;
+    pid_t pid;
+    int err;
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0)
+    {
+        print_err("Could not start server business logic: %s\n", strerror(err));
+        return -1;
+    }
+    if ((err = posix_spawnattr_init(&attr)) != 0)
+    {
+        print_err("Could not start server business logic: %s\n", strerror(err));
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    /* the business logic must not inherit the SIGCHLD blocked for the metrics or the signalfd */
+    if (launch_mask != NULL)
+        mask = *launch_mask;
+    else
+        sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGCHLD);
+    //nor the SIGPIPE ignored by the io_uring core
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    if ((err = posix_spawnattr_setsigmask(&attr, &mask)) != 0 ||
+        (err = posix_spawnattr_setsigdefault(&attr, &pipe)) != 0 ||
+        (err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF)) != 0)
+    {
+        print_err("Could not start server business logic: %s\n", strerror(err));
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    /* point stdin and stdout to newly connected socket, close everything else */
+    if ((err = posix_spawn_file_actions_adddup2(&actions, confd, STDIN_FILENO)) != 0 ||
+        (err = posix_spawn_file_actions_adddup2(&actions, confd, STDOUT_FILENO)) != 0 ||
+        (err = posix_spawn_file_actions_addclose(&actions, sockfd)) != 0 ||
+        (err = posix_spawn_file_actions_addclose(&actions, confd)) != 0 ||
+        (err = posix_spawn(&pid, BL_PATH, &actions, &attr, argv, environ)) != 0)
+    {
+        print_err("Could not start server business logic: %s\n", strerror(err));
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+}
+
+/**
+ *
+ * \brief Tells whether a plain request is waiting on a connection, never blocks
+ *
+ * The spawned business logic reads the connection directly, keepalive_detect() never
+ * runs for it. A keep-alive hello handed to it would be taken as the start of a plain
+ * request and the client would wait for its acknowledgement in vain.
+ *
+ * \param confd the connected socket
+ *
+ * \return non zero if the first byte arrived and is no keep-alive hello
+ *
+ */
+
+int plain_request_arrived(int confd)
+{
+    char first;
+
+    return recv(confd, &first, 1, MSG_PEEK | MSG_DONTWAIT) == 1 && first != PROTO_HELLO_PREFIX[0];
+}
+
+/**
+ *
+ * \brief Closes every inherited descriptor above stderr except one
+ *
+ * Used by processes that stay alive after fork without calling exec, close-on-exec does
+ * not help them. A forgotten client socket would keep that connection open.
+ *
+ * \param keep the descriptor to keep open
+ *
+ */
+
+void close_inherited_fds(int keep)
+{
+#ifdef SYS_close_range
+    if ((keep <= STDERR_FILENO + 1 || syscall(SYS_close_range, STDERR_FILENO + 1, keep - 1, 0) == 0) &&
+        syscall(SYS_close_range, keep + 1, ~0U, 0) == 0)
+        return;
+#endif
+    //old kernel, close one by one
+    long max = sysconf(_SC_OPEN_MAX);
+    for (long fd = STDERR_FILENO + 1; fd < max; fd++)
+    {
+        if (fd != keep)
+            close(fd);
+    }
+}
+
+/**
+ *
+ * \brief Reports the accept rate to stderr
+ *
+ * Counts accepted connections and prints the rate once per interval. Run the same client
+ * load against the different launch modes to compare them.
+ *
+ * \param interval seconds between two reports, 0 disables reporting
+ *
+ */
+
+void report_accept_rate(long interval)
+{
+    static struct timespec last;
+    static long accepted;
+    struct timespec now;
+    double elapsed;
+
+    if (interval <= 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (accepted++ == 0)
+    {
+        last = now;
+        return;
     }
 
-    return -1;
+    elapsed = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+    if (elapsed >= interval)
+    {
+        fprintf(stderr, "%s: accepted %ld connections in %.2fs (%.1f/s)\n",
+                sprogram_arg0, accepted - 1, elapsed, (accepted - 1) / elapsed);
+        accepted = 1;
+        last = now;
+    }
 }
 
 /**
@@ -380,7 +953,8 @@ void print_err(const char *fmt, ...)
  *
  * \brief Waits for all child processes, that are zombies, to be reaped
  *
- * Waits for all child processes, that are zombies, to be reaped
+ * Waits for all child processes, that are zombies, to be reaped and reports
+ * them with their resource usage to the metrics
  *
  * \param s sigaction (UNUSED)
  *
@@ -391,27 +965,138 @@ void sigchld_handler(int s)
     UNUSED(s);
     // waitpid() might overwrite errno, so we save and restore it:
     int saved_errno = errno;
+    struct rusage ru;
+    pid_t pid;
+    int status;
 
-    while (waitpid(-1, NULL, WNOHANG) > 0)
-        ;
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0)
+        metrics_reaped(pid, status, &ru);
 
     errno = saved_errno;
 }
 
+/**
+ *
+ * \brief Reaps all terminated children at once, with REAP_SIGNALFD
+ *
+ * Drains the signalfd first, several exits are coalesced into one pending
+ * SIGCHLD anyway, then reaps until no zombie is left. Runs synchronously in
+ * the server core, the metrics are updated without a handler interrupting.
+ *
+ */
+
+void reap_children(void)
+{
+    struct signalfd_siginfo info[16];
+    struct rusage ru;
+    pid_t pid;
+    int status;
+
+    while (read(sreap_fd, info, sizeof(info)) == sizeof(info))
+        ;
+
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0)
+        metrics_reaped(pid, status, &ru);
+}
+
+/**
+ *
+ * \brief signalfd the server core waits on besides its sockets
+ *
+ * \return the signalfd of SIGCHLD
+ * \retval -1 children are reaped by the SIGCHLD handler
+ *
+ */
+
+int reap_fd(void)
+{
+    return sreap_fd;
+}
+
+/**
+ *
+ * \brief Waits until a connection is pending, reaping children meanwhile
+ *
+ * The blocking accept loop with REAP_SIGNALFD, accept() alone would never
+ * return for a SIGCHLD. Queued connections are launched as children exit, shed
+ * ones are answered and closed by admission control meanwhile.
+ *
+ * \param sockfd The Listening socket File Descriptor
+ * \param opts the parsed command line options
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 a connection is pending
+ * \retval -1 poll() failed
+ *
+ */
+
+int wait_for_connection(int sockfd, const struct server_options *opts)
+{
+    //shed connections lingering in admission control follow the first two
+    struct pollfd fds[2 + ADMISSION_LINGER] = {{.fd = sockfd, .events = POLLIN}, {.fd = sreap_fd, .events = POLLIN}};
+
+    while (1)
+    {
+        int nfds = 2 + admission_pollfds(fds + 2);
+
+        if (poll(fds, nfds, admission_timeout()) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            print_err("poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (fds[1].revents != 0)
+        {
+            int confd;
+
+            reap_children();
+            while ((confd = admission_next()) >= 0)
+                launch_business_logic(sockfd, confd, opts);
+        }
+        if (nfds > 2)
+            admission_linger();
+        if (fds[0].revents != 0)
+            return 0;
+    }
+}
+
 /**
  *
  * \brief Registers the handler to reap dead processes
  *
- * Registers the handler to reap dead processes
+ * Registers the handler to reap dead processes. With REAP_SIGNALFD SIGCHLD is
+ * blocked instead and the server core reads it from reap_fd(); plugin threads
+ * started later inherit the mask, so no thread takes the signal.
+ *
+ * \param mode how children are reaped
  *
  * \return SUCCESS OR Failure
  * \retval 0 successful
  * \retval -1 Failure
  **/
 
-int register_handler()
+int register_handler(enum reap_mode mode)
 {
     struct sigaction sa;
+
+    if (mode == REAP_SIGNALFD)
+    {
+        sigset_t chld;
+
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        if (sigprocmask(SIG_BLOCK, &chld, NULL) < 0 ||
+            (sreap_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        {
+            perror("signalfd");
+            return -1;
+        }
+        //children that exited before the signal was blocked
+        reap_children();
+        return 0;
+    }
+
     sa.sa_handler = sigchld_handler; // reap all dead processes
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = SA_RESTART;
@@ -0,0 +1,231 @@
+/**
+ * @file simple_message_server.h
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - shared declarations
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+#ifndef SIMPLE_MESSAGE_SERVER_H
+#define SIMPLE_MESSAGE_SERVER_H
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "simple_message_server_plugin.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define BL_NAME "simple_message_server_logic"
+//overridden with -DBL_PATH=... e.g. by "make bench" for its stub business logic
+#ifndef BL_PATH
+#define BL_PATH "/usr/local/bin/simple_message_server_logic"
+#endif
+#define UNUSED(x) (void)(x)
+
+//default length of the queue of pending connections
+#define LISTEN_BACKLOG 100
+//acceptor workers dying faster than this are not restarted
+#define WORKER_MIN_LIFETIME 1
+
+//default number of idle workers kept by the warm pool
+#define POOL_DEFAULT_MIN 4
+//seconds without pool exhaustion before the pool shrinks by one worker
+#define POOL_SHRINK_SECONDS 5
+//workers forked at most per refill, the accept loop catches up over the next connections
+#define POOL_REFILL_BATCH 2
+//default number of plugin worker threads
+#define PLUGIN_DEFAULT_THREADS 8
+//queued connections per plugin worker thread before connections are shed
+#define PLUGIN_QUEUE_PER_THREAD 16
+//milliseconds a keep-alive client may keep a plugin worker thread without a request
+#define PLUGIN_KEEPALIVE_IDLE_MS 5000
+//shed connections kept open until their client is done, see sms_admission.c
+#define ADMISSION_LINGER 256
+//milliseconds a shed connection is kept open at most
+#define ADMISSION_LINGER_MS 2000
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//how the business logic is launched for an accepted connection
+enum launch_mode
+{
+    LAUNCH_EXEC,  //fork and exec per connection (default)
+    LAUNCH_SPAWN, //posix_spawn per connection, no page table copy
+    LAUNCH_POOL,  //hand the connection to a pre-forked warm worker
+    LAUNCH_PLUGIN //call a dlopen'd handler in a worker thread, no process
+};
+
+//server core accepting and serving connections
+enum server_backend
+{
+    BACKEND_BLOCKING, //blocking accept loop, business logic owns the socket (default)
+    BACKEND_EPOLL,    //non-blocking epoll loop relaying to the business logic
+    BACKEND_URING     //io_uring loop relaying to the business logic
+};
+
+//what admission control decided for an accepted connection
+enum admission
+{
+    ADMIT_NOW,    //launch the business logic
+    ADMIT_QUEUED, //waits for a child to exit, see admission_next()
+    ADMIT_SHED    //answered busy and closed
+};
+
+//how terminated children are reaped
+enum reap_mode
+{
+    REAP_HANDLER, //SIGCHLD handler interrupting whatever runs (default)
+    REAP_SIGNALFD //SIGCHLD blocked and read from a signalfd by the server core
+};
+
+//parsed command line options
+struct server_options
+{
+    long port;
+    enum launch_mode mode;
+    long pool_min;        //idle workers the pool keeps at least
+    long pool_max;        //idle workers the pool may grow to
+    long report_interval; //seconds between accept rate reports, 0 = off
+    const char *plugin_path; //shared object exporting PLUGIN_SYMBOL
+    long plugin_threads;
+    enum server_backend backend;
+    long workers;         //SO_REUSEPORT acceptor processes, 0 = single process
+    const char *cpu_list; //cpus the acceptors are pinned to, NULL = no pinning
+    long backlog;
+    const char *stats_path; //unix socket serving the metrics, NULL = none
+    const char *resource_log; //file a line per request is appended to, NULL = none
+    enum reap_mode reap;
+    long max_children;    //business logic processes per acceptor, 0 = unlimited
+    long queue_len;       //connections waiting for a child, -1 = max_children
+};
+
+//one idle warm worker waiting for a connection
+struct pool_worker
+{
+    pid_t pid;
+    int chan; //parent end of the socketpair the connection is passed over
+};
+
+//warm pool of pre-forked business logic workers
+struct worker_pool
+{
+    struct pool_worker *idle; //idle workers, used as LIFO stack
+    size_t idle_count;
+    size_t target; //idle workers currently aimed for (min <= target <= max)
+    size_t min;
+    size_t max;
+    time_t last_exhausted;
+};
+
+//worker threads serving connections with a dlopen'd handler
+struct plugin_host
+{
+    void *dl;
+    plugin_handler_t handle;
+    pthread_t *threads;
+    size_t nthreads;
+    int *queue; //ring buffer of connected sockets
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+void print_err(const char *fmt, ...);
+int create_socket(long port, int backlog, bool reuseport);
+int serve(int socketfd, const struct server_options *opts);
+int launch_business_logic(int sockfd, int confd, const struct server_options *opts);
+void start_business_logic(int confd);
+int reap_fd(void);
+void reap_children(void);
+pid_t spawn_business_logic(int sockfd, int confd);
+void report_accept_rate(long interval);
+void close_inherited_fds(int keep);
+
+int pool_init(struct worker_pool *pool, size_t min, size_t max);
+pid_t pool_handoff(struct worker_pool *pool, int confd);
+void pool_refill(struct worker_pool *pool);
+void pool_destroy(struct worker_pool *pool);
+
+int plugin_init(struct plugin_host *host, const char *path, size_t threads);
+int plugin_submit(struct plugin_host *host, int confd);
+void plugin_destroy(struct plugin_host *host);
+
+int workers_run(const struct server_options *opts);
+
+int epoll_run(int listen_fd, const struct server_options *opts);
+int set_nonblocking(int fd);
+
+int uring_run(int listen_fd, const struct server_options *opts);
+
+int launcher_fork(int *sockfd);
+int launcher_submit(int client_fd);
+int launcher_accept(int chan, const struct server_options *opts);
+
+int admission_init(long max_children, long queue_len);
+enum admission admission_admit(int confd);
+int admission_next(void);
+void admission_destroy(void);
+void admission_forked(void);
+void admission_shed(int confd);
+int admission_pollfds(struct pollfd *fds);
+int admission_timeout(void);
+void admission_linger(void);
+
+int metrics_init(const char *path, const char *log_path);
+uint64_t metrics_now(void);
+void metrics_accepted(int confd);
+void metrics_accept_failed(void);
+void metrics_dequeued(int confd, uint64_t accepted_ns);
+void metrics_relayed(int confd, uint64_t accepted_ns);
+void metrics_queued(int delta);
+void metrics_shed(void);
+long metrics_children(void);
+void metrics_set_accepted(uint64_t accepted_ns);
+uint64_t metrics_accept_time(void);
+uint64_t metrics_launch_begin(void);
+void metrics_launch_end(uint64_t start, pid_t pid, int forked);
+void metrics_launch_child(void);
+const sigset_t *metrics_launch_mask(void);
+void metrics_child_forked(void);
+void metrics_exec(void);
+void metrics_reaped(pid_t pid, int status, const struct rusage *ru);
+
+int keepalive_detect(int confd);
+int keepalive_session(int confd, int version, plugin_handler_t handler);
+int keepalive_status(int confd, int version, int status);
+
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,67 @@
+/**
+ * @file simple_message_server_plugin.h
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - business logic plugin interface
+ *
+ * A business logic plugin is a shared object loaded with "-m plugin -l <path>".
+ * Instead of reading stdin and writing stdout in a process of its own, the
+ * plugin exports PLUGIN_SYMBOL and is called once per connection from one of
+ * the server's worker threads. It must therefore be thread safe and must not
+ * call exit().
+ *
+ * Build a plugin with: gcc -shared -fPIC -o logic.so logic.c
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+#ifndef SIMPLE_MESSAGE_SERVER_PLUGIN_H
+#define SIMPLE_MESSAGE_SERVER_PLUGIN_H
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//name of the entry point looked up with dlsym()
+#define PLUGIN_SYMBOL "handle"
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+typedef int (*plugin_handler_t)(int in_fd, int out_fd);
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+/**
+ *
+ * \brief Serves one connection
+ *
+ * Reads the request from in_fd until end of file and writes the response to out_fd,
+ * exactly like the business logic does with stdin and stdout. Both descriptors refer
+ * to the same connected socket and are closed by the server after the call.
+ *
+ * \param in_fd descriptor the request is read from
+ * \param out_fd descriptor the response is written to
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure, reported by the server
+ *
+ */
+
+int handle(int in_fd, int out_fd);
+
+#endif
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,473 @@
+/**
+ * @file smc_batch.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Client - batch posting (--batch)
+ *
+ * Reads one record per line from a file or stdin,
+ *
+ *     user<TAB>image URL<TAB>message
+ *
+ * and posts them over --connections libsmc connections of one process, so
+ * process startup, name resolution and connect are paid once per connection
+ * instead of once per message. Empty user and image fields take the -u and -i
+ * values, "\n", "\t" and "\\" in the message stand for newline, tab and
+ * backslash. Every connection has at most --pipeline records outstanding;
+ * reading stops while the connection the next record goes to is full, so
+ * memory stays bounded for inputs of any size.
+ *
+ * Records go to the connection with the fewest outstanding, with --ordered to
+ * a connection chosen by the user name instead. A connection carries its
+ * records out one after the other (pipelined with --keepalive, the server
+ * answers frames in order), so the records of one user are posted in input
+ * order then; with --connections 1 all records are.
+ *
+ * One line per record is printed as soon as its response is in, followed by
+ * a summary:
+ *
+ *     record=<line> user=<user> result=ok status=<n> files=<n>
+ *     record=<line> user=<user> result=failed error="<message>"
+ *     records=<n> ok=<n> failed=<n> elapsed_s=<seconds>
+ *
+ * With --trace the phases of every record (see enum trace_phase) and the
+ * times of its files are collected in histograms, printed after the summary:
+ *
+ *     phase=<name> count=<n> p50_us=<n> p90_us=<n> p99_us=<n> max_us=<n>
+ *
+ * dns and connect only count the records that waited for them.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+#include "simple_message_client.h"
+#include "latency_histogram.h"
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//a record on its way, the argument of the libsmc callbacks
+struct batch_record
+{
+    struct batch_run *run;
+    struct smc_conn *conn;
+    long line;
+    long status;
+    int files;
+    char *user;
+};
+
+//state of a batch run
+struct batch_run
+{
+    struct smc_conn **conns;
+    long connections;
+    unsigned long records;
+    unsigned long ok;
+    unsigned long failed;
+    struct latency_histogram *phases;  //TRACE_PHASES and one for the files, with --trace
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static int parse_record(char *line, const char *default_user, const char *default_img, struct smc_message *msg);
+static long pick_connection(const struct batch_run *run, const struct batch_options *opts, const char *user);
+static void record_status(void *arg, long status);
+static void record_file(void *arg, const char *name, const char *data, long len);
+static void record_done(void *arg, int result);
+static void record_trace(void *arg, const struct smc_trace *trace);
+static void print_phase(const char *name, const struct latency_histogram *h);
+static double now_s(void);
+
+/**
+ *
+ * \brief posts the records of a file
+ *
+ * \param server the server to connect to
+ * \param port the port to connect to
+ * \param user user of records without one
+ * \param img_url image URL of records without one, may be NULL
+ * \param opts input, connections, window and ordering
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS returned if every record was posted
+ * \retval EXIT_FAILURE returned on error or if any record failed
+ *
+ */
+
+int run_batch(const char *server, const char *port, const char *user, const char *img_url, const struct batch_options *opts){
+    static const struct smc_callbacks callbacks = {record_status, record_file, record_done, NULL};
+    static const struct smc_callbacks traced = {record_status, record_file, record_done, record_trace};
+    struct smc_options lib_opts;
+    struct batch_run run;
+    struct pollfd *pfds;
+    FILE *in = strcmp(opts->path, "-") == 0 ? stdin : fopen(opts->path, "r");
+    char *line = NULL;
+    size_t line_size = 0;
+    long line_no = 0;
+    struct smc_message msg;
+    struct batch_record *next = NULL;   //read, but its connection was full
+    long target = 0;
+    int eof = 0;
+    int state = EXIT_SUCCESS;
+    double start = now_s();
+
+    if (in == NULL) {
+        fprintf(stderr, "%s: Could not open \"%s\": %s\n", sprogram_arg0, opts->path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    memset(&run, 0, sizeof(run));
+    memset(&lib_opts, 0, sizeof(lib_opts));
+    lib_opts.keepalive = opts->keepalive;
+    lib_opts.protocol = opts->protocol;
+    lib_opts.connect_timeout_ms = opts->connect_timeout_ms;
+    //the files of thousands of responses would overwrite each other, only their number is reported
+    lib_opts.files = SMC_FILES_DISCARD;
+
+    run.connections = opts->connections;
+    run.conns = calloc(run.connections, sizeof(*run.conns));
+    pfds = calloc(run.connections, sizeof(*pfds));
+    if (opts->trace && (run.phases = malloc((TRACE_PHASES + 1) * sizeof(*run.phases))) != NULL) {
+        for (int i = 0; i <= TRACE_PHASES; i++) {
+            hist_reset(&run.phases[i]);
+        }
+    }
+    if (run.conns == NULL || pfds == NULL || (opts->trace && run.phases == NULL)) {
+        fprintf(stderr, "%s: calloc() for batch connections failed.\n", sprogram_arg0);
+        state = EXIT_FAILURE;
+        goto out;
+    }
+    for (long i = 0; i < run.connections; i++) {
+        if ((run.conns[i] = smc_open(server, port, &lib_opts)) == NULL) {
+            fprintf(stderr, "%s: Could not create connection: %s\n", sprogram_arg0, strerror(errno));
+            state = EXIT_FAILURE;
+            goto out;
+        }
+    }
+
+    for (;;) {
+        int timeout = -1;
+        long outstanding = 0;
+        nfds_t nfds = 0;
+
+        //read records as long as their connections have room
+        while (!eof) {
+            if (next == NULL) {
+                ssize_t len;
+
+                if ((len = getline(&line, &line_size, in)) == -1) {
+                    eof = 1;
+                    break;
+                }
+                line_no++;
+                if (len > 0 && line[len - 1] == '\n') {
+                    line[len - 1] = '\0';
+                }
+                if (line[0] == '\0') {
+                    continue;
+                }
+                if ((next = calloc(1, sizeof(*next))) == NULL) {
+                    fprintf(stderr, "%s: calloc() for batch record failed.\n", sprogram_arg0);
+                    eof = 1;
+                    state = EXIT_FAILURE;
+                    break;
+                }
+                next->run = &run;
+                next->line = line_no;
+                next->status = -1;
+                run.records++;
+                if (parse_record(line, user, img_url, &msg) == -1 || (next->user = strdup(msg.user)) == NULL) {
+                    printf("record=%ld user=%s result=failed error=\"Malformed record\"\n", next->line, next->user != NULL ? next->user : "");
+                    run.failed++;
+                    free(next->user);
+                    free(next);
+                    next = NULL;
+                    continue;
+                }
+                target = pick_connection(&run, opts, next->user);
+            }
+            if (smc_pending(run.conns[target]) >= opts->window) {
+                break;
+            }
+            next->conn = run.conns[target];
+            if (smc_submit(next->conn, &msg, opts->trace ? &traced : &callbacks, next) == -1) {
+                printf("record=%ld user=%s result=failed error=\"%s\"\n", next->line, next->user, strerror(errno));
+                run.failed++;
+                free(next->user);
+                free(next);
+            }
+            next = NULL;
+        }
+
+        //carry out what is queued, then wait for the busy connections
+        for (long i = 0; i < run.connections; i++) {
+            int wait;
+
+            if (smc_poll(run.conns[i], 0) <= 0) {
+                continue;
+            }
+            outstanding += smc_pending(run.conns[i]);
+            pfds[nfds].fd = smc_fd(run.conns[i]);
+            pfds[nfds++].events = smc_events(run.conns[i]);
+            if ((wait = smc_timeout(run.conns[i])) >= 0 && (timeout < 0 || wait < timeout)) {
+                timeout = wait;
+            }
+        }
+        if (outstanding == 0 && next == NULL && eof) {
+            break;
+        }
+        if (outstanding > 0 && poll(pfds, nfds, timeout) == -1 && errno != EINTR) {
+            fprintf(stderr, "%s: poll() failed: %s\n", sprogram_arg0, strerror(errno));
+            state = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    if (ferror(in)) {
+        fprintf(stderr, "%s: Reading \"%s\" failed\n", sprogram_arg0, opts->path);
+        state = EXIT_FAILURE;
+    }
+    printf("records=%lu ok=%lu failed=%lu elapsed_s=%.3f\n", run.records, run.ok, run.failed, now_s() - start);
+    for (int i = 0; run.phases != NULL && i < TRACE_PHASES; i++) {
+        print_phase(trace_phase_names[i], &run.phases[i]);
+    }
+    if (run.phases != NULL) {
+        print_phase("file", &run.phases[TRACE_PHASES]);
+    }
+    if (run.failed > 0) {
+        state = EXIT_FAILURE;
+    }
+
+out:
+    for (long i = 0; run.conns != NULL && i < run.connections; i++) {
+        smc_close(run.conns[i]);
+    }
+    if (next != NULL) {
+        free(next->user);
+        free(next);
+    }
+    free(run.conns);
+    free(run.phases);
+    free(pfds);
+    free(line);
+    if (in != stdin) {
+        fclose(in);
+    }
+    return state;
+}
+
+/**
+ *
+ * \brief splits a record into its fields
+ *
+ * the message is unescaped in place.
+ *
+ * \param line the record without newline, modified
+ * \param default_user user if the field is empty
+ * \param default_img image URL if the field is empty, may be NULL
+ * \param msg receives the fields, pointing into line
+ *
+ * \return 0 on success, -1 if the record is malformed
+ *
+ */
+
+static int parse_record(char *line, const char *default_user, const char *default_img, struct smc_message *msg){
+    char *img = strchr(line, '\t');
+    char *message;
+    char *in, *out;
+
+    if (img == NULL || (message = strchr(img + 1, '\t')) == NULL) {
+        return -1;
+    }
+    *img++ = '\0';
+    *message++ = '\0';
+
+    msg->user = line[0] != '\0' ? line : default_user;
+    msg->img_url = img[0] != '\0' ? img : default_img;
+    msg->message = message;
+    msg->body_fd = -1;
+    msg->borrow = 0;
+
+    for (in = out = message; *in != '\0'; in++) {
+        if (*in == '\\' && in[1] != '\0') {
+            in++;
+            *out++ = *in == 'n' ? '\n' : *in == 't' ? '\t' : *in;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+    return 0;
+}
+
+/**
+ *
+ * \brief chooses the connection of a record
+ *
+ * \param run the batch run
+ * \param opts --ordered picks by user, otherwise the least busy connection
+ * \param user user of the record
+ *
+ * \return index of the connection
+ *
+ */
+
+static long pick_connection(const struct batch_run *run, const struct batch_options *opts, const char *user){
+    long best = 0;
+
+    if (opts->ordered) {
+        unsigned long hash = 5381;
+
+        //djb2, the same user always lands on the same connection
+        while (*user != '\0') {
+            hash = hash * 33 + (unsigned char)*user++;
+        }
+        return (long)(hash % (unsigned long)run->connections);
+    }
+    for (long i = 1; i < run->connections; i++) {
+        if (smc_pending(run->conns[i]) < smc_pending(run->conns[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ *
+ * \brief status of a response, callback of libsmc
+ *
+ * \param arg the struct batch_record
+ * \param status the status sent by the server
+ *
+ */
+
+static void record_status(void *arg, long status){
+    ((struct batch_record *)arg)->status = status;
+}
+
+/**
+ *
+ * \brief file of a response, callback of libsmc
+ *
+ * \param arg the struct batch_record
+ * \param name ignored
+ * \param data ignored
+ * \param len ignored
+ *
+ */
+
+static void record_file(void *arg, const char *name, const char *data, long len){
+    (void)name;
+    (void)data;
+    (void)len;
+    ((struct batch_record *)arg)->files++;
+}
+
+/**
+ *
+ * \brief prints the result of a record, callback of libsmc
+ *
+ * \param arg the struct batch_record, freed
+ * \param result 0 if the response is complete, -1 on error
+ *
+ */
+
+static void record_done(void *arg, int result){
+    struct batch_record *rec = arg;
+
+    if (result == 0) {
+        printf("record=%ld user=%s result=ok status=%ld files=%d\n", rec->line, rec->user, rec->status, rec->files);
+        rec->run->ok++;
+    } else {
+        printf("record=%ld user=%s result=failed error=\"%s\"\n", rec->line, rec->user, smc_error(rec->conn));
+        rec->run->failed++;
+    }
+    free(rec->user);
+    free(rec);
+}
+
+/**
+ *
+ * \brief collects the timings of a record, callback of libsmc
+ *
+ * \param arg the struct batch_record
+ * \param trace the timings
+ *
+ */
+
+static void record_trace(void *arg, const struct smc_trace *trace){
+    struct latency_histogram *phases = ((struct batch_record *)arg)->run->phases;
+    long long us[TRACE_PHASES];
+
+    trace_phases(trace, us);
+    for (int i = 0; i < TRACE_PHASES; i++) {
+        //a connection is only set up for the first of its records
+        if ((i != TRACE_DNS && i != TRACE_CONNECT) || us[i] > 0) {
+            hist_record(&phases[i], (uint64_t)us[i]);
+        }
+    }
+    for (int i = 0; i < trace->files && i < SMC_TRACE_FILES; i++) {
+        if (trace->file[i].end > 0) {
+            hist_record(&phases[TRACE_PHASES], (uint64_t)(trace->file[i].end - trace->file[i].begin));
+        }
+    }
+}
+
+/**
+ *
+ * \brief prints the distribution of a phase
+ *
+ * \param name name of the phase
+ * \param h its histogram
+ *
+ */
+
+static void print_phase(const char *name, const struct latency_histogram *h){
+    printf("phase=%s count=%llu p50_us=%llu p90_us=%llu p99_us=%llu max_us=%llu\n", name,
+           (unsigned long long)h->total,
+           (unsigned long long)hist_percentile(h, 50),
+           (unsigned long long)hist_percentile(h, 90),
+           (unsigned long long)hist_percentile(h, 99),
+           (unsigned long long)h->max);
+}
+
+/**
+ *
+ * \brief monotonic clock in seconds
+ *
+ * \return current time in seconds
+ *
+ */
+
+static double now_s(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * =================================================================== eof ==
+ */
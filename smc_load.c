@@ -0,0 +1,835 @@
+/**
+ * @file smc_load.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Client - load generator (--load)
+ *
+ * Keeps a fixed number of non-blocking connections busy from one epoll loop.
+ * In plain mode every request gets its own connection: the request is sent,
+ * the connection half-closed and the response fed to an incremental parser as
+ * it arrives, until end of file. With --keepalive a connection stays open and
+ * carries up to --pipeline framed requests at a time. Latencies go into an
+ * HDR style histogram. With --rate, requests are started on a fixed schedule
+ * and their latency is measured from the scheduled start, so a stalled server
+ * is not hidden by the generator waiting for it (coordinated omission).
+ * With --trace the name is resolved once and timed, and connect (including
+ * the keep-alive handshake) and time to first byte get histograms of their
+ * own, time to first byte measured from the start of the request like the
+ * latency.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "simple_message_client.h"
+#include "simple_message_protocol.h"
+#include "latency_histogram.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//receive buffer shared by all connections, the parser keeps no references
+#define LOAD_BUF_SIZE 65536
+#define LOAD_MAX_EVENTS 256
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+enum slot_state {SLOT_IDLE, SLOT_CONNECTING, SLOT_OPEN};
+
+//what the connection expects to receive next
+enum slot_input {IN_PLAIN, IN_ACK, IN_HEADER, IN_BODY};
+
+//one concurrent connection
+struct load_slot
+{
+    int fd;
+    const struct addrinfo *addr;    //address connected to
+    enum slot_state state;
+    unsigned events;    //epoll interest currently registered
+    double *starts;     //start times of the outstanding requests, a ring of --pipeline entries
+    long head;
+    long inflight;      //requests sent or queued, response not complete
+    long unsent;        //requests not completely sent
+    int hello_pending;  //keep-alive hello not completely sent
+    size_t out_off;     //bytes of the current hello or request sent
+    enum slot_input input;
+    double ack_deadline;
+    char hdr[PROTO_HELLO_LEN > PROTO_FRAME_HEADER ? PROTO_HELLO_LEN : PROTO_FRAME_HEADER];
+    size_t hdr_len;     //bytes of the hello or frame header received
+    uint32_t body_left; //bytes of the current response frame still to come
+    int version;        //protocol version the server acknowledged, 0 = plain
+    double connect_start;
+    int first_byte;     //the oldest outstanding response has begun to arrive
+    struct smc_parser parser;
+};
+
+//state of one run
+struct load_run
+{
+    int epfd;
+    const struct addrinfo *addr;    //address new connections go to
+    int addr_found;     //a connection to addr succeeded, no more falling back
+    int unreachable;    //every address failed
+    const struct load_options *opts;
+    const char *out;    //request as sent, framed with --keepalive
+    size_t out_len;
+    unsigned long issued;
+    unsigned long completed;
+    unsigned long errors;
+    long inflight;
+    int refused;        //the server did not acknowledge keep-alive
+    struct latency_histogram hist;
+    struct latency_histogram connect_hist;  //with --trace
+    struct latency_histogram ttfb_hist;     //with --trace
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static double now_s(void);
+static int slot_has_room(const struct load_run *run, const struct load_slot *slot, long round);
+static void slot_issue(struct load_run *run, struct load_slot *slot, double start);
+static int slot_connect(struct load_run *run, struct load_slot *slot);
+static int next_address(struct load_run *run, const struct addrinfo *failed);
+static void slot_event(struct load_run *run, struct load_slot *slot, unsigned events);
+static int slot_send(struct load_run *run, struct load_slot *slot);
+static int slot_receive(struct load_run *run, struct load_slot *slot, const char *buf, size_t len);
+static int slot_parse(struct load_slot *slot, const char *buf, size_t len);
+static int slot_interest(struct load_run *run, struct load_slot *slot);
+static void slot_first_byte(struct load_run *run, struct load_slot *slot);
+static void slot_complete(struct load_run *run, struct load_slot *slot);
+static void print_histogram(const char *name, const struct latency_histogram *h);
+static void slot_close(struct load_run *run, struct load_slot *slot);
+
+/**
+ *
+ * \brief runs the load generator
+ *
+ * \param server the server to connect to
+ * \param port the port to connect to
+ * \param request the request sent on every connection
+ * \param request_len length of the request
+ * \param opts connections, request count, duration, rate and keep-alive
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS returned if every request succeeded
+ * \retval EXIT_FAILURE returned on error or if any request failed
+ *
+ */
+
+int run_load(const char *server, const char *port, const char *request, size_t request_len, const struct load_options *opts){
+    struct addrinfo hints;
+    struct addrinfo *servinfo;
+    struct load_slot *slots;
+    struct load_run *run;
+    struct epoll_event events[LOAD_MAX_EVENTS];
+    double start, deadline, elapsed, dns;
+    long pipeline = opts->keepalive ? opts->pipeline : 1;
+    char *framed = NULL;
+    int state;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    dns = now_s();
+    if ((state = getaddrinfo(server, port, &hints, &servinfo)) != 0) {
+        fprintf(stderr, "%s: Could not obtain address information: %s\n", sprogram_arg0, gai_strerror(state));
+        return EXIT_FAILURE;
+    }
+    dns = now_s() - dns;
+
+    run = calloc(1, sizeof(*run));
+    slots = calloc(opts->connections, sizeof(*slots));
+    for (long i = 0; slots != NULL && i < opts->connections; i++) {
+        if ((slots[i].starts = calloc(pipeline, sizeof(*slots[i].starts))) == NULL) {
+            break;
+        }
+    }
+    //one frame is sent over and over, so frame the request once
+    if (opts->keepalive && (framed = malloc(PROTO_FRAME_HEADER + request_len)) != NULL) {
+        uint32_t len = htonl((uint32_t)request_len);
+
+        memcpy(framed, &len, PROTO_FRAME_HEADER);
+        memcpy(framed + PROTO_FRAME_HEADER, request, request_len);
+    }
+    if (run == NULL || slots == NULL || slots[opts->connections - 1].starts == NULL || (opts->keepalive && framed == NULL)) {
+        fprintf(stderr, "%s: calloc() for load generator failed.\n", sprogram_arg0);
+        state = EXIT_FAILURE;
+        goto out;
+    }
+
+    run->opts = opts;
+    run->addr = servinfo;
+    run->out = framed != NULL ? framed : request;
+    run->out_len = framed != NULL ? PROTO_FRAME_HEADER + request_len : request_len;
+    hist_reset(&run->hist);
+    hist_reset(&run->connect_hist);
+    hist_reset(&run->ttfb_hist);
+
+    if ((run->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        fprintf(stderr, "%s: epoll_create1() failed: %s\n", sprogram_arg0, strerror(errno));
+        state = EXIT_FAILURE;
+        goto out;
+    }
+
+    start = now_s();
+    deadline = opts->duration > 0 ? start + opts->duration : 0;
+
+    for (;;) {
+        double now = now_s();
+        int timeout = -1;
+        int more = (opts->requests == 0 || run->issued < (unsigned long)opts->requests)
+                && (deadline == 0 || now < deadline) && !run->refused && !run->unreachable;
+
+        //start requests while the schedule allows it, spread over the connections round by round
+        for (long round = 0; more && round < pipeline; round++) {
+            for (long i = 0; more && i < opts->connections; i++) {
+                double scheduled = now;
+
+                if (!slot_has_room(run, &slots[i], round)) {
+                    continue;
+                }
+                if (opts->rate > 0) {
+                    scheduled = start + run->issued / opts->rate;
+                    if (scheduled > now) {
+                        timeout = (int)((scheduled - now) * 1000) + 1;
+                        round = pipeline;
+                        break;
+                    }
+                }
+                run->issued++;
+                slot_issue(run, &slots[i], scheduled);
+                more = (opts->requests == 0 || run->issued < (unsigned long)opts->requests);
+            }
+        }
+
+        //a server without keep-alive never answers the hello
+        for (long i = 0; opts->keepalive && i < opts->connections; i++) {
+            if (slots[i].state != SLOT_OPEN || slots[i].input != IN_ACK) {
+                continue;
+            }
+            if (now >= slots[i].ack_deadline) {
+                if (!run->refused) {
+                    fprintf(stderr, "%s: Server did not acknowledge keep-alive\n", sprogram_arg0);
+                }
+                run->refused = 1;
+                more = 0;
+                slot_close(run, &slots[i]);
+                continue;
+            }
+            int until_ack = (int)((slots[i].ack_deadline - now) * 1000) + 1;
+            if (timeout < 0 || until_ack < timeout) {
+                timeout = until_ack;
+            }
+        }
+
+        if (!more && run->inflight == 0) {
+            break;
+        }
+        if (deadline != 0 && more) {
+            int until_deadline = (int)((deadline - now) * 1000) + 1;
+            if (timeout < 0 || until_deadline < timeout) {
+                timeout = until_deadline;
+            }
+        }
+
+        int n = epoll_wait(run->epfd, events, LOAD_MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "%s: epoll_wait() failed: %s\n", sprogram_arg0, strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            slot_event(run, events[i].data.ptr, events[i].events);
+        }
+    }
+    elapsed = now_s() - start;
+
+    printf("requests=%lu errors=%lu elapsed_s=%.3f throughput_rps=%.1f\n",
+           run->completed, run->errors, elapsed, elapsed > 0 ? run->completed / elapsed : 0);
+    printf("latency_us p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu mean=%.1f\n",
+           (unsigned long long)hist_percentile(&run->hist, 50),
+           (unsigned long long)hist_percentile(&run->hist, 90),
+           (unsigned long long)hist_percentile(&run->hist, 99),
+           (unsigned long long)hist_percentile(&run->hist, 99.9),
+           (unsigned long long)run->hist.max, hist_mean(&run->hist));
+    if (opts->trace) {
+        printf("dns_us=%llu\n", (unsigned long long)(dns * 1e6));
+        print_histogram("connect_us", &run->connect_hist);
+        print_histogram("ttfb_us", &run->ttfb_hist);
+    }
+    fflush(stdout);
+
+    state = (run->errors == 0 && !run->refused && run->issued == run->completed && run->inflight == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    for (long i = 0; i < opts->connections; i++) {
+        if (slots[i].state != SLOT_IDLE) {
+            close(slots[i].fd);
+        }
+    }
+    close(run->epfd);
+
+out:
+    for (long i = 0; slots != NULL && i < opts->connections; i++) {
+        free(slots[i].starts);
+    }
+    free(framed);
+    free(run);
+    free(slots);
+    freeaddrinfo(servinfo);
+
+    return state;
+}
+
+/**
+ *
+ * \brief prints a histogram of the trace in the format of the latency line
+ *
+ * \param name name of the measurement
+ * \param h the histogram
+ *
+ */
+
+static void print_histogram(const char *name, const struct latency_histogram *h){
+    printf("%s count=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu mean=%.1f\n", name,
+           (unsigned long long)h->total,
+           (unsigned long long)hist_percentile(h, 50),
+           (unsigned long long)hist_percentile(h, 90),
+           (unsigned long long)hist_percentile(h, 99),
+           (unsigned long long)hist_percentile(h, 99.9),
+           (unsigned long long)h->max, hist_mean(h));
+}
+
+/**
+ *
+ * \brief monotonic clock in seconds
+ *
+ * \return current time in seconds
+ *
+ */
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ *
+ * \brief whether a connection takes another request in this round
+ *
+ * \param run the run
+ * \param slot the connection
+ * \param round requests every connection already got in this pass
+ *
+ * \return 1 if a request can be issued on the connection, 0 otherwise
+ *
+ */
+
+static int slot_has_room(const struct load_run *run, const struct load_slot *slot, long round){
+    if (!run->opts->keepalive) {
+        return slot->state == SLOT_IDLE;
+    }
+    return slot->inflight <= round;
+}
+
+/**
+ *
+ * \brief queues a request on a connection, connecting first if needed
+ *
+ * \param run the run
+ * \param slot the connection
+ * \param start start time the latency is measured from
+ *
+ */
+
+static void slot_issue(struct load_run *run, struct load_slot *slot, double start){
+    long pipeline = run->opts->keepalive ? run->opts->pipeline : 1;
+
+    if (slot->state == SLOT_IDLE && slot_connect(run, slot) == -1) {
+        run->errors++;
+        return;
+    }
+
+    slot->starts[(slot->head + slot->inflight) % pipeline] = start;
+    slot->inflight++;
+    slot->unsent++;
+    run->inflight++;
+
+    if (slot->state == SLOT_OPEN && slot_interest(run, slot) == -1) {
+        slot_close(run, slot);
+    }
+}
+
+/**
+ *
+ * \brief starts a non-blocking connect
+ *
+ * \param run the run
+ * \param slot an idle connection
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int slot_connect(struct load_run *run, struct load_slot *slot){
+    struct epoll_event ev;
+    const struct addrinfo *ai;
+
+    for (;;) {
+        ai = run->addr;
+        slot->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (slot->fd == -1) {
+            fprintf(stderr, "%s: socket() failed: %s\n", sprogram_arg0, strerror(errno));
+            return -1;
+        }
+        if (connect(slot->fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            break;
+        }
+        int err = errno;
+
+        close(slot->fd);
+        if (next_address(run, ai) == -1) {
+            if (!run->unreachable) {
+                fprintf(stderr, "%s: connect() failed: %s\n", sprogram_arg0, strerror(err));
+            }
+            return -1;
+        }
+    }
+    slot->addr = ai;
+
+    ev.events = EPOLLOUT;
+    ev.data.ptr = slot;
+    if (epoll_ctl(run->epfd, EPOLL_CTL_ADD, slot->fd, &ev) == -1) {
+        fprintf(stderr, "%s: epoll_ctl() failed: %s\n", sprogram_arg0, strerror(errno));
+        close(slot->fd);
+        return -1;
+    }
+
+    slot->state = SLOT_CONNECTING;
+    slot->events = EPOLLOUT;
+    slot->head = 0;
+    slot->out_off = 0;
+    slot->hdr_len = 0;
+    slot->hello_pending = run->opts->keepalive;
+    slot->input = run->opts->keepalive ? IN_ACK : IN_PLAIN;
+    slot->version = 0;
+    slot->connect_start = now_s();
+    slot->first_byte = 0;
+    smc_parser_init(&slot->parser, 0);
+    return 0;
+}
+
+/**
+ *
+ * \brief falls back to the next address after a failed connect
+ *
+ * e.g. localhost resolves to ::1 first while the server may only listen on
+ * IPv4. Until a connection succeeded, a failed connect moves all connections
+ * on to the next address, so a dead address costs one failed non-blocking
+ * connect instead of a probe connection to the server.
+ *
+ * \param run the run
+ * \param failed the address the connect failed on
+ *
+ * \return 0 if the connect is to be retried on run->addr, -1 otherwise
+ *
+ */
+
+static int next_address(struct load_run *run, const struct addrinfo *failed){
+    if (run->addr_found || run->unreachable) {
+        return -1;
+    }
+    //another connection already moved on
+    if (failed != run->addr) {
+        return 0;
+    }
+    if (run->addr->ai_next == NULL) {
+        fprintf(stderr, "%s: Could not connect\n", sprogram_arg0);
+        run->unreachable = 1;
+        return -1;
+    }
+    run->addr = run->addr->ai_next;
+    return 0;
+}
+
+/**
+ *
+ * \brief advances a connection after an epoll event
+ *
+ * \param run the run
+ * \param slot the connection
+ * \param events the epoll events
+ *
+ */
+
+static void slot_event(struct load_run *run, struct load_slot *slot, unsigned events){
+    static char buf[LOAD_BUF_SIZE];
+    ssize_t n;
+
+    if (slot->state == SLOT_CONNECTING) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+
+        if (getsockopt(slot->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0) {
+            double connect_start = slot->connect_start;
+
+            //retry the queued requests on the next address, they were not sent yet
+            if (err != 0 && next_address(run, slot->addr) == 0) {
+                close(slot->fd);
+                if (slot_connect(run, slot) == 0) {
+                    slot->connect_start = connect_start;
+                    return;
+                }
+                slot->fd = -1;
+            } else if (!run->unreachable) {
+                fprintf(stderr, "%s: connect() failed: %s\n", sprogram_arg0, strerror(err != 0 ? err : errno));
+            }
+            slot_close(run, slot);
+            return;
+        }
+        run->addr = slot->addr;
+        run->addr_found = 1;
+        slot->state = SLOT_OPEN;
+        slot->ack_deadline = now_s() + KEEPALIVE_ACK_TIMEOUT_MS / 1000.0;
+        if (run->opts->trace && !run->opts->keepalive) {
+            hist_record(&run->connect_hist, (uint64_t)((now_s() - slot->connect_start) * 1e6));
+        }
+    }
+
+    if ((events & EPOLLOUT) && slot_send(run, slot) == -1) {
+        slot_close(run, slot);
+        return;
+    }
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        return;
+    }
+
+    for (;;) {
+        n = read(slot->fd, buf, sizeof(buf));
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            fprintf(stderr, "%s: Cannot read from socket: %s\n", sprogram_arg0, strerror(errno));
+            slot_close(run, slot);
+            return;
+        }
+        if (slot_receive(run, slot, buf, n) == -1 || n == 0) {
+            slot_close(run, slot);
+            return;
+        }
+    }
+}
+
+/**
+ *
+ * \brief sends the pending hello and requests as far as the socket takes them
+ *
+ * \param run the run
+ * \param slot the connection
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int slot_send(struct load_run *run, struct load_slot *slot){
+    while (slot->hello_pending || slot->unsent > 0) {
+        const char *out = slot->hello_pending ? PROTO_HELLO(run->opts->protocol) : run->out;
+        size_t len = slot->hello_pending ? PROTO_HELLO_LEN : run->out_len;
+        int more = slot->unsent > (slot->hello_pending ? 0 : 1) ? MSG_MORE : 0;
+        ssize_t n = send(slot->fd, out + slot->out_off, len - slot->out_off, MSG_NOSIGNAL | more);
+
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return slot_interest(run, slot);
+            }
+            fprintf(stderr, "%s: Error when writing to socket: %s\n", sprogram_arg0, strerror(errno));
+            return -1;
+        }
+        slot->out_off += n;
+        if (slot->out_off < len) {
+            continue;
+        }
+        slot->out_off = 0;
+        if (slot->hello_pending) {
+            slot->hello_pending = 0;
+        } else {
+            slot->unsent--;
+        }
+    }
+
+    //plain mode: end of the request is end of file
+    if (!run->opts->keepalive && shutdown(slot->fd, SHUT_WR) == -1) {
+        fprintf(stderr, "%s: Error when shutting down socket for writing: %s\n", sprogram_arg0, strerror(errno));
+        return -1;
+    }
+    return slot_interest(run, slot);
+}
+
+/**
+ *
+ * \brief handles received bytes of a connection
+ *
+ * \param run the run
+ * \param slot the connection
+ * \param buf the received bytes
+ * \param len number of bytes, 0 at end of file
+ *
+ * \return 0 while the connection is fine, -1 if it has to be closed
+ *
+ */
+
+static int slot_receive(struct load_run *run, struct load_slot *slot, const char *buf, size_t len){
+    size_t off = 0;
+
+    if (slot->input == IN_PLAIN) {
+        if (len > 0) {
+            slot_first_byte(run, slot);
+        }
+        if (slot_parse(slot, buf, len) == -1) {
+            return -1;
+        }
+        if (len == 0) {
+            slot_complete(run, slot);
+        }
+        return 0;
+    }
+
+    if (len == 0) {
+        if (slot->inflight > 0) {
+            fprintf(stderr, "%s: Server closed the connection with %ld requests outstanding\n", sprogram_arg0, slot->inflight);
+        }
+        return -1;
+    }
+
+    while (off < len) {
+        size_t need, take;
+
+        switch (slot->input) {
+        case IN_ACK:
+        case IN_HEADER:
+            need = slot->input == IN_ACK ? PROTO_HELLO_LEN : PROTO_FRAME_HEADER;
+            if (slot->input == IN_HEADER) {
+                slot_first_byte(run, slot);
+            }
+            take = need - slot->hdr_len < len - off ? need - slot->hdr_len : len - off;
+            memcpy(slot->hdr + slot->hdr_len, buf + off, take);
+            slot->hdr_len += take;
+            off += take;
+            if (slot->hdr_len < need) {
+                break;
+            }
+            slot->hdr_len = 0;
+            if (slot->input == IN_ACK) {
+                int version = PROTO_HELLO_VERSION(slot->hdr);
+
+                if (version == 0 || version > run->opts->protocol) {
+                    fprintf(stderr, "%s: Invalid keep-alive acknowledgement\n", sprogram_arg0);
+                    return -1;
+                }
+                slot->version = version;
+                slot->input = IN_HEADER;
+                if (run->opts->trace) {
+                    hist_record(&run->connect_hist, (uint64_t)((now_s() - slot->connect_start) * 1e6));
+                }
+                break;
+            }
+            memcpy(&slot->body_left, slot->hdr, PROTO_FRAME_HEADER);
+            slot->body_left = ntohl(slot->body_left);
+            slot->input = IN_BODY;
+            smc_parser_init(&slot->parser, slot->version);
+            //an empty frame is complete right away
+            if (slot->body_left > 0) {
+                break;
+            }
+            /* falls through */
+        case IN_BODY:
+            take = slot->body_left < len - off ? slot->body_left : len - off;
+            if (take > 0 && slot_parse(slot, buf + off, take) == -1) {
+                return -1;
+            }
+            slot->body_left -= take;
+            off += take;
+            if (slot->body_left > 0) {
+                break;
+            }
+            if (slot->inflight == 0) {
+                fprintf(stderr, "%s: Unexpected response\n", sprogram_arg0);
+                return -1;
+            }
+            if (slot_parse(slot, NULL, 0) == -1) {
+                return -1;
+            }
+            slot->input = IN_HEADER;
+            slot_complete(run, slot);
+            break;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief feeds a fragment of the response to the parser of a connection
+ *
+ * \param slot the connection
+ * \param buf the fragment, contents are only checked, not kept
+ * \param len length of the fragment, 0 at the end of the response
+ *
+ * \return 0 while the response is fine, -1 for a malformed response or a status other than 0
+ *
+ */
+
+static int slot_parse(struct load_slot *slot, const char *buf, size_t len){
+    struct smc_event ev;
+    size_t off = 0;
+    long status;
+
+    do {
+        if (len == 0) {
+            smc_parser_finish(&slot->parser, &ev);
+        } else {
+            off += smc_parse(&slot->parser, buf + off, len - off, &ev);
+        }
+
+        if (ev.type == SMC_EVENT_ERROR) {
+            fprintf(stderr, "%s: %s\n", sprogram_arg0, ev.error);
+            return -1;
+        }
+        if (ev.type == SMC_EVENT_STATUS) {
+            status = ev.status;
+            if (status != 0) {
+                fprintf(stderr, "%s: Server returned status %ld\n", sprogram_arg0, status);
+                return -1;
+            }
+        }
+    } while (ev.type != SMC_EVENT_NEED_MORE && ev.type != SMC_EVENT_END);
+
+    return 0;
+}
+
+/**
+ *
+ * \brief registers the epoll events the connection waits for
+ *
+ * \param run the run
+ * \param slot the connection
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int slot_interest(struct load_run *run, struct load_slot *slot){
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    if (slot->hello_pending || slot->unsent > 0) {
+        ev.events |= EPOLLOUT;
+    }
+    if (ev.events == slot->events) {
+        return 0;
+    }
+    ev.data.ptr = slot;
+    if (epoll_ctl(run->epfd, EPOLL_CTL_MOD, slot->fd, &ev) == -1) {
+        fprintf(stderr, "%s: epoll_ctl() failed: %s\n", sprogram_arg0, strerror(errno));
+        return -1;
+    }
+    slot->events = ev.events;
+    return 0;
+}
+
+/**
+ *
+ * \brief records the time to first byte of the oldest outstanding request once
+ *
+ * \param run the run
+ * \param slot the connection
+ *
+ */
+
+static void slot_first_byte(struct load_run *run, struct load_slot *slot){
+    if (!run->opts->trace || slot->first_byte || slot->inflight == 0) {
+        return;
+    }
+    slot->first_byte = 1;
+    hist_record(&run->ttfb_hist, (uint64_t)((now_s() - slot->starts[slot->head]) * 1e6));
+}
+
+/**
+ *
+ * \brief records the oldest outstanding request of a connection as done
+ *
+ * \param run the run
+ * \param slot the connection
+ *
+ */
+
+static void slot_complete(struct load_run *run, struct load_slot *slot){
+    long pipeline = run->opts->keepalive ? run->opts->pipeline : 1;
+    double start = slot->starts[slot->head];
+
+    slot->head = (slot->head + 1) % pipeline;
+    slot->first_byte = 0;
+    slot->inflight--;
+    run->inflight--;
+    run->completed++;
+    hist_record(&run->hist, (uint64_t)((now_s() - start) * 1e6));
+}
+
+/**
+ *
+ * \brief closes a connection, its outstanding requests count as failed
+ *
+ * \param run the run
+ * \param slot the connection, idle afterwards
+ *
+ */
+
+static void slot_close(struct load_run *run, struct load_slot *slot){
+    //close() also removes the socket from the epoll set
+    close(slot->fd);
+    slot->state = SLOT_IDLE;
+
+    run->errors += slot->inflight;
+    run->inflight -= slot->inflight;
+    slot->inflight = 0;
+    slot->unsent = 0;
+}
+
+/*
+ * =================================================================== eof ==
+ */
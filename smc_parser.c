@@ -0,0 +1,471 @@
+/**
+ * @file smc_parser.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Client - incremental response parser
+ *
+ * A state machine over the response of the business logic:
+ *
+ *     status=<n>\n
+ *     file=<name>\n len=<n>\n <n bytes>   (repeated)
+ *
+ * or the binary response of protocol version 2 (see simple_message_protocol.h),
+ * which reports the same events from fixed-width fields. The checksum that
+ * follows every file from version 3 on is reported with SMC_EVENT_FILE_END.
+ *
+ * Input may be split anywhere. Every call to smc_parse() consumes some of
+ * the given fragment and reports one event; file content is reported as
+ * pointers into the fragment, so nothing is allocated or copied except the
+ * header lines themselves.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include "libsmc.h"
+#include "simple_message_protocol.h"
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void parse_line(struct smc_parser *p, struct smc_event *ev);
+static size_t binary_need(const struct smc_parser *p);
+static void parse_binary(struct smc_parser *p, struct smc_event *ev);
+static int parse_value(const char *line, const char *key, long *value);
+static void parse_error(struct smc_parser *p, struct smc_event *ev, const char *error);
+
+/**
+ *
+ * \brief prepares a parser for a new response
+ *
+ * \param p the parser
+ * \param version protocol version of the response, text below PROTO_VERSION_BINARY
+ *
+ */
+
+void smc_parser_init(struct smc_parser *p, int version){
+    p->binary = version >= PROTO_VERSION_BINARY;
+    p->checksum = version >= PROTO_VERSION_CRC;
+    p->state = p->binary ? SMC_PARSE_BIN_HEADER : SMC_PARSE_STATUS;
+    p->body_left = 0;
+    p->line_len = 0;
+    p->files_left = 0;
+    p->name[0] = '\0';
+    p->error = NULL;
+}
+
+/**
+ *
+ * \brief parses the next part of a fragment
+ *
+ * Call repeatedly with the unconsumed rest of the fragment until the event is
+ * SMC_EVENT_NEED_MORE, which means the whole fragment was consumed, or
+ * SMC_EVENT_ERROR.
+ *
+ * \param p the parser
+ * \param buf the fragment
+ * \param len length of the fragment, may be 0
+ * \param ev receives the event
+ *
+ * \return the number of bytes of buf consumed
+ *
+ */
+
+size_t smc_parse(struct smc_parser *p, const char *buf, size_t len, struct smc_event *ev){
+    const char *nl;
+    size_t used = 0;
+    size_t take;
+
+    ev->type = SMC_EVENT_NEED_MORE;
+
+    while (ev->type == SMC_EVENT_NEED_MORE) {
+        if (p->state == SMC_PARSE_ERROR) {
+            ev->type = SMC_EVENT_ERROR;
+            ev->error = p->error;
+            break;
+        }
+
+        if (p->state == SMC_PARSE_BODY) {
+            if (p->body_left == 0 && p->checksum) {
+                p->state = SMC_PARSE_BIN_CRC;
+                continue;
+            }
+            if (p->body_left == 0) {
+                p->state = p->binary ? SMC_PARSE_BIN_FILE : SMC_PARSE_FILE;
+                ev->type = SMC_EVENT_FILE_END;
+                ev->name = p->name;
+                ev->has_crc = 0;
+                break;
+            }
+            if (used == len) {
+                break;
+            }
+            take = (size_t)p->body_left < len - used ? (size_t)p->body_left : len - used;
+            p->body_left -= take;
+            ev->type = SMC_EVENT_FILE_DATA;
+            ev->data = buf + used;
+            ev->data_len = take;
+            used += take;
+            break;
+        }
+
+        //checksum trailer of a file
+        if (p->state == SMC_PARSE_BIN_CRC) {
+            if (used == len) {
+                break;
+            }
+            take = PROTO_BIN_FILE_TRAILER - p->line_len < len - used ? PROTO_BIN_FILE_TRAILER - p->line_len : len - used;
+            memcpy(p->line + p->line_len, buf + used, take);
+            p->line_len += take;
+            used += take;
+            if (p->line_len == PROTO_BIN_FILE_TRAILER) {
+                uint32_t crc;
+
+                memcpy(&crc, p->line, sizeof(crc));
+                p->line_len = 0;
+                p->state = SMC_PARSE_BIN_FILE;
+                ev->type = SMC_EVENT_FILE_END;
+                ev->name = p->name;
+                ev->has_crc = 1;
+                ev->crc = ntohl(crc);
+            }
+            continue;
+        }
+
+        //binary header: collect the fixed-width fields, then the name
+        if (p->state == SMC_PARSE_BIN_HEADER || p->state == SMC_PARSE_BIN_FILE) {
+            size_t need;
+
+            if (p->state == SMC_PARSE_BIN_FILE && p->files_left == 0) {
+                if (used < len) {
+                    parse_error(p, ev, "Data after the last file of the response");
+                }
+                break;
+            }
+            if (used == len) {
+                break;
+            }
+            need = binary_need(p);
+            if (p->state == SMC_PARSE_BIN_FILE && need - PROTO_BIN_FILE_HEADER >= SMC_NAME_MAX) {
+                parse_error(p, ev, "File name in response too long");
+                break;
+            }
+            take = need - p->line_len < len - used ? need - p->line_len : len - used;
+            memcpy(p->line + p->line_len, buf + used, take);
+            p->line_len += take;
+            used += take;
+            //the name length is known once the fixed fields are complete
+            if (p->line_len == need && binary_need(p) == need) {
+                parse_binary(p, ev);
+                p->line_len = 0;
+            }
+            continue;
+        }
+
+        //header line: collect up to the newline
+        if (used == len) {
+            break;
+        }
+        nl = memchr(buf + used, '\n', len - used);
+        take = nl != NULL ? (size_t)(nl - (buf + used)) : len - used;
+        if (p->line_len + take > SMC_LINE_MAX) {
+            parse_error(p, ev, "Response header line too long");
+            break;
+        }
+        memcpy(p->line + p->line_len, buf + used, take);
+        p->line_len += take;
+        used += take;
+        if (nl == NULL) {
+            break;
+        }
+
+        //the file= line alone is no event, the loop goes on with the len= line
+        used++;
+        p->line[p->line_len] = '\0';
+        parse_line(p, ev);
+        p->line_len = 0;
+    }
+
+    return used;
+}
+
+/**
+ *
+ * \brief reports the end of the input
+ *
+ * A status line without newline is still accepted, as with getline(). Any
+ * other incomplete line or file content is an error.
+ *
+ * \param p the parser
+ * \param ev receives SMC_EVENT_STATUS for a pending status line, then
+ *        SMC_EVENT_END or SMC_EVENT_ERROR on the next call
+ *
+ */
+
+void smc_parser_finish(struct smc_parser *p, struct smc_event *ev){
+    switch (p->state) {
+    case SMC_PARSE_STATUS:
+        if (p->line_len == 0) {
+            parse_error(p, ev, "Error when getting line for \"status=\"");
+            return;
+        }
+        p->line[p->line_len] = '\0';
+        parse_line(p, ev);
+        p->line_len = 0;
+        return;
+    case SMC_PARSE_FILE:
+        if (p->line_len == 0) {
+            ev->type = SMC_EVENT_END;
+            return;
+        }
+        parse_error(p, ev, "Error when getting line for \"len=\"");
+        return;
+    case SMC_PARSE_LEN:
+        parse_error(p, ev, "Error when getting line for \"len=\"");
+        return;
+    case SMC_PARSE_BIN_HEADER:
+        parse_error(p, ev, "Response ended before its header");
+        return;
+    case SMC_PARSE_BIN_FILE:
+        if (p->files_left == 0 && p->line_len == 0) {
+            ev->type = SMC_EVENT_END;
+            return;
+        }
+        parse_error(p, ev, "Response ended before its last file");
+        return;
+    case SMC_PARSE_BODY:
+        if (p->body_left == 0 && !p->checksum) {
+            p->state = p->binary ? SMC_PARSE_BIN_FILE : SMC_PARSE_FILE;
+            ev->type = SMC_EVENT_FILE_END;
+            ev->name = p->name;
+            ev->has_crc = 0;
+            return;
+        }
+        parse_error(p, ev, p->body_left == 0 ? "Response ended before the checksum of a file" : "Cannot read from socket");
+        return;
+    case SMC_PARSE_BIN_CRC:
+        parse_error(p, ev, "Response ended before the checksum of a file");
+        return;
+    default:
+        ev->type = SMC_EVENT_ERROR;
+        ev->error = p->error;
+        return;
+    }
+}
+
+/**
+ *
+ * \brief bytes of the current file content still to come
+ *
+ * \param p the parser
+ *
+ * \return the number of bytes, 0 outside of file content
+ *
+ */
+
+long smc_parser_body_left(const struct smc_parser *p){
+    return p->state == SMC_PARSE_BODY ? p->body_left : 0;
+}
+
+/**
+ *
+ * \brief marks file content as consumed that the caller read itself
+ *
+ * e.g. after moving the rest of a file with splice(). The next call to
+ * smc_parse() reports SMC_EVENT_FILE_END once the content is complete.
+ *
+ * \param p the parser
+ * \param n number of bytes, at most smc_parser_body_left()
+ *
+ */
+
+void smc_parser_skip(struct smc_parser *p, long n){
+    if (p->state == SMC_PARSE_BODY && n <= p->body_left) {
+        p->body_left -= n;
+    }
+}
+
+/**
+ *
+ * \brief handles a complete header line
+ *
+ * \param p the parser, p->line holds the line without newline
+ * \param ev receives the event
+ *
+ */
+
+static void parse_line(struct smc_parser *p, struct smc_event *ev){
+    long value;
+    size_t name_len;
+
+    switch (p->state) {
+    case SMC_PARSE_STATUS:
+        if (parse_value(p->line, "status=", &value) == -1) {
+            parse_error(p, ev, "Could not find \"status=\".");
+            return;
+        }
+        p->state = SMC_PARSE_FILE;
+        ev->type = SMC_EVENT_STATUS;
+        ev->status = value;
+        return;
+    case SMC_PARSE_FILE:
+        if (strncmp(p->line, "file=", strlen("file=")) != 0) {
+            parse_error(p, ev, "Could not find \"file=\".");
+            return;
+        }
+        name_len = p->line_len - strlen("file=");
+        if (name_len >= SMC_NAME_MAX) {
+            parse_error(p, ev, "File name in response too long");
+            return;
+        }
+        memcpy(p->name, p->line + strlen("file="), name_len + 1);
+        p->state = SMC_PARSE_LEN;
+        return;
+    case SMC_PARSE_LEN:
+        if (parse_value(p->line, "len=", &value) == -1 || value < 0) {
+            parse_error(p, ev, "Could not convert \"len=\" to long.");
+            return;
+        }
+        p->state = SMC_PARSE_BODY;
+        p->body_left = value;
+        ev->type = SMC_EVENT_FILE_BEGIN;
+        ev->name = p->name;
+        ev->len = value;
+        return;
+    default:
+        return;
+    }
+}
+
+/**
+ *
+ * \brief bytes the current binary header has in total
+ *
+ * \param p the parser, in SMC_PARSE_BIN_HEADER or SMC_PARSE_BIN_FILE
+ *
+ * \return the length, for a file header including the name once its length is known
+ *
+ */
+
+static size_t binary_need(const struct smc_parser *p){
+    uint16_t name_len;
+
+    if (p->state == SMC_PARSE_BIN_HEADER) {
+        return PROTO_BIN_HEADER;
+    }
+    if (p->line_len < PROTO_BIN_FILE_HEADER) {
+        return PROTO_BIN_FILE_HEADER;
+    }
+    memcpy(&name_len, p->line, sizeof(name_len));
+    return PROTO_BIN_FILE_HEADER + ntohs(name_len);
+}
+
+/**
+ *
+ * \brief handles a complete binary header
+ *
+ * \param p the parser, p->line holds the header
+ * \param ev receives the event
+ *
+ */
+
+static void parse_binary(struct smc_parser *p, struct smc_event *ev){
+    uint32_t u32;
+    uint16_t name_len;
+    uint64_t len;
+
+    if (p->state == SMC_PARSE_BIN_HEADER) {
+        memcpy(&u32, p->line, sizeof(u32));
+        ev->status = (int32_t)ntohl(u32);
+        memcpy(&u32, p->line + sizeof(u32), sizeof(u32));
+        p->files_left = ntohl(u32);
+        p->state = SMC_PARSE_BIN_FILE;
+        ev->type = SMC_EVENT_STATUS;
+        return;
+    }
+
+    memcpy(&name_len, p->line, sizeof(name_len));
+    name_len = ntohs(name_len);
+    memcpy(&len, p->line + sizeof(name_len), sizeof(len));
+    len = be64toh(len);
+    if (len > LONG_MAX) {
+        parse_error(p, ev, "File length in response too large");
+        return;
+    }
+    memcpy(p->name, p->line + PROTO_BIN_FILE_HEADER, name_len);
+    p->name[name_len] = '\0';
+    p->files_left--;
+    p->state = SMC_PARSE_BODY;
+    p->body_left = len;
+    ev->type = SMC_EVENT_FILE_BEGIN;
+    ev->name = p->name;
+    ev->len = len;
+}
+
+/**
+ *
+ * \brief converts the number of a "key=<n>" line
+ *
+ * \param line the line
+ * \param key the key including the '='
+ * \param value receives the number
+ *
+ * \return 0 on success, -1 if the key is missing or the number invalid
+ *
+ */
+
+static int parse_value(const char *line, const char *key, long *value){
+    size_t key_len = strlen(key);
+    char *end;
+
+    if (strncmp(line, key, key_len) != 0) {
+        return -1;
+    }
+    errno = 0;
+    *value = strtol(line + key_len, &end, 10);
+    if (end == line + key_len || errno == ERANGE) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief puts the parser into the error state
+ *
+ * \param p the parser
+ * \param ev receives the error event
+ * \param error description of the error
+ *
+ */
+
+static void parse_error(struct smc_parser *p, struct smc_event *ev, const char *error){
+    p->state = SMC_PARSE_ERROR;
+    p->error = error;
+    ev->type = SMC_EVENT_ERROR;
+    ev->error = error;
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,778 @@
+/**
+ * @file smc_response.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * libsmc - receiving responses
+ *
+ * Reads responses from a descriptor, feeds them to the parser in smc_parser.c
+ * and stores the files they announce. smc_receive() returns whenever the
+ * descriptor has nothing more to read, so a non-blocking socket is served
+ * from a poll loop (libsmc.c) and a blocking one in a single call
+ * (bench/smc_bench.c). Keep-alive frames may arrive back to back, whatever is
+ * read past the end of one response stays in the buffer for the next.
+ *
+ * With a cache directory files are content addressed: a file of at most
+ * SMC_CACHE_FILE_MAX bytes is collected in memory, hashed and stored in the
+ * cache under its hash and length unless an entry with the same bytes is
+ * there already. The file itself becomes a hard link to the entry, so a
+ * response repeating what an earlier one sent costs a link and a rename
+ * instead of writing the content again, and nothing at all if the file
+ * already is that entry. Larger files are written to a temporary file and
+ * renamed, so a file is always either the old or the complete new content.
+ *
+ * From protocol version 3 on the CRC-32C of every file is computed while its
+ * content passes through file_data() and compared with the checksum behind
+ * it. A file that does not match is dropped, the response still completes
+ * and reports the mismatch in corrupt.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "libsmc.h"
+#include "crc32c.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+//pipe size requested for splice(), the default of 64 KB needs many round trips
+#define SPLICE_PIPE_SIZE (1 << 20)
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+static int fill(struct smc_receiver *r, int fd);
+static int splice_body(struct smc_receiver *r, int fd);
+static int file_begin(struct smc_receiver *r, const struct smc_event *ev);
+static int file_data(struct smc_receiver *r, const char *data, size_t len);
+static int file_end(struct smc_receiver *r, const struct smc_event *ev);
+static void file_abort(struct smc_receiver *r);
+static int cache_file(struct smc_receiver *r, const char *name);
+static int write_atomic(struct smc_receiver *r, int dir_fd, const char *name);
+static int same_content(int dir_fd, const char *name, const char *data, long len);
+static const char *temp_name(struct smc_receiver *r);
+static uint64_t content_hash(const char *data, size_t len);
+static int fail(struct smc_receiver *r, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ *
+ * \brief prepares a receiver for the responses of one connection
+ *
+ * \param r the receiver
+ * \param version keep-alive protocol version: every response is a frame, binary
+ *        from version 2 on. 0 for a plain response ending with end of file
+ * \param files where the files of the responses go
+ * \param dir_fd directory for SMC_FILES_DISK, AT_FDCWD for the working directory
+ * \param cache_fd cache directory for SMC_FILES_DISK, -1 for none
+ * \param writer writes SMC_FILES_DISK in the background, NULL to write right away,
+ *        not used with a cache
+ *
+ */
+
+void smc_receiver_init(struct smc_receiver *r, int version, enum smc_files files, int dir_fd, int cache_fd, struct smc_writer *writer){
+    r->version = version;
+    r->files = files;
+    r->dir_fd = dir_fd;
+    r->cache_fd = cache_fd;
+    r->writer = cache_fd == -1 ? writer : NULL;
+    r->tmp_name[0] = '\0';
+    r->tmp_seq = 0;
+    r->file_fd = -1;
+    r->mem = NULL;
+    r->pipe_fd[0] = r->pipe_fd[1] = -1;
+    r->no_splice = 0;
+    r->off = r->len = 0;
+    r->error = NULL;
+    smc_receiver_start(r, NULL, NULL);
+}
+
+/**
+ *
+ * \brief prepares the receiver for the next response
+ *
+ * Bytes already read past the previous response are kept.
+ *
+ * \param r the receiver
+ * \param cb callbacks for the response, may be NULL
+ * \param arg passed to the callbacks
+ *
+ */
+
+void smc_receiver_start(struct smc_receiver *r, const struct smc_callbacks *cb, void *arg){
+    smc_parser_init(&r->parser, r->version);
+    r->cb = cb;
+    r->arg = arg;
+    r->trace = NULL;
+    r->hdr_len = 0;
+    r->frame_left = 0;
+    r->ending = 0;
+    r->eof = 0;
+    r->corrupt = 0;
+}
+
+/**
+ *
+ * \brief reads and processes a response
+ *
+ * reads the descriptor into a large buffer and feeds it to the response
+ * parser, which reports the status and every file to the callbacks. With
+ * SMC_FILES_DISK file content is written to a file of the announced name,
+ * preallocated to the announced length. Once the buffer is used up, the rest
+ * of a large file is moved from the descriptor to the file with splice()
+ * without passing through user space, or read into the buffer where splice()
+ * is not supported. With a writer the content is copied to its buffers
+ * instead and the response is complete once the writer caught up with it.
+ *
+ * \param r the receiver, see smc_receiver_start()
+ * \param fd descriptor the response is read from
+ *
+ * \return 1 if the response is complete, 0 if fd has nothing more to read
+ *         for now, -1 on error, see r->error
+ *
+ */
+
+int smc_receive(struct smc_receiver *r, int fd){
+    int framed = r->version > 0;
+    struct smc_event ev;
+    int rc;
+
+    for(;;){
+        if(r->trace != NULL && r->trace->first_byte == 0 && r->off < r->len){
+            r->trace->first_byte = smc_now_us();
+        }
+        if(r->ending){
+            smc_parser_finish(&r->parser, &ev);
+        }else if(framed && r->hdr_len < PROTO_FRAME_HEADER){
+            size_t take;
+            uint32_t frame_len;
+
+            if(r->off == r->len){
+                if(r->eof){
+                    return fail(r, "Connection closed before the response");
+                }
+                if((rc = fill(r, fd)) <= 0){
+                    return rc;
+                }
+                continue;
+            }
+            take = PROTO_FRAME_HEADER - r->hdr_len < r->len - r->off ? PROTO_FRAME_HEADER - r->hdr_len : r->len - r->off;
+            memcpy(r->hdr + r->hdr_len, r->buf + r->off, take);
+            r->hdr_len += take;
+            r->off += take;
+            if(r->hdr_len == PROTO_FRAME_HEADER){
+                memcpy(&frame_len, r->hdr, sizeof(frame_len));
+                r->frame_left = ntohl(frame_len);
+            }
+            continue;
+        }else if(framed && r->frame_left == 0){
+            r->ending = 1;
+            continue;
+        }else if(r->off == r->len){
+            if(r->eof){
+                if(framed){
+                    return fail(r, "Connection closed within a response");
+                }
+                r->ending = 1;
+                continue;
+            }
+            //the buffer is used up, move the rest of the file directly
+            if(r->file_fd != -1 && r->writer == NULL && !r->no_splice && !r->parser.checksum && smc_parser_body_left(&r->parser) > 0 &&
+               (!framed || smc_parser_body_left(&r->parser) <= r->frame_left)){
+                rc = splice_body(r, fd);
+            }else{
+                rc = fill(r, fd);
+            }
+            if(rc <= 0){
+                return rc;
+            }
+            continue;
+        }else{
+            size_t avail = r->len - r->off;
+            size_t used;
+
+            //never parse past the frame, the next one belongs to the next response
+            if(framed && (long)avail > r->frame_left){
+                avail = r->frame_left;
+            }
+            used = smc_parse(&r->parser, r->buf + r->off, avail, &ev);
+            r->off += used;
+            if(framed){
+                r->frame_left -= used;
+            }
+        }
+
+        switch(ev.type){
+        case SMC_EVENT_NEED_MORE:
+            break;
+        case SMC_EVENT_STATUS:
+            if(r->cb != NULL && r->cb->status != NULL){
+                r->cb->status(r->arg, ev.status);
+            }
+            break;
+        case SMC_EVENT_FILE_BEGIN:
+            if(file_begin(r, &ev) == -1){
+                return -1;
+            }
+            break;
+        case SMC_EVENT_FILE_DATA:
+            if(file_data(r, ev.data, ev.data_len) == -1){
+                return -1;
+            }
+            break;
+        case SMC_EVENT_FILE_END:
+            if(file_end(r, &ev) == -1){
+                return -1;
+            }
+            break;
+        case SMC_EVENT_END:
+            //done means on disk, as without the writer
+            if(r->writer != NULL && r->files == SMC_FILES_DISK && smc_writer_drain(r->writer) == -1){
+                return fail(r, "Writing files failed: %s", smc_writer_error(r->writer));
+            }
+            return 1;
+        case SMC_EVENT_ERROR:
+            return fail(r, "%s", ev.error);
+        }
+    }
+}
+
+/**
+ *
+ * \brief releases the resources of a receiver
+ *
+ * \param r the receiver
+ *
+ */
+
+void smc_receiver_destroy(struct smc_receiver *r){
+    file_abort(r);
+    if(r->pipe_fd[0] != -1){
+        close(r->pipe_fd[0]);
+        close(r->pipe_fd[1]);
+        r->pipe_fd[0] = r->pipe_fd[1] = -1;
+    }
+}
+
+/**
+ *
+ * \brief reads the next part of the input into the empty buffer
+ *
+ * \param r the receiver
+ * \param fd descriptor to read from
+ *
+ * \return 1 if data or end of file was read, 0 if fd would block, -1 on error
+ *
+ */
+
+static int fill(struct smc_receiver *r, int fd){
+    ssize_t n;
+
+    while((n = read(fd, r->buf, sizeof(r->buf))) == -1 && errno == EINTR){
+    }
+    if(n == -1){
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            return 0;
+        }
+        return fail(r, "Cannot read from socket: %s", strerror(errno));
+    }
+    r->off = 0;
+    r->len = n;
+    r->eof = n == 0;
+    return 1;
+}
+
+/**
+ *
+ * \brief moves file content from the descriptor to the file through a pipe with splice()
+ *
+ * moves at most one pipe full, which is drained to the file right away.
+ * Descriptors splice() does not support switch the receiver to fill().
+ *
+ * \param r the receiver, the current file is stored on disk
+ * \param fd descriptor to read from
+ *
+ * \return 1 if data or end of file was read, 0 if fd would block, -1 on error
+ *
+ */
+
+static int splice_body(struct smc_receiver *r, int fd){
+    ssize_t in_pipe;
+
+    if(r->pipe_fd[0] == -1){
+        if(pipe2(r->pipe_fd, O_CLOEXEC) == -1){
+            r->no_splice = 1;
+            return fill(r, fd);
+        }
+        //a bigger pipe means fewer splice() calls, the default size works as well
+        (void)fcntl(r->pipe_fd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    }
+
+    //the pipe is empty, only the descriptor decides whether this blocks
+    while((in_pipe = splice(fd, NULL, r->pipe_fd[1], NULL, smc_parser_body_left(&r->parser), SPLICE_F_MOVE | SPLICE_F_MORE)) == -1 && errno == EINTR){
+    }
+    if(in_pipe == -1){
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            return 0;
+        }
+        if(errno == EINVAL || errno == ENOSYS){
+            r->no_splice = 1;
+            return fill(r, fd);
+        }
+        return fail(r, "Cannot read from socket: %s", strerror(errno));
+    }
+    if(in_pipe == 0){
+        r->eof = 1;
+        return 1;
+    }
+
+    smc_parser_skip(&r->parser, in_pipe);
+    r->frame_left -= r->version > 0 ? in_pipe : 0;
+    r->file_have += in_pipe;
+
+    //drain the pipe completely before filling it again
+    while(in_pipe > 0){
+        ssize_t out = splice(r->pipe_fd[0], NULL, r->file_fd, NULL, in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if(out == -1 && errno == EINTR){
+            continue;
+        }
+        if(out <= 0){
+            return fail(r, "Writing file \"%s\" failed: %s", r->parser.name, out == 0 ? "no progress" : strerror(errno));
+        }
+        in_pipe -= out;
+    }
+    return 1;
+}
+
+/**
+ *
+ * \brief prepares the destination of an announced file
+ *
+ * \param r the receiver
+ * \param ev the SMC_EVENT_FILE_BEGIN event
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int file_begin(struct smc_receiver *r, const struct smc_event *ev){
+    r->file_len = ev->len;
+    r->file_have = 0;
+    r->crc = CRC32C_INIT;
+    if(r->trace != NULL && r->trace->files++ < SMC_TRACE_FILES){
+        struct smc_trace_file *tf = &r->trace->file[r->trace->files - 1];
+
+        snprintf(tf->name, sizeof(tf->name), "%s", ev->name);
+        tf->len = ev->len;
+        tf->begin = smc_now_us();
+    }
+
+    switch(r->files){
+    case SMC_FILES_DISK:
+        if(r->cache_fd != -1 && ev->len <= SMC_CACHE_FILE_MAX){
+            //stored through the cache once complete, see cache_file()
+            if((r->mem = malloc(ev->len > 0 ? (size_t)ev->len : 1)) == NULL){
+                return fail(r, "No memory for file \"%s\" of %ld bytes", ev->name, ev->len);
+            }
+            break;
+        }
+        if(r->cache_fd != -1){
+            r->file_fd = openat(r->dir_fd, temp_name(r), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        }else{
+            r->file_fd = openat(r->dir_fd, ev->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        }
+        if(r->file_fd == -1){
+            r->tmp_name[0] = '\0';
+            return fail(r, "Opening file \"%s\" failed: %s", ev->name, strerror(errno));
+        }
+        //reserve the blocks up front, file systems without fallocate() just allocate while writing
+        if(ev->len > 0 && fallocate(r->file_fd, 0, 0, ev->len) == -1 && errno != EOPNOTSUPP && errno != ENOSYS){
+            return fail(r, "Preallocating file \"%s\" failed: %s", ev->name, strerror(errno));
+        }
+        break;
+    case SMC_FILES_MEMORY:
+        if((r->mem = malloc(ev->len > 0 ? (size_t)ev->len : 1)) == NULL){
+            return fail(r, "No memory for file \"%s\" of %ld bytes", ev->name, ev->len);
+        }
+        break;
+    case SMC_FILES_DISCARD:
+        break;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief stores part of the current file
+ *
+ * \param r the receiver
+ * \param data the content
+ * \param len its length, the parser never exceeds the announced length
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int file_data(struct smc_receiver *r, const char *data, size_t len){
+    //while the content is in the cache anyway
+    if(r->parser.checksum){
+        r->crc = crc32c_update(r->crc, data, len);
+    }
+    if(r->file_fd != -1 && r->writer != NULL){
+        if(smc_writer_write(r->writer, r->file_fd, data, len) == -1){
+            return fail(r, "Writing file \"%s\" failed: %s", r->parser.name, smc_writer_error(r->writer));
+        }
+    }else if(r->file_fd != -1 && smc_write_all(r->file_fd, data, len) == -1){
+        return fail(r, "Writing file \"%s\" failed: %s", r->parser.name, strerror(errno));
+    }
+    if(r->mem != NULL){
+        memcpy(r->mem + r->file_have, data, len);
+    }
+    r->file_have += len;
+    return 0;
+}
+
+/**
+ *
+ * \brief completes the current file and reports it
+ *
+ * a file failing its checksum is removed instead and not reported.
+ *
+ * \param r the receiver
+ * \param ev the SMC_EVENT_FILE_END event
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int file_end(struct smc_receiver *r, const struct smc_event *ev){
+    const char *name = ev->name;
+
+    if(ev->has_crc && crc32c_final(r->crc) != ev->crc){
+        if(r->file_fd != -1){
+            if(r->writer != NULL){
+                (void)smc_writer_close(r->writer, r->file_fd);
+            }else{
+                close(r->file_fd);
+            }
+            r->file_fd = -1;
+            unlinkat(r->dir_fd, r->tmp_name[0] != '\0' ? r->tmp_name : name, 0);
+            r->tmp_name[0] = '\0';
+        }
+        free(r->mem);
+        r->mem = NULL;
+        r->corrupt++;
+        snprintf(r->error_buf, sizeof(r->error_buf), "Checksum mismatch in file \"%s\", the file was dropped", name);
+        r->error = r->error_buf;
+        return 0;
+    }
+    if(r->file_fd != -1 && r->writer != NULL){
+        int err = smc_writer_close(r->writer, r->file_fd);
+
+        r->file_fd = -1;
+        if(err){
+            return fail(r, "Writing file \"%s\" failed: %s", name, smc_writer_error(r->writer));
+        }
+    }else if(r->file_fd != -1){
+        int err = close(r->file_fd);
+
+        r->file_fd = -1;
+        if(err){
+            return fail(r, "Closing file \"%s\" failed: %s", name, strerror(errno));
+        }
+        //the complete file replaces the old one in one step
+        if(r->tmp_name[0] != '\0'){
+            if(renameat(r->dir_fd, r->tmp_name, r->dir_fd, name) == -1){
+                return fail(r, "Renaming file \"%s\" failed: %s", name, strerror(errno));
+            }
+            r->tmp_name[0] = '\0';
+        }
+    }else if(r->files == SMC_FILES_DISK && r->mem != NULL && cache_file(r, name) == -1){
+        return -1;
+    }
+    if(r->trace != NULL && r->trace->files <= SMC_TRACE_FILES){
+        r->trace->file[r->trace->files - 1].end = smc_now_us();
+    }
+    if(r->cb != NULL && r->cb->file != NULL){
+        r->cb->file(r->arg, name, r->files == SMC_FILES_MEMORY ? r->mem : NULL, r->file_len);
+    }
+    free(r->mem);
+    r->mem = NULL;
+    return 0;
+}
+
+/**
+ *
+ * \brief drops the current file
+ *
+ * \param r the receiver
+ *
+ */
+
+static void file_abort(struct smc_receiver *r){
+    if(r->file_fd != -1 && r->writer != NULL){
+        //the writer may still hold content of the file
+        (void)smc_writer_close(r->writer, r->file_fd);
+        r->file_fd = -1;
+    }else if(r->file_fd != -1){
+        close(r->file_fd);
+        r->file_fd = -1;
+    }
+    if(r->tmp_name[0] != '\0'){
+        unlinkat(r->dir_fd, r->tmp_name, 0);
+        r->tmp_name[0] = '\0';
+    }
+    free(r->mem);
+    r->mem = NULL;
+}
+
+/**
+ *
+ * \brief stores the file collected in memory through the cache
+ *
+ * the content is compared byte by byte with an entry of the same hash, so a
+ * collision or an entry changed through one of its links is never used.
+ *
+ * \param r the receiver, the file is in r->mem
+ * \param name name of the file
+ *
+ * \return 0 on success, -1 on error
+ *
+ */
+
+static int cache_file(struct smc_receiver *r, const char *name){
+    char key[40];
+    char tmp[sizeof(r->tmp_name)];
+    struct stat entry, file;
+
+    snprintf(key, sizeof(key), "%016" PRIx64 "-%ld", content_hash(r->mem, r->file_len), r->file_len);
+    if(!same_content(r->cache_fd, key, r->mem, r->file_len) && write_atomic(r, r->cache_fd, key) == -1){
+        return fail(r, "Storing file \"%s\" in the cache failed: %s", name, strerror(errno));
+    }
+    if(fstatat(r->cache_fd, key, &entry, 0) == -1){
+        return fail(r, "Storing file \"%s\" in the cache failed: %s", name, strerror(errno));
+    }
+    //the file already is the entry, nothing to do
+    if(fstatat(r->dir_fd, name, &file, 0) == 0 && file.st_ino == entry.st_ino && file.st_dev == entry.st_dev){
+        return 0;
+    }
+
+    strcpy(tmp, temp_name(r));
+    r->tmp_name[0] = '\0';
+    if(linkat(r->cache_fd, key, r->dir_fd, tmp, 0) == -1){
+        //another file system or no hard links there, a copy does it as well
+        if(errno != EXDEV && errno != EPERM && errno != EMLINK){
+            return fail(r, "Linking file \"%s\" failed: %s", name, strerror(errno));
+        }
+        if(write_atomic(r, r->dir_fd, name) == -1){
+            return fail(r, "Writing file \"%s\" failed: %s", name, strerror(errno));
+        }
+        return 0;
+    }
+    if(renameat(r->dir_fd, tmp, r->dir_fd, name) == -1){
+        int err = errno;
+
+        unlinkat(r->dir_fd, tmp, 0);
+        return fail(r, "Renaming file \"%s\" failed: %s", name, strerror(err));
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief writes the file collected in memory through a temporary file
+ *
+ * \param r the receiver, the file is in r->mem
+ * \param dir_fd directory of the file
+ * \param name name of the file, replaced once the content is complete
+ *
+ * \return 0 on success, -1 with errno set on error
+ *
+ */
+
+static int write_atomic(struct smc_receiver *r, int dir_fd, const char *name){
+    char tmp[sizeof(r->tmp_name)];
+    int fd;
+    int err = 0;
+
+    strcpy(tmp, temp_name(r));
+    r->tmp_name[0] = '\0';
+    if((fd = openat(dir_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666)) == -1){
+        return -1;
+    }
+    if(smc_write_all(fd, r->mem, r->file_len) == -1){
+        err = errno != 0 ? errno : EIO;
+    }
+    if(close(fd) == -1 && err == 0){
+        err = errno;
+    }
+    if(err == 0 && renameat(dir_fd, tmp, dir_fd, name) == -1){
+        err = errno;
+    }
+    if(err != 0){
+        unlinkat(dir_fd, tmp, 0);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief checks whether a file holds exactly the given content
+ *
+ * \param dir_fd directory of the file
+ * \param name name of the file
+ * \param data the content
+ * \param len its length
+ *
+ * \return 1 if the content is the same, 0 if not or the file cannot be read
+ *
+ */
+
+static int same_content(int dir_fd, const char *name, const char *data, long len){
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    void *map;
+    int same = 0;
+
+    if(fd == -1){
+        return 0;
+    }
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == len){
+        if(len == 0){
+            same = 1;
+        }else if((map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED){
+            same = memcmp(map, data, len) == 0;
+            munmap(map, len);
+        }
+    }
+    close(fd);
+    return same;
+}
+
+/**
+ *
+ * \brief makes up a name for a temporary file
+ *
+ * hidden and unique per process and receiver, so concurrent clients on the
+ * same directory do not collide.
+ *
+ * \param r the receiver
+ *
+ * \return the name, stored in r->tmp_name
+ *
+ */
+
+static const char *temp_name(struct smc_receiver *r){
+    snprintf(r->tmp_name, sizeof(r->tmp_name), ".smc-%ld-%" PRIxPTR "-%lu.tmp", (long)getpid(), (uintptr_t)r, r->tmp_seq++);
+    return r->tmp_name;
+}
+
+/**
+ *
+ * \brief fast 64 bit hash of a file content, eight bytes at a time
+ *
+ * not cryptographic, a match is confirmed by same_content().
+ *
+ * \param data the content
+ * \param len its length
+ *
+ * \return the hash
+ *
+ */
+
+static uint64_t content_hash(const char *data, size_t len){
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t w;
+
+    for(; len >= sizeof(w); data += sizeof(w), len -= sizeof(w)){
+        memcpy(&w, data, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, data, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+/**
+ *
+ * \brief records an error and drops the current file
+ *
+ * \param r the receiver
+ * \param format printf() format of the message
+ *
+ * \return always -1
+ *
+ */
+
+static int fail(struct smc_receiver *r, const char *format, ...){
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(r->error_buf, sizeof(r->error_buf), format, args);
+    va_end(args);
+    r->error = r->error_buf;
+    file_abort(r);
+    return -1;
+}
+
+/**
+ *
+ * \brief writes a whole buffer to a file descriptor
+ *
+ * \param fd file descriptor to write to
+ * \param buf data to write
+ * \param len number of bytes to write
+ *
+ * \return returns success or error
+ * \retval -1 returned on error
+ * \retval 0 returned on success
+ *
+ */
+
+int smc_write_all(int fd, const char *buf, size_t len){
+    while(len > 0){
+        ssize_t n = write(fd, buf, len);
+
+        if(n == -1 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * =================================================================== eof ==
+ */
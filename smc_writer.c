@@ -0,0 +1,435 @@
+/**
+ * @file smc_writer.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * libsmc - background file writer
+ *
+ * Writing a received file on the thread that reads the socket lets a slow
+ * disk stall the connection: the receive window fills and the server keeps
+ * its business logic around until the client caught up. With a writer the
+ * receiver copies file content into one of a fixed number of buffers and
+ * hands it to a thread that writes it, so reading goes on while the disk
+ * catches up. The buffers cap the memory; once all of them are queued the
+ * receiver waits for the next one, which is the backpressure the socket
+ * would have seen anyway.
+ *
+ * Small pieces of content are collected in the current buffer and written
+ * once it is full. Files handed back with smc_writer_close() are closed by
+ * the thread. With sync they are fdatasync()ed first, all files closed since
+ * the queue last ran empty together rather than each on its own.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libsmc.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//files closed with sync whose fdatasync() is batched, more are synced right away
+#define SMC_WRITER_SYNC_BATCH 64
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+enum job_type
+{
+    JOB_WRITE,
+    JOB_CLOSE
+};
+
+//a buffer, queued for the thread or free
+struct job
+{
+    struct job *next;
+    enum job_type type;
+    int fd;
+    size_t len;
+    char data[MAX_CHUNK_SIZE];
+};
+
+struct smc_writer
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;          //signalled when a job is queued or on stop
+    pthread_cond_t done;          //signalled when a buffer is free again or the queue ran empty
+    struct job *free_list;
+    struct job *head;             //queued jobs, oldest first
+    struct job *tail;
+    struct job *current;          //being filled by the receiver, not queued yet
+    int busy;                     //the thread works on a job or syncs
+    int stop;
+    int sync;
+    int unsynced[SMC_WRITER_SYNC_BATCH];  //closed with sync, only touched by the thread
+    size_t unsynced_count;
+    int err;                      //first error of the thread, 0 = none
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void *writer_main(void *arg);
+static void queue(struct smc_writer *w, struct job *job);
+static struct job *get_buffer(struct smc_writer *w);
+static int sync_files(struct smc_writer *w);
+
+/**
+ *
+ * \brief starts a writer thread
+ *
+ * \param buffers number of MAX_CHUNK_SIZE buffers, at least 2
+ * \param sync fdatasync() files before they are closed
+ *
+ * \return the writer or NULL with errno set on error
+ *
+ */
+
+struct smc_writer *smc_writer_create(long buffers, int sync){
+    struct smc_writer *w = calloc(1, sizeof(*w));
+    int err;
+
+    if(w == NULL){
+        return NULL;
+    }
+    w->sync = sync;
+    //one buffer is filled while the other is written
+    for(long i = 0; i < (buffers < 2 ? 2 : buffers); i++){
+        struct job *job = malloc(sizeof(*job));
+
+        if(job == NULL){
+            w->stop = -1;
+            smc_writer_destroy(w);
+            errno = ENOMEM;
+            return NULL;
+        }
+        job->next = w->free_list;
+        w->free_list = job;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->done, NULL);
+    if((err = pthread_create(&w->thread, NULL, writer_main, w)) != 0){
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->work);
+        pthread_cond_destroy(&w->done);
+        w->stop = -1;
+        smc_writer_destroy(w);
+        errno = err;
+        return NULL;
+    }
+    return w;
+}
+
+/**
+ *
+ * \brief queues content of a file
+ *
+ * copies the content, waits for a free buffer if all are queued.
+ *
+ * \param w the writer
+ * \param fd the file, owned by the writer from now on until smc_writer_close()
+ * \param data the content
+ * \param len its length
+ *
+ * \return 0 on success, -1 if a write of the thread failed, see smc_writer_error()
+ *
+ */
+
+int smc_writer_write(struct smc_writer *w, int fd, const char *data, size_t len){
+    while(len > 0){
+        size_t take;
+
+        if(w->current != NULL && (w->current->fd != fd || w->current->len == sizeof(w->current->data))){
+            queue(w, w->current);
+            w->current = NULL;
+        }
+        if(w->current == NULL){
+            if((w->current = get_buffer(w)) == NULL){
+                return -1;
+            }
+            w->current->type = JOB_WRITE;
+            w->current->fd = fd;
+            w->current->len = 0;
+        }
+        take = sizeof(w->current->data) - w->current->len < len ? sizeof(w->current->data) - w->current->len : len;
+        memcpy(w->current->data + w->current->len, data, take);
+        w->current->len += take;
+        data += take;
+        len -= take;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief queues the close of a file after its content
+ *
+ * \param w the writer
+ * \param fd the file, closed by the writer even on error
+ *
+ * \return 0 on success, -1 if a write of the thread failed, see smc_writer_error()
+ *
+ */
+
+int smc_writer_close(struct smc_writer *w, int fd){
+    struct job *job;
+
+    if(w->current != NULL){
+        queue(w, w->current);
+        w->current = NULL;
+    }
+    if((job = get_buffer(w)) == NULL){
+        //nothing is written after an error, but the file still has to go
+        close(fd);
+        return -1;
+    }
+    job->type = JOB_CLOSE;
+    job->fd = fd;
+    queue(w, job);
+    return 0;
+}
+
+/**
+ *
+ * \brief waits until everything queued is written and the files are closed
+ *
+ * \param w the writer
+ *
+ * \return 0 on success, -1 if a write of the thread failed, see smc_writer_error()
+ *
+ */
+
+int smc_writer_drain(struct smc_writer *w){
+    int err;
+
+    if(w->current != NULL){
+        queue(w, w->current);
+        w->current = NULL;
+    }
+    pthread_mutex_lock(&w->lock);
+    while(w->head != NULL || w->busy){
+        pthread_cond_wait(&w->done, &w->lock);
+    }
+    err = w->err;
+    pthread_mutex_unlock(&w->lock);
+    return err != 0 ? -1 : 0;
+}
+
+/**
+ *
+ * \brief first error of the writer
+ *
+ * \param w the writer
+ *
+ * \return message of the error, which stays in effect until smc_writer_destroy()
+ *
+ */
+
+const char *smc_writer_error(struct smc_writer *w){
+    int err;
+
+    pthread_mutex_lock(&w->lock);
+    err = w->err;
+    pthread_mutex_unlock(&w->lock);
+    return strerror(err);
+}
+
+/**
+ *
+ * \brief writes what is queued, stops the thread and releases the writer
+ *
+ * \param w the writer, may be NULL
+ *
+ */
+
+void smc_writer_destroy(struct smc_writer *w){
+    if(w == NULL){
+        return;
+    }
+    //stop is -1 if the thread was never started
+    if(w->stop == 0){
+        smc_writer_drain(w);
+        pthread_mutex_lock(&w->lock);
+        w->stop = 1;
+        pthread_cond_signal(&w->work);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->work);
+        pthread_cond_destroy(&w->done);
+    }
+    while(w->free_list != NULL){
+        struct job *job = w->free_list;
+
+        w->free_list = job->next;
+        free(job);
+    }
+    free(w);
+}
+
+/**
+ *
+ * \brief the writer thread, carries out the queued jobs in order
+ *
+ * after an error content is dropped, files are still closed.
+ *
+ * \param arg the writer
+ *
+ * \return NULL
+ *
+ */
+
+static void *writer_main(void *arg){
+    struct smc_writer *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for(;;){
+        struct job *job;
+        int err = 0;
+
+        while(w->head == NULL && !w->stop){
+            pthread_cond_wait(&w->work, &w->lock);
+        }
+        if(w->head == NULL){
+            break;
+        }
+        job = w->head;
+        if((w->head = job->next) == NULL){
+            w->tail = NULL;
+        }
+        w->busy = 1;
+        pthread_mutex_unlock(&w->lock);
+
+        if(job->type == JOB_WRITE){
+            if(w->err == 0 && smc_write_all(job->fd, job->data, job->len) == -1){
+                err = errno != 0 ? errno : EIO;
+            }
+        }else if(w->sync && w->err == 0){
+            w->unsynced[w->unsynced_count++] = job->fd;
+            if(w->unsynced_count == SMC_WRITER_SYNC_BATCH){
+                err = sync_files(w);
+            }
+        }else if(close(job->fd) == -1){
+            err = errno;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        //whatever was closed since the queue last ran empty is synced at once
+        if(w->head == NULL && w->unsynced_count > 0){
+            int sync_err;
+
+            pthread_mutex_unlock(&w->lock);
+            sync_err = sync_files(w);
+            err = err != 0 ? err : sync_err;
+            pthread_mutex_lock(&w->lock);
+        }
+        if(err != 0 && w->err == 0){
+            w->err = err;
+        }
+        job->next = w->free_list;
+        w->free_list = job;
+        w->busy = 0;
+        pthread_cond_broadcast(&w->done);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/**
+ *
+ * \brief appends a job to the queue
+ *
+ * \param w the writer
+ * \param job the job
+ *
+ */
+
+static void queue(struct smc_writer *w, struct job *job){
+    job->next = NULL;
+    pthread_mutex_lock(&w->lock);
+    if(w->tail != NULL){
+        w->tail->next = job;
+    }else{
+        w->head = job;
+    }
+    w->tail = job;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ *
+ * \brief takes a free buffer, waits for one if all are queued
+ *
+ * \param w the writer
+ *
+ * \return the buffer, NULL if the thread ran into an error
+ *
+ */
+
+static struct job *get_buffer(struct smc_writer *w){
+    struct job *job = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    while(w->free_list == NULL && w->err == 0){
+        pthread_cond_wait(&w->done, &w->lock);
+    }
+    if(w->err == 0){
+        job = w->free_list;
+        w->free_list = job->next;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return job;
+}
+
+/**
+ *
+ * \brief fdatasync()s and closes the files closed with sync, runs on the thread
+ *
+ * \param w the writer
+ *
+ * \return 0 on success, the first errno on error
+ *
+ */
+
+static int sync_files(struct smc_writer *w){
+    int err = 0;
+
+    for(size_t i = 0; i < w->unsynced_count; i++){
+        if(fdatasync(w->unsynced[i]) == -1 && err == 0){
+            err = errno;
+        }
+        if(close(w->unsynced[i]) == -1 && err == 0){
+            err = errno;
+        }
+    }
+    w->unsynced_count = 0;
+    return err;
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,447 @@
+/**
+ * @file sms_admission.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - admission control of business logic children
+ *
+ * Every accepting process runs at most max_children business logic processes
+ * at a time. A connection accepted beyond that waits in a bounded FIFO queue
+ * and is launched by the server core as soon as a child has been reaped. Once
+ * the queue is full a connection is shed: it is answered with
+ * PROTO_STATUS_BUSY and closed, without any process started for it. A burst
+ * therefore costs a few bytes per excess connection instead of a process, and
+ * the clients that are admitted are served at full speed.
+ *
+ * The answer depends on the first bytes of the connection. A plain request gets
+ * the plain "status=503" response. A keep-alive client sent a hello and reads
+ * the acknowledgement first; an unframed status would look like a failed hello
+ * to it and make it retry in plain mode. So its hello is acknowledged like the
+ * keep-alive path does and a framed busy status follows (keepalive_status()),
+ * which the client reports as the status of its first request.
+ *
+ * A shed connection is only shut down for writing after the answer. Closing it
+ * while the request is still on its way would reset it and could destroy the
+ * busy status before the client read it, so up to ADMISSION_LINGER of them stay
+ * open until the client closed, ADMISSION_LINGER_MS passed or they are pushed
+ * out by newer ones. The server core polls them together with the listening
+ * socket (admission_pollfds(), admission_timeout()) and lets admission_linger()
+ * answer, drain and close them, nothing here blocks.
+ *
+ * The children are counted by the metrics (metrics_children()), which reap
+ * synchronously from the signalfd, so -C implies -R signalfd: the server core
+ * wakes up for every exit and launches the next queued connection. With the
+ * event loops all of this happens in the launcher process (sms_launcher.c),
+ * the connection is the business logic end of the relay there.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "simple_message_server.h"
+#include "simple_message_protocol.h"
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//a connection waiting for admission
+struct queued_conn
+{
+    int fd;
+    uint64_t accepted_ns;
+};
+
+//a shed connection, answered as soon as its first bytes arrived
+struct lingering_conn
+{
+    int fd;
+    uint64_t deadline_ns;
+    int answered;
+    size_t hello_len;
+    char hello[PROTO_HELLO_LEN];
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+//0 while admission control is off
+static long smax_children;
+
+//ring buffer of waiting connections
+static struct queued_conn *squeue;
+static size_t scapacity;
+static size_t shead;
+static size_t scount;
+
+//shed connections, oldest (earliest deadline) first
+static struct lingering_conn slinger[ADMISSION_LINGER];
+static size_t slinger_count;
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void shed(int confd);
+static int linger_done(struct lingering_conn *conn);
+static void answer(struct lingering_conn *conn);
+static int drained(int fd);
+
+/**
+ *
+ * \brief Turns admission control on for this process
+ *
+ * \param max_children business logic processes running at most
+ * \param queue_len connections waiting at most, 0 = shed as soon as all children run
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+int admission_init(long max_children, long queue_len)
+{
+    if (queue_len > 0 && (squeue = calloc(queue_len, sizeof(*squeue))) == NULL)
+    {
+        print_err("calloc() for admission queue failed\n");
+        return -1;
+    }
+    scapacity = queue_len;
+    smax_children = max_children;
+    return 0;
+}
+
+/**
+ *
+ * \brief Decides about a newly accepted connection
+ *
+ * Queued connections go first, a new one never overtakes them.
+ *
+ * \param confd the accepted connection, owned by admission control unless ADMIT_NOW
+ *
+ * \return ADMIT_NOW, ADMIT_QUEUED or ADMIT_SHED
+ *
+ */
+
+enum admission admission_admit(int confd)
+{
+    if (smax_children == 0 || (scount == 0 && metrics_children() < smax_children))
+        return ADMIT_NOW;
+
+    if (scount == scapacity)
+    {
+        shed(confd);
+        return ADMIT_SHED;
+    }
+
+    //children started meanwhile must not hold it open
+    fcntl(confd, F_SETFD, FD_CLOEXEC);
+    squeue[(shead + scount) % scapacity].fd = confd;
+    squeue[(shead + scount) % scapacity].accepted_ns = metrics_accept_time();
+    scount++;
+    metrics_queued(1);
+    return ADMIT_QUEUED;
+}
+
+/**
+ *
+ * \brief Takes the next queued connection if a child slot is free
+ *
+ * Called by the server core after reaping, until it returns -1.
+ *
+ * \return the connection to launch the business logic for, now owned by the caller
+ * \retval -1 queue empty or all children running
+ *
+ */
+
+int admission_next(void)
+{
+    struct queued_conn *next;
+
+    if (scount == 0 || metrics_children() >= smax_children)
+        return -1;
+
+    next = &squeue[shead];
+    shead = (shead + 1) % scapacity;
+    scount--;
+    metrics_queued(-1);
+    metrics_dequeued(next->fd, next->accepted_ns);
+    return next->fd;
+}
+
+/**
+ *
+ * \brief Closes the connections still waiting and turns admission control off
+ *
+ */
+
+void admission_destroy(void)
+{
+    while (scount > 0)
+    {
+        close(squeue[shead].fd);
+        shead = (shead + 1) % scapacity;
+        scount--;
+        metrics_queued(-1);
+    }
+    while (slinger_count > 0)
+        close(slinger[--slinger_count].fd);
+    free(squeue);
+    squeue = NULL;
+    scapacity = 0;
+    shead = 0;
+    smax_children = 0;
+}
+
+/**
+ *
+ * \brief Closes the queued connections in a child forked by the server
+ *
+ * They belong to the server, a child that does not exec (keep-alive) would
+ * otherwise keep them open after the server served and closed them.
+ *
+ */
+
+void admission_forked(void)
+{
+    for (size_t i = 0; i < scount; i++)
+        close(squeue[(shead + i) % scapacity].fd);
+    scount = 0;
+    while (slinger_count > 0)
+        close(slinger[--slinger_count].fd);
+}
+
+/**
+ *
+ * \brief Sheds a connection the server has no room for elsewhere
+ *
+ * Used by plugin mode when all worker threads are busy and their queue is
+ * full, the connection is answered busy and lingers like any other.
+ *
+ * \param confd the connection, owned by admission control afterwards
+ *
+ */
+
+void admission_shed(int confd)
+{
+    shed(confd);
+}
+
+/**
+ *
+ * \brief Fills in the shed connections the server core has to poll
+ *
+ * \param fds room for ADMISSION_LINGER entries
+ *
+ * \return the number of entries filled in
+ *
+ */
+
+int admission_pollfds(struct pollfd *fds)
+{
+    for (size_t i = 0; i < slinger_count; i++)
+    {
+        fds[i].fd = slinger[i].fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    return slinger_count;
+}
+
+/**
+ *
+ * \brief Tells how long the server core may wait for admission_linger()
+ *
+ * \return milliseconds until the next shed connection expires
+ * \retval -1 no shed connection lingers, wait as long as needed
+ *
+ */
+
+int admission_timeout(void)
+{
+    uint64_t now;
+
+    if (slinger_count == 0)
+        return -1;
+    now = metrics_now();
+    if (slinger[0].deadline_ns <= now)
+        return 0;
+    //rounded up, a timeout just short of the deadline would spin
+    return (slinger[0].deadline_ns - now + 999999) / 1000000;
+}
+
+/**
+ *
+ * \brief Answers and drains the shed connections, closes the finished ones
+ *
+ * Called by the server core whenever its poll returned.
+ *
+ */
+
+void admission_linger(void)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < slinger_count; i++)
+    {
+        if (linger_done(&slinger[i]))
+            close(slinger[i].fd);
+        else
+            slinger[kept++] = slinger[i];
+    }
+    slinger_count = kept;
+}
+
+/**
+ *
+ * \brief Sheds a connection and lets it linger until it is answered
+ *
+ * The oldest lingering connection is closed if there is no room. Nothing here
+ * blocks.
+ *
+ * \param confd the connection
+ *
+ */
+
+static void shed(int confd)
+{
+    struct lingering_conn *conn;
+
+    metrics_shed();
+    if (slinger_count == ADMISSION_LINGER)
+    {
+        close(slinger[0].fd);
+        memmove(slinger, slinger + 1, (ADMISSION_LINGER - 1) * sizeof(*slinger));
+        slinger_count--;
+    }
+
+    fcntl(confd, F_SETFD, FD_CLOEXEC);
+    fcntl(confd, F_SETFL, fcntl(confd, F_GETFL) | O_NONBLOCK);
+    conn = &slinger[slinger_count++];
+    conn->fd = confd;
+    conn->deadline_ns = metrics_now() + (uint64_t)ADMISSION_LINGER_MS * 1000000;
+    conn->answered = 0;
+    conn->hello_len = 0;
+    //the first bytes are mostly there already
+    if (linger_done(conn))
+    {
+        close(confd);
+        slinger_count--;
+    }
+}
+
+/**
+ *
+ * \brief Makes progress on a lingering connection
+ *
+ * \param conn the connection
+ *
+ * \return non zero once the connection may be closed
+ *
+ */
+
+static int linger_done(struct lingering_conn *conn)
+{
+    if (!conn->answered)
+        answer(conn);
+    if (conn->answered && drained(conn->fd))
+        return 1;
+    return metrics_now() >= conn->deadline_ns;
+}
+
+/**
+ *
+ * \brief Sends the busy status once it is known what kind of client waits
+ *
+ * Sets answered once the status was sent or can not be sent any more.
+ *
+ * \param conn the connection, its hello is collected in conn->hello
+ *
+ */
+
+static void answer(struct lingering_conn *conn)
+{
+    char status[32];
+    int version, len;
+    ssize_t n;
+
+    do
+    {
+        //one byte decides, the rest of a plain request is drained later
+        size_t want = conn->hello_len == 0 ? 1 : PROTO_HELLO_LEN - conn->hello_len;
+
+        while ((n = recv(conn->fd, conn->hello + conn->hello_len, want, 0)) < 0 && errno == EINTR)
+            ;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            //nobody left to answer, drained() sees the close
+            conn->answered = 1;
+            return;
+        }
+        conn->hello_len += n;
+    } while (conn->hello[0] == PROTO_HELLO_PREFIX[0] && conn->hello_len < PROTO_HELLO_LEN);
+    conn->answered = 1;
+
+    if (conn->hello[0] != PROTO_HELLO_PREFIX[0])
+    {
+        len = snprintf(status, sizeof(status), "status=%d\n", PROTO_STATUS_BUSY);
+        if (send(conn->fd, status, len, MSG_NOSIGNAL) != len)
+            return;
+    }
+    else
+    {
+        if ((version = PROTO_HELLO_VERSION(conn->hello)) == 0)
+            return;
+        if (version > PROTO_VERSION_MAX)
+            version = PROTO_VERSION_MAX;
+        if (send(conn->fd, PROTO_HELLO(version), PROTO_HELLO_LEN, MSG_NOSIGNAL) != (ssize_t)PROTO_HELLO_LEN ||
+            keepalive_status(conn->fd, version, PROTO_STATUS_BUSY) < 0)
+            return;
+    }
+    shutdown(conn->fd, SHUT_WR);
+}
+
+/**
+ *
+ * \brief Reads away what a lingering connection received
+ *
+ * \param fd the connection
+ *
+ * \return non zero once the client closed, the connection may be closed then
+ *
+ */
+
+static int drained(int fd)
+{
+    char discard[4096];
+    ssize_t n;
+
+    while ((n = recv(fd, discard, sizeof(discard), MSG_DONTWAIT)) > 0)
+        ;
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/*
+ * =================================================================== eof ==
+ */
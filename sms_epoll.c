@@ -0,0 +1,509 @@
+/**
+ * @file sms_epoll.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - epoll event loop backend
+ *
+ * The listening socket and all connections are non-blocking and driven by one
+ * epoll loop. Pending connections are accepted in batches. The business logic
+ * no longer gets the client socket itself but one end of a unix socketpair;
+ * the loop relays request and response between the client and the other end.
+ * The loop itself never forks: the other end goes to the launcher process
+ * (see sms_launcher.c), which starts the business logic in whatever launch
+ * mode (-m exec, spawn or pool) while the loop keeps accepting and relaying.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "simple_message_server.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//bytes buffered per direction and connection
+#define RELAY_BUF_SIZE 16384
+//connections accepted per readiness notification of the listening socket
+#define ACCEPT_BATCH 64
+//events fetched per epoll_wait()
+#define MAX_EVENTS 256
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+struct relay_conn;
+
+//one direction of a relayed connection
+struct relay_dir
+{
+    char buf[RELAY_BUF_SIZE];
+    size_t off; //first byte not yet written
+    size_t len; //bytes in buf
+    int eof;    //source reached end of file
+    int shut;   //destination shut down for writing
+};
+
+//one of the two descriptors of a relayed connection, registered with epoll
+struct relay_end
+{
+    struct relay_conn *conn;
+    int fd;
+    uint32_t events; //currently registered interest
+};
+
+//client connection relayed to the business logic
+struct relay_conn
+{
+    struct relay_end client;
+    struct relay_end logic;
+    struct relay_dir up;   //client -> business logic
+    struct relay_dir down; //business logic -> client
+    int closed;
+    struct relay_conn *next_closed; //freed after the current batch of events
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+//its address marks the signalfd of REAP_SIGNALFD in the epoll set
+static char reap_tag;
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void accept_batch(int epfd, int listen_fd);
+static struct relay_conn *relay_open(int epfd, int client_fd);
+static void relay_close(int epfd, struct relay_conn *conn, struct relay_conn **closed);
+static int relay_event(struct relay_end *end, uint32_t events);
+static int relay_fill(struct relay_dir *dir, int fd);
+static int relay_flush(struct relay_dir *dir, int fd);
+static void relay_update(int epfd, struct relay_end *end, uint32_t events);
+
+/**
+ *
+ * \brief Runs the epoll event loop. Returns only on fatal errors
+ *
+ * \param listen_fd the listening socket
+ * \param opts the parsed command line options
+ *
+ * \return Failure
+ * \retval -1 the event loop could not be set up or failed
+ *
+ */
+
+int epoll_run(int listen_fd, const struct server_options *opts)
+{
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct relay_conn *closed = NULL;
+    int epfd, n;
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        print_err("epoll_create1 failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (set_nonblocking(listen_fd) < 0)
+    {
+        close(epfd);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; //NULL marks the listening socket
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+    {
+        print_err("Registering listening socket failed: %s\n", strerror(errno));
+        close(epfd);
+        return -1;
+    }
+
+    ev.data.ptr = &reap_tag;
+    if (reap_fd() >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, reap_fd(), &ev) < 0)
+    {
+        print_err("Registering signalfd failed: %s\n", strerror(errno));
+        close(epfd);
+        return -1;
+    }
+
+    while (1)
+    {
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS, -1)) < 0)
+        {
+            if (errno == EINTR) //SIGCHLD handler
+                continue;
+            print_err("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct relay_end *end = events[i].data.ptr;
+
+            //only the launcher is a child of the event loop
+            if (events[i].data.ptr == &reap_tag)
+            {
+                reap_children();
+                continue;
+            }
+            if (end == NULL)
+            {
+                accept_batch(epfd, listen_fd);
+                report_accept_rate(opts->report_interval);
+                continue;
+            }
+
+            struct relay_conn *conn = end->conn;
+            if (conn->closed)
+                continue;
+            if (relay_event(end, events[i].events) < 0)
+            {
+                relay_close(epfd, conn, &closed);
+                continue;
+            }
+            relay_update(epfd, &conn->client, (!conn->up.eof && conn->up.len == 0 ? EPOLLIN : 0) | (conn->down.len > 0 ? EPOLLOUT : 0));
+            relay_update(epfd, &conn->logic, (!conn->down.eof && conn->down.len == 0 ? EPOLLIN : 0) | (conn->up.len > 0 ? EPOLLOUT : 0));
+        }
+
+        //later events of the same batch may still have pointed to these
+        while (closed != NULL)
+        {
+            struct relay_conn *next = closed->next_closed;
+            free(closed);
+            closed = next;
+        }
+    }
+
+    close(epfd);
+    return -1;
+}
+
+/**
+ *
+ * \brief Switches a descriptor to non-blocking mode
+ *
+ * \param fd the descriptor
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        print_err("Setting O_NONBLOCK failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Accepts up to ACCEPT_BATCH pending connections
+ *
+ * \param epfd the epoll instance
+ * \param listen_fd the non-blocking listening socket
+ *
+ * Connections the launcher can not take are dropped.
+ *
+ */
+
+static void accept_batch(int epfd, int listen_fd)
+{
+    int confd;
+
+    for (int i = 0; i < ACCEPT_BATCH; i++)
+    {
+        if ((confd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                print_err("Accepting new Client failed\n");
+                metrics_accept_failed();
+            }
+            return;
+        }
+
+        printf("Client accepted\n");
+        metrics_accepted(confd);
+        if (relay_open(epfd, confd) == NULL)
+            close(confd);
+    }
+}
+
+/**
+ *
+ * \brief Hands a connection to the launcher and registers both ends
+ *
+ * \param epfd the epoll instance
+ * \param client_fd the non-blocking client connection
+ *
+ * \return the relayed connection or NULL on failure
+ *
+ */
+
+static struct relay_conn *relay_open(int epfd, int client_fd)
+{
+    struct relay_conn *conn;
+    struct epoll_event ev;
+    int logic_fd;
+
+    if ((conn = calloc(1, sizeof(*conn))) == NULL)
+    {
+        print_err("calloc() for relay failed\n");
+        return NULL;
+    }
+    if ((logic_fd = launcher_submit(client_fd)) < 0)
+    {
+        free(conn);
+        return NULL;
+    }
+
+    conn->client.conn = conn;
+    conn->client.fd = client_fd;
+    conn->client.events = EPOLLIN;
+    conn->logic.conn = conn;
+    conn->logic.fd = logic_fd;
+    conn->logic.events = EPOLLIN;
+
+    //closing logic_fd on failure lets the business logic see end of file
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &conn->client;
+    if (set_nonblocking(logic_fd) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, client_fd, &ev) < 0)
+    {
+        print_err("Registering connection failed: %s\n", strerror(errno));
+        close(logic_fd);
+        free(conn);
+        return NULL;
+    }
+    ev.data.ptr = &conn->logic;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, logic_fd, &ev) < 0)
+    {
+        print_err("Registering connection failed: %s\n", strerror(errno));
+        epoll_ctl(epfd, EPOLL_CTL_DEL, client_fd, NULL);
+        close(logic_fd);
+        free(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+/**
+ *
+ * \brief Closes both ends of a relayed connection
+ *
+ * The connection is only marked closed and queued, it is freed once the current
+ * batch of events has been processed.
+ *
+ * \param epfd the epoll instance
+ * \param conn the connection
+ * \param closed list of connections to free after the batch
+ *
+ */
+
+static void relay_close(int epfd, struct relay_conn *conn, struct relay_conn **closed)
+{
+    if (conn->client.events != 0)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->client.fd, NULL);
+    if (conn->logic.events != 0)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->logic.fd, NULL);
+    //a copy inherited by some child must not keep the client waiting for end of file
+    shutdown(conn->client.fd, SHUT_RDWR);
+    close(conn->client.fd);
+    close(conn->logic.fd);
+    conn->closed = 1;
+    conn->next_closed = *closed;
+    *closed = conn;
+}
+
+/**
+ *
+ * \brief Moves data for a ready descriptor and propagates end of file
+ *
+ * The connection is finished once the complete response has been passed to the client
+ * and the client has sent its whole request. If the business logic stops reading early,
+ * the rest of the request is discarded.
+ *
+ * \param end the ready end
+ * \param events the reported epoll events
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 connection still in progress
+ * \retval -1 connection finished or failed, close it
+ *
+ */
+
+static int relay_event(struct relay_end *end, uint32_t events)
+{
+    struct relay_conn *conn = end->conn;
+    int is_client = end == &conn->client;
+    struct relay_dir *in = is_client ? &conn->up : &conn->down;
+
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !in->eof && in->len == 0)
+    {
+        if (relay_fill(in, end->fd) < 0)
+        {
+            if (is_client)
+                return -1; //client gone, nobody to answer
+            in->eof = 1;   //business logic crashed, pass on what we have
+        }
+    }
+
+    //flush optimistically, a socket is writable far more often than not
+    if (relay_flush(&conn->up, conn->logic.fd) < 0)
+    {
+        conn->up.len = conn->up.off = 0;
+        conn->up.eof = conn->up.shut = 1;
+    }
+    if (relay_flush(&conn->down, conn->client.fd) < 0)
+        return -1;
+
+    if (conn->up.eof && conn->up.len == 0 && !conn->up.shut)
+    {
+        shutdown(conn->logic.fd, SHUT_WR);
+        conn->up.shut = 1;
+    }
+    if (conn->down.eof && conn->down.len == 0)
+    {
+        if (conn->up.eof)
+            return -1; //response complete
+        //answered early (e.g. busy), closing now would reset the client before it read the answer
+        if (!conn->down.shut)
+        {
+            shutdown(conn->client.fd, SHUT_WR);
+            conn->down.shut = 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ *
+ * \brief Reads into an empty direction buffer
+ *
+ * \param dir the direction
+ * \param fd the source descriptor
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 data read, end of file or nothing available yet
+ * \retval -1 read error
+ *
+ */
+
+static int relay_fill(struct relay_dir *dir, int fd)
+{
+    ssize_t n = read(fd, dir->buf, sizeof(dir->buf));
+
+    if (n > 0)
+    {
+        dir->off = 0;
+        dir->len = n;
+    }
+    else if (n == 0)
+        dir->eof = 1;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return -1;
+    return 0;
+}
+
+/**
+ *
+ * \brief Writes buffered data of a direction as far as possible
+ *
+ * \param dir the direction
+ * \param fd the destination descriptor
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 buffer written or destination not ready
+ * \retval -1 write error
+ *
+ */
+
+static int relay_flush(struct relay_dir *dir, int fd)
+{
+    while (dir->off < dir->len)
+    {
+        ssize_t n = send(fd, dir->buf + dir->off, dir->len - dir->off, MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        dir->off += n;
+    }
+    dir->off = dir->len = 0;
+    return 0;
+}
+
+/**
+ *
+ * \brief Changes the registered interest of an end if it differs
+ *
+ * An end without interest is removed from the epoll set, otherwise a hung up peer
+ * would be reported over and over while its data waits in the buffer.
+ *
+ * \param epfd the epoll instance
+ * \param end the end
+ * \param events the new interest
+ *
+ */
+
+static void relay_update(int epfd, struct relay_end *end, uint32_t events)
+{
+    struct epoll_event ev;
+    int op;
+
+    if (end->events == events)
+        return;
+
+    if (events == 0)
+        op = EPOLL_CTL_DEL;
+    else
+        op = end->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = end;
+    if (epoll_ctl(epfd, op, end->fd, &ev) == 0)
+        end->events = events;
+}
+
+/*
+ * =================================================================== eof ==
+ */
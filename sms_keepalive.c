@@ -0,0 +1,701 @@
+/**
+ * @file sms_keepalive.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - keep-alive sessions with framed, pipelined requests
+ *
+ * A client that opens with PROTO_HELLO (see simple_message_protocol.h) keeps
+ * its connection for many requests. Each request frame is stored in a memfd,
+ * the business logic runs with that memfd as stdin and a second one as stdout,
+ * and the output is sent back as a response frame with sendfile(). The
+ * business logic still sees end of file after every request, as in plain mode.
+ * Protocol version 2 clients get the output translated to the binary response
+ * format, sent with writev() straight from the mapped output, version 3
+ * clients with the CRC-32C of every file behind it.
+ * With a plugin the handler is called in-process, so a request costs neither a
+ * TCP handshake nor a process.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <limits.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "simple_message_server.h"
+#include "simple_message_protocol.h"
+#include "crc32c.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define KEEPALIVE_BUF_SIZE 65536
+#define KEEPALIVE_NUMBER_MAX 32
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//a file of a text response, pointing into the mapped output
+struct text_file
+{
+    const char *name;
+    size_t name_len;
+    const char *data;
+    uint64_t len;
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+extern char **environ;
+
+//requests pass through it, small responses are read into it
+static __thread char io_buf[KEEPALIVE_BUF_SIZE];
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static int run_business_logic(int confd, int in_fd, int out_fd);
+static int recv_request(int confd, int in_fd, uint32_t len);
+static int send_response(int confd, int out_fd);
+static int send_response_binary(int confd, int out_fd, int version);
+static int text_line(const char **pos, const char *end, const char *key, const char **value, size_t *value_len);
+static int text_number(const char *value, size_t value_len, long *number);
+static int writev_all(int fd, struct iovec *iov, int iovcnt);
+static ssize_t recv_all(int fd, void *buf, size_t len);
+
+/**
+ *
+ * \brief Checks whether a new connection asks for keep-alive
+ *
+ * Waits for the first byte only, so plain requests are not held up. If it starts
+ * the hello, the hello is consumed and acknowledged with the highest protocol
+ * version both sides speak.
+ *
+ * \param confd the connected socket
+ *
+ * \return the protocol of the connection or failure
+ * \retval >0 keep-alive with this protocol version, continue with keepalive_session()
+ * \retval 0 plain request, nothing consumed
+ * \retval -1 Failure
+ *
+ */
+
+int keepalive_detect(int confd)
+{
+    char hello[PROTO_HELLO_LEN];
+    ssize_t n;
+    int version;
+
+    do
+        n = recv(confd, hello, 1, MSG_PEEK);
+    while (n < 0 && errno == EINTR);
+
+    if (n <= 0 || hello[0] != PROTO_HELLO_PREFIX[0])
+        return n < 0 ? -1 : 0;
+
+    if (recv_all(confd, hello, PROTO_HELLO_LEN) != (ssize_t)PROTO_HELLO_LEN ||
+        (version = PROTO_HELLO_VERSION(hello)) == 0)
+    {
+        print_err("Invalid protocol hello\n");
+        return -1;
+    }
+    if (version > PROTO_VERSION_MAX)
+        version = PROTO_VERSION_MAX;
+    if (send(confd, PROTO_HELLO(version), PROTO_HELLO_LEN, MSG_NOSIGNAL) != (ssize_t)PROTO_HELLO_LEN)
+    {
+        print_err("Acknowledging keep-alive failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return version;
+}
+
+/**
+ *
+ * \brief Sends a response frame carrying only a status, no files
+ *
+ * \param confd the connected socket, after the hello was acknowledged
+ * \param version the protocol version of the connection
+ * \param status the status, e.g. PROTO_STATUS_BUSY
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+int keepalive_status(int confd, int version, int status)
+{
+    char frame[PROTO_FRAME_HEADER + KEEPALIVE_NUMBER_MAX + sizeof("status=\n")];
+    uint32_t u32;
+    int len;
+
+    if (version >= PROTO_VERSION_BINARY)
+    {
+        len = PROTO_BIN_HEADER;
+        u32 = htonl((uint32_t)(int32_t)status);
+        memcpy(frame + PROTO_FRAME_HEADER, &u32, sizeof(u32));
+        u32 = 0;
+        memcpy(frame + PROTO_FRAME_HEADER + sizeof(u32), &u32, sizeof(u32));
+    }
+    else
+        len = snprintf(frame + PROTO_FRAME_HEADER, sizeof(frame) - PROTO_FRAME_HEADER, "status=%d\n", status);
+    u32 = htonl((uint32_t)len);
+    memcpy(frame, &u32, sizeof(u32));
+    len += PROTO_FRAME_HEADER;
+
+    if (send(confd, frame, len, MSG_NOSIGNAL) != len)
+    {
+        print_err("Sending status frame failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Serves framed requests until the client closes the connection
+ *
+ * \param confd the connected socket, after keepalive_detect() returned a version
+ * \param version the protocol version returned by keepalive_detect()
+ * \param handler in-process business logic, NULL to run BL_PATH for every request
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 the client ended the session after a complete frame
+ * \retval -1 Failure
+ *
+ */
+
+int keepalive_session(int confd, int version, plugin_handler_t handler)
+{
+    int in_fd, out_fd;
+    uint32_t len;
+    ssize_t n;
+    int result = -1;
+
+    if ((in_fd = memfd_create("sms_request", MFD_CLOEXEC)) < 0 ||
+        (out_fd = memfd_create("sms_response", MFD_CLOEXEC)) < 0)
+    {
+        print_err("memfd_create failed: %s\n", strerror(errno));
+        if (in_fd >= 0)
+            close(in_fd);
+        return -1;
+    }
+
+    //inherited from the server: its SIGCHLD handler would reap our business logic
+    if (handler == NULL)
+        signal(SIGCHLD, SIG_DFL);
+    //sendfile() to a client that went away must fail, not kill the (plugin) server
+    signal(SIGPIPE, SIG_IGN);
+
+    while (1)
+    {
+        //a plugin worker thread is shared, an idle client gives it back
+        if (handler != NULL)
+        {
+            struct pollfd pfd = {.fd = confd, .events = POLLIN};
+
+            while ((n = poll(&pfd, 1, PLUGIN_KEEPALIVE_IDLE_MS)) < 0 && errno == EINTR)
+                ;
+            if (n == 0)
+            {
+                result = 0;
+                break;
+            }
+        }
+        if ((n = recv_all(confd, &len, sizeof(len))) == 0)
+        {
+            result = 0;
+            break;
+        }
+        if (n != sizeof(len))
+        {
+            print_err("Reading frame header failed\n");
+            break;
+        }
+        //the request is stored in memory, a client must not make it unbounded
+        if (ntohl(len) > PROTO_FRAME_MAX)
+        {
+            print_err("Request frame of %u bytes exceeds %u\n", ntohl(len), PROTO_FRAME_MAX);
+            break;
+        }
+
+        //reuse both files, truncating does not move the file offsets
+        if (ftruncate(in_fd, 0) < 0 || ftruncate(out_fd, 0) < 0 ||
+            lseek(in_fd, 0, SEEK_SET) < 0 || lseek(out_fd, 0, SEEK_SET) < 0 ||
+            recv_request(confd, in_fd, ntohl(len)) < 0 || lseek(in_fd, 0, SEEK_SET) < 0)
+            break;
+
+        if ((handler != NULL ? handler(in_fd, out_fd) : run_business_logic(confd, in_fd, out_fd)) < 0)
+            print_err("Business logic failed\n");
+
+        if ((version >= PROTO_VERSION_BINARY ? send_response_binary(confd, out_fd, version) : send_response(confd, out_fd)) < 0)
+            break;
+    }
+
+    close(in_fd);
+    close(out_fd);
+    return result;
+}
+
+/**
+ *
+ * \brief Runs the business logic for one request and waits for it
+ *
+ * \param confd the connected socket, not passed on to the business logic
+ * \param in_fd the request, becomes stdin
+ * \param out_fd receives the response, becomes stdout
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 the business logic exited successfully
+ * \retval -1 Failure
+ *
+ */
+
+static int run_business_logic(int confd, int in_fd, int out_fd)
+{
+    posix_spawn_file_actions_t actions;
+    char *const argv[] = {BL_NAME, NULL};
+    pid_t pid;
+    int status, err;
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0)
+    {
+        print_err("Could not start server business logic: %s\n", strerror(err));
+        return -1;
+    }
+    if ((err = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO)) != 0 ||
+        (err = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO)) != 0 ||
+        (err = posix_spawn_file_actions_addclose(&actions, confd)) != 0 ||
+        (err = posix_spawn(&pid, BL_PATH, &actions, NULL, argv, environ)) != 0)
+    {
+        print_err("Could not start server business logic: %s\n", strerror(err));
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ *
+ * \brief Copies the body of a request frame into a file
+ *
+ * \param confd the connected socket
+ * \param in_fd the file, empty
+ * \param len length of the frame body
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+static int recv_request(int confd, int in_fd, uint32_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = recv(confd, io_buf, len < sizeof(io_buf) ? len : sizeof(io_buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            print_err("Reading request frame failed\n");
+            return -1;
+        }
+        for (ssize_t done = 0; done < n;)
+        {
+            ssize_t w = write(in_fd, io_buf + done, n - done);
+            if (w < 0)
+            {
+                print_err("Storing request failed: %s\n", strerror(errno));
+                return -1;
+            }
+            done += w;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Sends the output of the business logic as response frame
+ *
+ * \param confd the connected socket
+ * \param out_fd the output of the business logic
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+static int send_response(int confd, int out_fd)
+{
+    off_t size = lseek(out_fd, 0, SEEK_END);
+    off_t offset = 0;
+    uint32_t len;
+
+    if (size < 0 || size > UINT32_MAX)
+    {
+        print_err("Response does not fit into a frame\n");
+        return -1;
+    }
+    len = htonl((uint32_t)size);
+    if (send(confd, &len, sizeof(len), MSG_NOSIGNAL | MSG_MORE) != sizeof(len))
+    {
+        print_err("Sending frame header failed: %s\n", strerror(errno));
+        return -1;
+    }
+    while (offset < size)
+    {
+        ssize_t n = sendfile(confd, out_fd, &offset, size - offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            print_err("Sending response frame failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Sends the output of the business logic as binary response frame
+ *
+ * Parses the text response once on the server, so the client only reads
+ * fixed-width fields. Names and contents are sent from the output as read
+ * into the thread's buffer or, if larger, as mapped. Output that is no valid
+ * response is answered with PROTO_STATUS_ERROR and no files, only a failed
+ * send ends the session.
+ *
+ * \param confd the connected socket
+ * \param out_fd the output of the business logic
+ * \param version protocol version of the session, from PROTO_VERSION_CRC on
+ *        every file is followed by its checksum
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 the response or the error status was sent
+ * \retval -1 Failure
+ *
+ */
+
+static int send_response_binary(int confd, int out_fd, int version)
+{
+    int crc = version >= PROTO_VERSION_CRC;
+    size_t file_headers = PROTO_BIN_FILE_HEADER + (crc ? PROTO_BIN_FILE_TRAILER : 0);
+    off_t size = lseek(out_fd, 0, SEEK_END);
+    char *text = io_buf;
+    int mapped = 0;
+    const char *pos, *end, *value;
+    size_t value_len, count = 0, capacity = 0;
+    struct text_file *files = NULL;
+    char *headers = NULL;
+    struct iovec *iov = NULL;
+    uint64_t total = PROTO_BIN_HEADER;
+    uint32_t u32;
+    long status;
+    int iovcnt = 0;
+    int result = -1;
+    //cleared once the response itself goes out
+    int unusable = 1;
+
+    if (size < 0)
+    {
+        print_err("Reading business logic output failed: %s\n", strerror(errno));
+        goto out;
+    }
+    //mapping costs more than copying a small response
+    if (size <= KEEPALIVE_BUF_SIZE)
+    {
+        if (pread(out_fd, io_buf, size, 0) != size)
+        {
+            print_err("Reading business logic output failed: %s\n", strerror(errno));
+            goto out;
+        }
+    }
+    else if ((text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, out_fd, 0)) == MAP_FAILED)
+    {
+        print_err("Mapping business logic output failed: %s\n", strerror(errno));
+        goto out;
+    }
+    else
+        mapped = 1;
+    pos = text;
+    end = text + size;
+
+    if (text_line(&pos, end, "status=", &value, &value_len) < 0 ||
+        text_number(value, value_len, &status) < 0 || status < INT32_MIN || status > INT32_MAX)
+    {
+        print_err("Business logic response has no status\n");
+        goto out;
+    }
+    while (pos < end)
+    {
+        struct text_file file;
+        long len;
+
+        if (text_line(&pos, end, "file=", &file.name, &file.name_len) < 0 || file.name_len > UINT16_MAX ||
+            text_line(&pos, end, "len=", &value, &value_len) < 0 ||
+            text_number(value, value_len, &len) < 0 || len < 0 || len > end - pos)
+        {
+            print_err("Malformed business logic response\n");
+            goto out;
+        }
+        file.data = pos;
+        file.len = len;
+        pos += len;
+
+        if (count == capacity)
+        {
+            struct text_file *grown;
+
+            capacity = capacity == 0 ? 4 : capacity * 2;
+            if ((grown = realloc(files, capacity * sizeof(*files))) == NULL)
+            {
+                print_err("Out of memory\n");
+                goto out;
+            }
+            files = grown;
+        }
+        files[count++] = file;
+        total += file_headers + file.name_len + file.len;
+    }
+    if (total > UINT32_MAX)
+    {
+        print_err("Response does not fit into a frame\n");
+        goto out;
+    }
+
+    //frame header and response header first, then header, name, content and checksum per file
+    if ((headers = malloc(PROTO_FRAME_HEADER + PROTO_BIN_HEADER + count * file_headers)) == NULL ||
+        (iov = malloc((1 + 4 * count) * sizeof(*iov))) == NULL)
+    {
+        print_err("Out of memory\n");
+        goto out;
+    }
+    u32 = htonl((uint32_t)total);
+    memcpy(headers, &u32, sizeof(u32));
+    u32 = htonl((uint32_t)(int32_t)status);
+    memcpy(headers + PROTO_FRAME_HEADER, &u32, sizeof(u32));
+    u32 = htonl((uint32_t)count);
+    memcpy(headers + PROTO_FRAME_HEADER + sizeof(u32), &u32, sizeof(u32));
+    iov[iovcnt].iov_base = headers;
+    iov[iovcnt++].iov_len = PROTO_FRAME_HEADER + PROTO_BIN_HEADER;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        char *h = headers + PROTO_FRAME_HEADER + PROTO_BIN_HEADER + i * file_headers;
+        uint16_t name_len = htons((uint16_t)files[i].name_len);
+        uint64_t len = htobe64(files[i].len);
+
+        memcpy(h, &name_len, sizeof(name_len));
+        memcpy(h + sizeof(name_len), &len, sizeof(len));
+        iov[iovcnt].iov_base = h;
+        iov[iovcnt++].iov_len = PROTO_BIN_FILE_HEADER;
+        iov[iovcnt].iov_base = (char *)files[i].name;
+        iov[iovcnt++].iov_len = files[i].name_len;
+        iov[iovcnt].iov_base = (char *)files[i].data;
+        iov[iovcnt++].iov_len = files[i].len;
+        if (crc)
+        {
+            uint32_t sum = htonl(crc32c(files[i].data, files[i].len));
+
+            memcpy(h + PROTO_BIN_FILE_HEADER, &sum, sizeof(sum));
+            iov[iovcnt].iov_base = h + PROTO_BIN_FILE_HEADER;
+            iov[iovcnt++].iov_len = PROTO_BIN_FILE_TRAILER;
+        }
+    }
+    unusable = 0;
+    result = writev_all(confd, iov, iovcnt);
+
+out:
+    free(iov);
+    free(headers);
+    free(files);
+    if (mapped)
+        munmap(text, size);
+    //the request failed, the connection did not
+    if (unusable)
+        result = keepalive_status(confd, version, PROTO_STATUS_ERROR);
+    return result;
+}
+
+/**
+ *
+ * \brief Takes the next "key=value" line of a text response
+ *
+ * The last line may lack its newline.
+ *
+ * \param pos current position, moved behind the line
+ * \param end end of the response
+ * \param key the expected key including the '='
+ * \param value receives the start of the value
+ * \param value_len receives the length of the value
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 no more lines or the key does not match
+ *
+ */
+
+static int text_line(const char **pos, const char *end, const char *key, const char **value, size_t *value_len)
+{
+    size_t key_len = strlen(key);
+    const char *nl, *line_end;
+
+    if (*pos >= end)
+        return -1;
+    nl = memchr(*pos, '\n', end - *pos);
+    line_end = nl != NULL ? nl : end;
+    if ((size_t)(line_end - *pos) < key_len || memcmp(*pos, key, key_len) != 0)
+        return -1;
+
+    *value = *pos + key_len;
+    *value_len = line_end - *value;
+    *pos = nl != NULL ? nl + 1 : end;
+    return 0;
+}
+
+/**
+ *
+ * \brief Converts the number of a text response line
+ *
+ * \param value the value, not terminated
+ * \param value_len length of the value
+ * \param number receives the number
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 no valid number
+ *
+ */
+
+static int text_number(const char *value, size_t value_len, long *number)
+{
+    char buf[KEEPALIVE_NUMBER_MAX];
+    char *num_end;
+
+    if (value_len >= sizeof(buf))
+        return -1;
+    memcpy(buf, value, value_len);
+    buf[value_len] = '\0';
+
+    errno = 0;
+    *number = strtol(buf, &num_end, 10);
+    return num_end == buf || errno == ERANGE ? -1 : 0;
+}
+
+/**
+ *
+ * \brief Writes all buffers, continuing after partial writes
+ *
+ * \param fd the connected socket
+ * \param iov the buffers, modified
+ * \param iovcnt number of buffers
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            print_err("Sending response frame failed: %s\n", strerror(errno));
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Reads exactly len bytes unless the connection ends
+ *
+ * \param fd the connected socket
+ * \param buf receives the data
+ * \param len number of bytes
+ *
+ * \return the number of bytes read, less than len at end of file, or -1 on error
+ *
+ */
+
+static ssize_t recv_all(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = recv(fd, (char *)buf + done, len - done, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * =================================================================== eof ==
+ */
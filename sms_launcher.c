@@ -0,0 +1,238 @@
+/**
+ * @file sms_launcher.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - launcher process of the event loop backends
+ *
+ * The epoll and io_uring loops never fork. Before they start, the server forks
+ * one small launcher process and talks to it over a unix socketpair. For every
+ * accepted connection the loop creates the socketpair the business logic will
+ * be relayed over, passes the business logic end (and the client socket, for
+ * its peer address) to the launcher with SCM_RIGHTS and goes on relaying; a
+ * request arriving meanwhile waits in the socket buffer. The launcher starts
+ * the business logic on its end in the selected launch mode, exactly like the
+ * blocking core does with an accepted socket: warm pool, admission control,
+ * reaping and the child table of the metrics all live in the launcher.
+ *
+ * The launcher stays as small as it was at startup, so its forks stay cheap,
+ * and however long they take, the loop keeps accepting and relaying. A full
+ * channel fails the connection instead of blocking the loop.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "simple_message_server.h"
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+//loop end of the channel to the launcher, -1 in the launcher itself
+static int slauncher_fd = -1;
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+/**
+ *
+ * \brief Forks the launcher process
+ *
+ * In the launcher the listening socket is closed and replaced by the launcher
+ * end of the channel: the caller prepares the launch mode and serves that end
+ * with launcher_accept() instead of accept().
+ *
+ * \param sockfd the listening socket, replaced by the channel in the launcher
+ *
+ * \return which process returns or failure
+ * \retval 0 the event loop process, relay with launcher_submit()
+ * \retval 1 the launcher
+ * \retval -1 Failure
+ *
+ */
+
+int launcher_fork(int *sockfd)
+{
+    int sv[2];
+    pid_t pid;
+
+    //datagrams keep every pair of descriptors apart
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        print_err("socketpair for launcher failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+    {
+        print_err("Forking launcher failed: %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        close(sv[0]);
+        close(*sockfd);
+        *sockfd = sv[1];
+        return 1;
+    }
+
+    close(sv[1]);
+    if (set_nonblocking(sv[0]) < 0)
+    {
+        close(sv[0]);
+        return -1;
+    }
+    slauncher_fd = sv[0];
+    return 0;
+}
+
+/**
+ *
+ * \brief Has the business logic started for a connection, never blocks
+ *
+ * Called by the event loops. The connection is only handed to the launcher,
+ * the business logic may start after this returned.
+ *
+ * \param client_fd the accepted connection, still owned by the caller
+ *
+ * \return the end of the socketpair to relay to or failure
+ * \retval -1 the connection could not be handed over
+ *
+ */
+
+int launcher_submit(int client_fd)
+{
+    uint64_t accepted_ns = metrics_accept_time();
+    struct iovec iov = {.iov_base = &accepted_ns, .iov_len = sizeof(accepted_ns)};
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } ctrl;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int sv[2], fds[2];
+
+    //both ends close-on-exec, dup2() in the business logic clears the flag on stdin/stdout
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        print_err("socketpair for relay failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    fds[0] = sv[1];
+    fds[1] = client_fd;
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(slauncher_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(accepted_ns))
+    {
+        int err = errno;
+
+        close(sv[0]);
+        close(sv[1]);
+        if (err == EAGAIN || err == EWOULDBLOCK)
+        {
+            print_err("Launcher busy, connection dropped\n");
+            return -1;
+        }
+        //nothing could be served any more, the supervisor (-w) starts a new acceptor
+        print_err("Launcher gone: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    close(sv[1]);
+    return sv[0];
+}
+
+/**
+ *
+ * \brief Receives the next connection in the launcher and starts its business logic
+ *
+ * The counterpart of create_new_child() for the launcher, with the channel in
+ * place of the listening socket.
+ *
+ * \param chan the launcher end of the channel
+ * \param opts the parsed command line options
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 business logic started, queued or the message was unusable
+ * \retval -1 the event loop is gone or the business logic could not be started
+ *
+ */
+
+int launcher_accept(int chan, const struct server_options *opts)
+{
+    uint64_t accepted_ns = 0;
+    struct iovec iov = {.iov_base = &accepted_ns, .iov_len = sizeof(accepted_ns)};
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } ctrl;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+    int fds[2];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    while ((n = recvmsg(chan, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0)
+        return -1;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        print_err("Launcher received no connection\n");
+        return 0;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    //the client socket only tells the metrics who is served, the event loop keeps it
+    metrics_relayed(fds[1], accepted_ns);
+    close(fds[1]);
+    if (admission_admit(fds[0]) != ADMIT_NOW)
+        return 0;
+
+    return launch_business_logic(chan, fds[0], opts);
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,956 @@
+/**
+ * @file sms_metrics.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - metrics in shared memory and the stats socket
+ *
+ * Counters and latency histograms live in one anonymous shared mapping that is
+ * created before any process is forked, so SO_REUSEPORT acceptors, warm pool
+ * workers and forked children (until they exec) all update the same numbers.
+ * Every update is a single relaxed atomic add, no process ever takes a lock.
+ *
+ * Each accepting process remembers the accept time and the peer address of
+ * its children by pid. The SIGCHLD handler, or the server core with -R
+ * signalfd, reaps them with wait4(), looks the pid up and records lifetime,
+ * CPU time, peak memory, context switches and exit status of the request, in
+ * the histograms and with -a as one line of the resource log:
+ *
+ *     pid=<n> peer=<address>:<port> wall_s=<s> user_s=<s> sys_s=<s> maxrss_kb=<n> nvcsw=<n> nivcsw=<n> exit=<status>|signal=<n>
+ *
+ * The line is formatted without stdio, the handler may interrupt it, and
+ * written with a single write() to the O_APPEND log, so the lines of several
+ * acceptors never mix. SIGCHLD is blocked from the start of a launch until the
+ * new pid is in the table, so a child that exits at once is never reaped before
+ * it is known.
+ *
+ * The same table is the set of connections being served, admission control
+ * (see sms_admission.c) limits its size with metrics_children().
+ *
+ * A thread of the process that called metrics_init() serves a unix socket and
+ * answers every connection with the metrics in the Prometheus text format, a
+ * plain HTTP GET (e.g. curl --unix-socket) gets an HTTP response around them.
+ * Without -s, -a and -C nothing is measured.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "simple_message_server.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//histogram buckets end at 2^k units (microseconds, KiB, ...), the last one is +Inf
+#define METRICS_BUCKETS 28
+//longest peer address, "[IPv6]:port"
+#define METRICS_PEER_MAX (INET6_ADDRSTRLEN + 8)
+//longest line of the resource log
+#define METRICS_LOG_LINE 256
+//children per accepting process whose accept time is remembered
+#define METRICS_CHILD_SLOTS 16384
+//how long the stats socket waits for an HTTP request line before it answers anyway
+#define METRICS_REQUEST_TIMEOUT_MS 100
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//distribution of a value in units of the histogram, bucket counts are not cumulative
+struct metrics_histogram
+{
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+};
+
+//the shared segment
+struct metrics_shared
+{
+    uint64_t started_ns;       //metrics_init(), for the uptime
+    uint64_t accepted;
+    uint64_t accept_errors;
+    uint64_t launch_failures;
+    uint64_t children_started; //business logic processes, idle pool workers included
+    uint64_t children_reaped;
+    uint64_t exits_success;   //children of connections by exit status
+    uint64_t exits_failure;
+    uint64_t exits_signal;
+    uint64_t serving;         //children of connections alive, of all acceptors
+    uint64_t queued;          //connections waiting for admission, of all acceptors
+    uint64_t shed;            //connections turned away busy
+    //times in microseconds
+    struct metrics_histogram launch;    //starting the business logic, in the accepting process
+    struct metrics_histogram exec;      //accept until the business logic is exec'd, in the child
+    struct metrics_histogram lifetime;  //accept until the child is reaped
+    struct metrics_histogram queue_wait; //accept until admission, queued connections only
+    struct metrics_histogram cpu_user;
+    struct metrics_histogram cpu_sys;
+    struct metrics_histogram max_rss;   //KiB
+    struct metrics_histogram switches;  //voluntary and involuntary context switches
+};
+
+//a child of this process serving a connection
+struct child_info
+{
+    pid_t pid; //0 = free slot
+    uint64_t accepted_ns;
+    char peer[METRICS_PEER_MAX];
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+//NULL while metrics are off
+static struct metrics_shared *smetrics;
+
+//accept time of the connection being launched, inherited by forked children
+static uint64_t saccepted_ns;
+//peer of the connection being launched, only with the resource log
+static char saccepted_peer[METRICS_PEER_MAX];
+
+//resource log, -1 = none
+static int slog_fd = -1;
+
+//signal mask before metrics_launch_begin(), restored in the child
+static sigset_t slaunch_mask;
+static int slaunch_blocked;
+
+//children in schildren
+static long schildren_count;
+//open addressing with linear probing, only touched with SIGCHLD blocked or in its handler,
+//with REAP_SIGNALFD it is blocked for good
+static struct child_info schildren[METRICS_CHILD_SLOTS];
+
+static int sstats_fd = -1;
+static pthread_t sstats_thread;
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void hist_add(struct metrics_histogram *h, uint64_t value);
+static uint64_t us(uint64_t ns);
+static uint64_t timeval_us(const struct timeval *tv);
+static void log_request(const struct child_info *child, uint64_t wall_ns, int status, const struct rusage *ru);
+static char *append_str(char *p, char *end, const char *s);
+static char *append_num(char *p, char *end, uint64_t value, int decimals);
+static void remember_peer(int confd);
+static void child_insert(pid_t pid, uint64_t accepted_ns);
+static struct child_info *child_find(pid_t pid);
+static void child_remove(struct child_info *slot);
+static void *stats_main(void *arg);
+static void stats_write(FILE *out);
+static void print_counter(FILE *out, const char *name, const char *help, const char *type, uint64_t value);
+static void print_histogram(FILE *out, const char *name, const char *help, const struct metrics_histogram *h, double unit);
+
+/**
+ *
+ * \brief Creates the shared segment, opens the resource log and starts serving the stats socket
+ *
+ * Must be called before the first process is forked. A stale socket left behind
+ * by an earlier server is replaced.
+ *
+ * \param path path of the unix socket, NULL = none
+ * \param log_path resource log appended to, NULL = none
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+int metrics_init(const char *path, const char *log_path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    sigset_t block, old;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path != NULL && strlen(path) >= sizeof(addr.sun_path))
+    {
+        print_err("Stats socket path \"%s\" is too long\n", path);
+        return -1;
+    }
+    if (log_path != NULL && (slog_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0)
+    {
+        print_err("Could not open resource log \"%s\": %s\n", log_path, strerror(errno));
+        return -1;
+    }
+
+    smetrics = mmap(NULL, sizeof(*smetrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (smetrics == MAP_FAILED)
+    {
+        print_err("mmap() for metrics failed: %s\n", strerror(errno));
+        smetrics = NULL;
+        return -1;
+    }
+    smetrics->started_ns = metrics_now();
+    if (path == NULL)
+        return 0;
+    strcpy(addr.sun_path, path);
+
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    if ((sstats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(sstats_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sstats_fd, LISTEN_BACKLOG) < 0)
+    {
+        print_err("Could not create stats socket \"%s\": %s\n", path, strerror(errno));
+        if (sstats_fd >= 0)
+            close(sstats_fd);
+        munmap(smetrics, sizeof(*smetrics));
+        smetrics = NULL;
+        return -1;
+    }
+
+    //SIGCHLD has to reach the accept loop, not this thread
+    sigfillset(&block);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    if (pthread_create(&sstats_thread, NULL, stats_main, NULL) != 0)
+    {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        print_err("Could not start stats thread\n");
+        close(sstats_fd);
+        munmap(smetrics, sizeof(*smetrics));
+        smetrics = NULL;
+        return -1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return 0;
+}
+
+/**
+ *
+ * \brief Monotonic clock in nanoseconds, comparable across the server processes
+ *
+ * \return current time in nanoseconds
+ *
+ */
+
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ *
+ * \brief Counts an accepted connection and remembers when and from where it was accepted
+ *
+ * \param confd the accepted connection
+ *
+ */
+
+void metrics_accepted(int confd)
+{
+    if (smetrics == NULL)
+        return;
+    saccepted_ns = metrics_now();
+    __atomic_fetch_add(&smetrics->accepted, 1, __ATOMIC_RELAXED);
+    remember_peer(confd);
+}
+
+/**
+ *
+ * \brief Restores accept time and peer of a connection that waited for admission
+ *
+ * \param confd the connection about to be launched
+ * \param accepted_ns its accept time as returned by metrics_accept_time() back then
+ *
+ */
+
+void metrics_dequeued(int confd, uint64_t accepted_ns)
+{
+    if (smetrics == NULL)
+        return;
+    saccepted_ns = accepted_ns;
+    hist_add(&smetrics->queue_wait, us(metrics_now() - accepted_ns));
+    remember_peer(confd);
+}
+
+/**
+ *
+ * \brief Restores accept time and peer of a connection the event loop handed to the launcher
+ *
+ * \param confd the client connection
+ * \param accepted_ns its accept time as returned by metrics_accept_time() in the event loop
+ *
+ */
+
+void metrics_relayed(int confd, uint64_t accepted_ns)
+{
+    if (smetrics == NULL)
+        return;
+    saccepted_ns = accepted_ns;
+    remember_peer(confd);
+}
+
+/**
+ *
+ * \brief Updates the number of connections waiting for admission
+ *
+ * \param delta 1 for a queued connection, -1 for one leaving the queue
+ *
+ */
+
+void metrics_queued(int delta)
+{
+    if (smetrics != NULL)
+        __atomic_fetch_add(&smetrics->queued, (uint64_t)(int64_t)delta, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ * \brief Counts a connection turned away busy
+ *
+ */
+
+void metrics_shed(void)
+{
+    if (smetrics != NULL)
+        __atomic_fetch_add(&smetrics->shed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ * \brief Children of this process serving a connection
+ *
+ * Exact once SIGCHLD is read from a signalfd, a handler may reap concurrently.
+ *
+ * \return number of children, 0 = metrics off
+ *
+ */
+
+long metrics_children(void)
+{
+    return __atomic_load_n(&schildren_count, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ * \brief Counts a failed accept()
+ *
+ */
+
+void metrics_accept_failed(void)
+{
+    if (smetrics != NULL)
+        __atomic_fetch_add(&smetrics->accept_errors, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ * \brief Sets the accept time of the connection a pool worker received
+ *
+ * \param accepted_ns accept time sent along with the connection, 0 = unknown
+ *
+ */
+
+void metrics_set_accepted(uint64_t accepted_ns)
+{
+    saccepted_ns = accepted_ns;
+}
+
+/**
+ *
+ * \brief Accept time of the current connection, sent to pool workers
+ *
+ * \return accept time in nanoseconds, 0 = metrics off
+ *
+ */
+
+uint64_t metrics_accept_time(void)
+{
+    return smetrics != NULL ? saccepted_ns : 0;
+}
+
+/**
+ *
+ * \brief Starts timing the launch of the business logic and blocks SIGCHLD
+ *
+ * Must be followed by metrics_launch_end() in the accepting process and by
+ * metrics_launch_child() in a forked child.
+ *
+ * \return start of the launch, pass it to metrics_launch_end()
+ *
+ */
+
+uint64_t metrics_launch_begin(void)
+{
+    sigset_t block;
+
+    if (smetrics == NULL)
+        return 0;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    slaunch_blocked = pthread_sigmask(SIG_BLOCK, &block, &slaunch_mask) == 0;
+    return metrics_now();
+}
+
+/**
+ *
+ * \brief Records a launch, remembers the child and unblocks SIGCHLD
+ *
+ * \param start result of metrics_launch_begin()
+ * \param pid the process serving the connection, 0 = none (plugin), -1 = launch failed
+ * \param forked non zero if the process was created for the connection
+ *
+ */
+
+void metrics_launch_end(uint64_t start, pid_t pid, int forked)
+{
+    if (smetrics == NULL)
+        return;
+    hist_add(&smetrics->launch, us(metrics_now() - start));
+    if (pid < 0)
+        __atomic_fetch_add(&smetrics->launch_failures, 1, __ATOMIC_RELAXED);
+    if (pid > 0 && forked)
+        __atomic_fetch_add(&smetrics->children_started, 1, __ATOMIC_RELAXED);
+    if (pid > 0)
+        child_insert(pid, saccepted_ns);
+    if (slaunch_blocked)
+        pthread_sigmask(SIG_SETMASK, &slaunch_mask, NULL);
+    slaunch_blocked = 0;
+}
+
+/**
+ *
+ * \brief Restores the signal mask in a child forked during a launch
+ *
+ */
+
+void metrics_launch_child(void)
+{
+    if (slaunch_blocked)
+        pthread_sigmask(SIG_SETMASK, &slaunch_mask, NULL);
+    slaunch_blocked = 0;
+}
+
+/**
+ *
+ * \brief Signal mask a child spawned during a launch has to start with
+ *
+ * \return the mask before metrics_launch_begin() or NULL if nothing was blocked
+ *
+ */
+
+const sigset_t *metrics_launch_mask(void)
+{
+    return slaunch_blocked ? &slaunch_mask : NULL;
+}
+
+/**
+ *
+ * \brief Counts a business logic process forked ahead of any connection (warm pool)
+ *
+ */
+
+void metrics_child_forked(void)
+{
+    if (smetrics != NULL)
+        __atomic_fetch_add(&smetrics->children_started, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ * \brief Records the time from accept to exec, called by the child right before exec
+ *
+ */
+
+void metrics_exec(void)
+{
+    if (smetrics != NULL && saccepted_ns != 0)
+        hist_add(&smetrics->exec, us(metrics_now() - saccepted_ns));
+}
+
+/**
+ *
+ * \brief Counts a reaped child and accounts the request it served. Async-signal-safe
+ *
+ * Children that served no connection, like retired pool workers, are only counted.
+ *
+ * \param pid the reaped child
+ * \param status its status as returned by wait4()
+ * \param ru its resource usage as returned by wait4()
+ *
+ */
+
+void metrics_reaped(pid_t pid, int status, const struct rusage *ru)
+{
+    struct child_info *child;
+    uint64_t wall_ns;
+
+    if (smetrics == NULL)
+        return;
+    __atomic_fetch_add(&smetrics->children_reaped, 1, __ATOMIC_RELAXED);
+    if ((child = child_find(pid)) == NULL)
+        return;
+
+    wall_ns = metrics_now() - child->accepted_ns;
+    hist_add(&smetrics->lifetime, us(wall_ns));
+    hist_add(&smetrics->cpu_user, timeval_us(&ru->ru_utime));
+    hist_add(&smetrics->cpu_sys, timeval_us(&ru->ru_stime));
+    hist_add(&smetrics->max_rss, ru->ru_maxrss);
+    hist_add(&smetrics->switches, ru->ru_nvcsw + ru->ru_nivcsw);
+    if (WIFSIGNALED(status))
+        __atomic_fetch_add(&smetrics->exits_signal, 1, __ATOMIC_RELAXED);
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        __atomic_fetch_add(&smetrics->exits_success, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&smetrics->exits_failure, 1, __ATOMIC_RELAXED);
+    if (slog_fd >= 0)
+        log_request(child, wall_ns, status, ru);
+    child_remove(child);
+}
+
+/**
+ *
+ * \brief Adds a value to a histogram
+ *
+ * \param h the histogram
+ * \param value the value in units of the histogram
+ *
+ */
+
+static void hist_add(struct metrics_histogram *h, uint64_t value)
+{
+    unsigned k = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+
+    if (k >= METRICS_BUCKETS)
+        k = METRICS_BUCKETS - 1;
+    __atomic_fetch_add(&h->buckets[k], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ * \brief Converts nanoseconds to microseconds, rounded up
+ *
+ * \param ns nanoseconds
+ *
+ * \return microseconds
+ *
+ */
+
+static uint64_t us(uint64_t ns)
+{
+    return (ns + 999) / 1000;
+}
+
+/**
+ *
+ * \brief Converts a struct timeval to microseconds
+ *
+ * \param tv the time
+ *
+ * \return microseconds
+ *
+ */
+
+static uint64_t timeval_us(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/**
+ *
+ * \brief Appends the line of a request to the resource log. Async-signal-safe
+ *
+ * \param child the child that served the request
+ * \param wall_ns time from accept until the child was reaped
+ * \param status status of the child
+ * \param ru resource usage of the child
+ *
+ */
+
+static void log_request(const struct child_info *child, uint64_t wall_ns, int status, const struct rusage *ru)
+{
+    char line[METRICS_LOG_LINE];
+    char *end = line + sizeof(line) - 1;
+    char *p = line;
+
+    p = append_str(p, end, "pid=");
+    p = append_num(p, end, child->pid, 0);
+    p = append_str(p, end, " peer=");
+    p = append_str(p, end, child->peer);
+    p = append_str(p, end, " wall_s=");
+    p = append_num(p, end, us(wall_ns), 6);
+    p = append_str(p, end, " user_s=");
+    p = append_num(p, end, timeval_us(&ru->ru_utime), 6);
+    p = append_str(p, end, " sys_s=");
+    p = append_num(p, end, timeval_us(&ru->ru_stime), 6);
+    p = append_str(p, end, " maxrss_kb=");
+    p = append_num(p, end, ru->ru_maxrss, 0);
+    p = append_str(p, end, " nvcsw=");
+    p = append_num(p, end, ru->ru_nvcsw, 0);
+    p = append_str(p, end, " nivcsw=");
+    p = append_num(p, end, ru->ru_nivcsw, 0);
+    p = append_str(p, end, WIFSIGNALED(status) ? " signal=" : " exit=");
+    p = append_num(p, end, WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status), 0);
+    *p++ = '\n';
+
+    //a short write leaves a torn line, retrying could interleave with another acceptor
+    if (write(slog_fd, line, p - line) < 0)
+        return;
+}
+
+/**
+ *
+ * \brief Appends a string to a buffer. Async-signal-safe
+ *
+ * \param p where to append
+ * \param end end of the buffer, nothing is written there
+ * \param s the string
+ *
+ * \return the new end of the text
+ *
+ */
+
+static char *append_str(char *p, char *end, const char *s)
+{
+    while (*s != '\0' && p < end)
+        *p++ = *s++;
+    return p;
+}
+
+/**
+ *
+ * \brief Appends a number to a buffer. Async-signal-safe
+ *
+ * \param p where to append
+ * \param end end of the buffer, nothing is written there
+ * \param value the number
+ * \param decimals digits of value after the decimal point, e.g. 6 for microseconds as seconds
+ *
+ * \return the new end of the text
+ *
+ */
+
+static char *append_num(char *p, char *end, uint64_t value, int decimals)
+{
+    char digits[24];
+    int n = 0;
+
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0 || n <= decimals);
+
+    while (n > 0 && p < end)
+    {
+        if (n == decimals)
+            *p++ = '.';
+        if (p < end)
+            *p++ = digits[--n];
+    }
+    return p;
+}
+
+/**
+ *
+ * \brief Remembers the peer of the current connection for the resource log
+ *
+ * \param confd the connection
+ *
+ */
+
+static void remember_peer(int confd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char host[INET6_ADDRSTRLEN];
+    in_port_t port;
+
+    //the address is only logged
+    strcpy(saccepted_peer, "-");
+    if (slog_fd < 0 || getpeername(confd, (struct sockaddr *)&addr, &len) < 0)
+        return;
+    if (addr.ss_family == AF_INET6)
+    {
+        port = ((struct sockaddr_in6 *)&addr)->sin6_port;
+        if (inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&addr)->sin6_addr, host, sizeof(host)) != NULL)
+            snprintf(saccepted_peer, sizeof(saccepted_peer), "[%s]:%u", host, ntohs(port));
+    }
+    else if (addr.ss_family == AF_INET)
+    {
+        port = ((struct sockaddr_in *)&addr)->sin_port;
+        if (inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr, host, sizeof(host)) != NULL)
+            snprintf(saccepted_peer, sizeof(saccepted_peer), "%s:%u", host, ntohs(port));
+    }
+}
+
+/**
+ *
+ * \brief Remembers the accept time of a child, dropped if the table is full
+ *
+ * \param pid the child
+ * \param accepted_ns its accept time
+ *
+ */
+
+static void child_insert(pid_t pid, uint64_t accepted_ns)
+{
+    size_t i = (size_t)pid % METRICS_CHILD_SLOTS;
+
+    for (size_t n = 0; n < METRICS_CHILD_SLOTS; n++, i = (i + 1) % METRICS_CHILD_SLOTS)
+    {
+        if (schildren[i].pid == 0 || schildren[i].pid == pid)
+        {
+            if (schildren[i].pid == 0)
+            {
+                __atomic_store_n(&schildren_count, schildren_count + 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&smetrics->serving, 1, __ATOMIC_RELAXED);
+            }
+            schildren[i].accepted_ns = accepted_ns;
+            strcpy(schildren[i].peer, slog_fd >= 0 ? saccepted_peer : "-");
+            schildren[i].pid = pid;
+            return;
+        }
+    }
+}
+
+/**
+ *
+ * \brief Looks up a child
+ *
+ * \param pid the child
+ *
+ * \return its slot or NULL if it is not known
+ *
+ */
+
+static struct child_info *child_find(pid_t pid)
+{
+    size_t i = (size_t)pid % METRICS_CHILD_SLOTS;
+
+    for (size_t n = 0; n < METRICS_CHILD_SLOTS && schildren[i].pid != 0; n++, i = (i + 1) % METRICS_CHILD_SLOTS)
+    {
+        if (schildren[i].pid == pid)
+            return &schildren[i];
+    }
+    return NULL;
+}
+
+/**
+ *
+ * \brief Frees a slot, moving later entries of its probe sequence back
+ *
+ * \param slot the slot
+ *
+ */
+
+static void child_remove(struct child_info *slot)
+{
+    size_t hole = slot - schildren;
+    size_t i = hole;
+
+    while (1)
+    {
+        size_t home;
+
+        i = (i + 1) % METRICS_CHILD_SLOTS;
+        if (schildren[i].pid == 0 || i == hole)
+            break;
+        home = (size_t)schildren[i].pid % METRICS_CHILD_SLOTS;
+        //the entry may fill the hole if its home is not between the hole and itself
+        if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i))
+        {
+            schildren[hole] = schildren[i];
+            hole = i;
+        }
+    }
+    schildren[hole].pid = 0;
+    __atomic_store_n(&schildren_count, schildren_count - 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&smetrics->serving, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ * \brief Main of the stats thread, answers every connection with the metrics
+ *
+ * \param arg unused
+ *
+ * \return never
+ *
+ */
+
+static void *stats_main(void *arg)
+{
+    UNUSED(arg);
+
+    while (1)
+    {
+        char request[512];
+        struct pollfd pfd;
+        ssize_t n = 0;
+        FILE *out;
+        int fd;
+
+        if ((fd = accept4(sstats_fd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+                print_err("Accepting stats client failed: %s\n", strerror(errno));
+            continue;
+        }
+
+        //a scraper speaks HTTP, a plain socket reader sends nothing
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, METRICS_REQUEST_TIMEOUT_MS) > 0)
+            n = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+
+        if ((out = fdopen(fd, "w")) == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        if (n > 4 && strncmp(request, "GET ", 4) == 0)
+            fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+        stats_write(out);
+        fclose(out);
+    }
+    return NULL;
+}
+
+/**
+ *
+ * \brief Writes all metrics in the Prometheus text format
+ *
+ * \param out the stream
+ *
+ */
+
+static void stats_write(FILE *out)
+{
+    uint64_t started = __atomic_load_n(&smetrics->children_started, __ATOMIC_RELAXED);
+    uint64_t reaped = __atomic_load_n(&smetrics->children_reaped, __ATOMIC_RELAXED);
+
+    print_counter(out, "sms_accepted_total", "Connections accepted.", "counter",
+                  __atomic_load_n(&smetrics->accepted, __ATOMIC_RELAXED));
+    print_counter(out, "sms_accept_errors_total", "Failed accept() calls.", "counter",
+                  __atomic_load_n(&smetrics->accept_errors, __ATOMIC_RELAXED));
+    print_counter(out, "sms_launch_failures_total", "Connections the business logic could not be started for.", "counter",
+                  __atomic_load_n(&smetrics->launch_failures, __ATOMIC_RELAXED));
+    print_counter(out, "sms_children_started_total", "Business logic processes started, warm pool workers included.", "counter", started);
+    print_counter(out, "sms_children_reaped_total", "Business logic processes reaped.", "counter", reaped);
+    //a child may be reaped before the process that forked it counted it
+    print_counter(out, "sms_children_live", "Business logic processes alive.", "gauge", started > reaped ? started - reaped : 0);
+    print_counter(out, "sms_connections_serving", "Connections a business logic process is serving.", "gauge",
+                  __atomic_load_n(&smetrics->serving, __ATOMIC_RELAXED));
+    print_counter(out, "sms_connections_queued", "Accepted connections waiting for admission.", "gauge",
+                  __atomic_load_n(&smetrics->queued, __ATOMIC_RELAXED));
+    print_counter(out, "sms_connections_shed_total", "Connections turned away busy with a full admission queue.", "counter",
+                  __atomic_load_n(&smetrics->shed, __ATOMIC_RELAXED));
+    fprintf(out, "# HELP sms_uptime_seconds Seconds since the server started.\n# TYPE sms_uptime_seconds gauge\nsms_uptime_seconds %.3f\n",
+            (metrics_now() - smetrics->started_ns) / 1e9);
+    print_counter(out, "sms_child_exits_success_total", "Children of connections that exited with status 0.", "counter",
+                  __atomic_load_n(&smetrics->exits_success, __ATOMIC_RELAXED));
+    print_counter(out, "sms_child_exits_failure_total", "Children of connections that exited with another status.", "counter",
+                  __atomic_load_n(&smetrics->exits_failure, __ATOMIC_RELAXED));
+    print_counter(out, "sms_child_exits_signal_total", "Children of connections killed by a signal.", "counter",
+                  __atomic_load_n(&smetrics->exits_signal, __ATOMIC_RELAXED));
+    print_histogram(out, "sms_launch_seconds", "Time the accepting process spent starting the business logic (fork, spawn or pool handoff).",
+                    &smetrics->launch, 1e-6);
+    print_histogram(out, "sms_exec_delay_seconds", "Time from accept until a forked child or pool worker executes the business logic.",
+                    &smetrics->exec, 1e-6);
+    print_histogram(out, "sms_child_lifetime_seconds", "Time from accept until the child serving the connection is reaped.",
+                    &smetrics->lifetime, 1e-6);
+    print_histogram(out, "sms_queue_wait_seconds", "Time a queued connection waited for admission.",
+                    &smetrics->queue_wait, 1e-6);
+    print_histogram(out, "sms_child_cpu_user_seconds", "User CPU time of the child serving a connection.",
+                    &smetrics->cpu_user, 1e-6);
+    print_histogram(out, "sms_child_cpu_system_seconds", "System CPU time of the child serving a connection.",
+                    &smetrics->cpu_sys, 1e-6);
+    print_histogram(out, "sms_child_max_rss_bytes", "Peak resident memory of the child serving a connection.",
+                    &smetrics->max_rss, 1024);
+    print_histogram(out, "sms_child_context_switches", "Voluntary and involuntary context switches of the child serving a connection.",
+                    &smetrics->switches, 1);
+}
+
+/**
+ *
+ * \brief Writes a metric with a single value
+ *
+ * \param out the stream
+ * \param name name of the metric
+ * \param help description
+ * \param type "counter" or "gauge"
+ * \param value the value
+ *
+ */
+
+static void print_counter(FILE *out, const char *name, const char *help, const char *type, uint64_t value)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long)value);
+}
+
+/**
+ *
+ * \brief Writes a histogram with cumulative buckets
+ *
+ * The buckets are read one by one while others update them, so count may run a
+ * little ahead of the +Inf bucket; +Inf is printed as count.
+ *
+ * \param out the stream
+ * \param name name of the metric
+ * \param help description
+ * \param h the histogram
+ * \param unit value of one unit of the histogram in the unit of the metric
+ *
+ */
+
+static void print_histogram(FILE *out, const char *name, const char *help, const struct metrics_histogram *h, double unit)
+{
+    uint64_t cumulative = 0;
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (int k = 0; k < METRICS_BUCKETS - 1; k++)
+    {
+        cumulative += __atomic_load_n(&h->buckets[k], __ATOMIC_RELAXED);
+        fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name, (double)(1ULL << k) * unit, (unsigned long long)cumulative);
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)(count > cumulative ? count : cumulative));
+    fprintf(out, "%s_sum %.9g\n%s_count %llu\n", name, __atomic_load_n(&h->sum, __ATOMIC_RELAXED) * unit,
+            name, (unsigned long long)(count > cumulative ? count : cumulative));
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,220 @@
+/**
+ * @file sms_plugin.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - in-process business logic loaded from a shared object
+ *
+ * The accept loop queues connected sockets into a bounded queue, a fixed set of
+ * worker threads takes them out and calls the plugin's handle() entry point.
+ * No process is created per connection. A full queue never blocks the accept
+ * loop, the connection is shed by admission control instead (busy status).
+ * Keep-alive connections stay with their worker thread until the client closes
+ * or sends no request for PLUGIN_KEEPALIVE_IDLE_MS, so idle clients cannot keep
+ * all threads from the queue for long.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "simple_message_server.h"
+#include "simple_message_server_plugin.h"
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void *plugin_worker(void *arg);
+
+/**
+ *
+ * \brief Loads the plugin and starts the worker threads
+ *
+ * \param host the plugin host to initialise
+ * \param path path of the shared object
+ * \param threads number of worker threads
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+int plugin_init(struct plugin_host *host, const char *path, size_t threads)
+{
+    sigset_t block, old;
+
+    memset(host, 0, sizeof(*host));
+
+    if ((host->dl = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+    {
+        print_err("Could not load plugin: %s\n", dlerror());
+        return -1;
+    }
+
+    //ISO C forbids casting void * to a function pointer, copy the bits instead
+    void *sym = dlsym(host->dl, PLUGIN_SYMBOL);
+    if (sym == NULL)
+    {
+        print_err("Plugin does not export %s(): %s\n", PLUGIN_SYMBOL, dlerror());
+        dlclose(host->dl);
+        return -1;
+    }
+    memcpy(&host->handle, &sym, sizeof(host->handle));
+
+    host->capacity = threads * PLUGIN_QUEUE_PER_THREAD;
+    host->queue = malloc(host->capacity * sizeof(*host->queue));
+    host->threads = malloc(threads * sizeof(*host->threads));
+    if (host->queue == NULL || host->threads == NULL)
+    {
+        print_err("malloc() for plugin workers failed\n");
+        free(host->queue);
+        free(host->threads);
+        dlclose(host->dl);
+        return -1;
+    }
+
+    pthread_mutex_init(&host->lock, NULL);
+    pthread_cond_init(&host->not_empty, NULL);
+
+    //signals are handled by the accept loop, workers never see them
+    sigfillset(&block);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (host->nthreads = 0; host->nthreads < threads; host->nthreads++)
+    {
+        if (pthread_create(&host->threads[host->nthreads], NULL, plugin_worker, host) != 0)
+        {
+            print_err("Could not start plugin worker thread\n");
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (host->nthreads == 0)
+    {
+        plugin_destroy(host);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Queues a connection for the worker threads
+ *
+ * Never blocks. The host takes ownership of confd unless the queue is full.
+ *
+ * \param host the plugin host
+ * \param confd the connected socket
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 queued
+ * \retval -1 all workers busy and the queue full, confd still owned by the caller
+ *
+ */
+
+int plugin_submit(struct plugin_host *host, int confd)
+{
+    pthread_mutex_lock(&host->lock);
+    if (host->count == host->capacity)
+    {
+        pthread_mutex_unlock(&host->lock);
+        return -1;
+    }
+    host->queue[(host->head + host->count) % host->capacity] = confd;
+    host->count++;
+    pthread_cond_signal(&host->not_empty);
+    pthread_mutex_unlock(&host->lock);
+    return 0;
+}
+
+/**
+ *
+ * \brief Lets the workers drain the queue, joins them and unloads the plugin
+ *
+ * \param host the plugin host
+ *
+ */
+
+void plugin_destroy(struct plugin_host *host)
+{
+    pthread_mutex_lock(&host->lock);
+    host->stopping = 1;
+    pthread_cond_broadcast(&host->not_empty);
+    pthread_mutex_unlock(&host->lock);
+
+    for (size_t i = 0; i < host->nthreads; i++)
+        pthread_join(host->threads[i], NULL);
+
+    pthread_cond_destroy(&host->not_empty);
+    pthread_mutex_destroy(&host->lock);
+    free(host->threads);
+    free(host->queue);
+    dlclose(host->dl);
+}
+
+/**
+ *
+ * \brief Worker thread. Serves queued connections until the host is stopped
+ *
+ * \param arg the plugin host
+ *
+ * \return always NULL
+ *
+ */
+
+static void *plugin_worker(void *arg)
+{
+    struct plugin_host *host = arg;
+    int confd, version;
+
+    while (1)
+    {
+        pthread_mutex_lock(&host->lock);
+        while (host->count == 0 && !host->stopping)
+            pthread_cond_wait(&host->not_empty, &host->lock);
+        if (host->count == 0)
+        {
+            pthread_mutex_unlock(&host->lock);
+            return NULL;
+        }
+        confd = host->queue[host->head];
+        host->head = (host->head + 1) % host->capacity;
+        host->count--;
+        pthread_mutex_unlock(&host->lock);
+
+        switch (version = keepalive_detect(confd))
+        {
+        case 0:
+            if (host->handle(confd, confd) < 0)
+                print_err("Plugin business logic failed\n");
+            break;
+        case -1:
+            break;
+        default:
+            keepalive_session(confd, version, host->handle);
+            break;
+        }
+        close(confd);
+    }
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,374 @@
+/**
+ * @file sms_pool.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - warm pool of pre-forked business logic workers
+ *
+ * Every worker is forked ahead of time and blocks on its own unix socketpair.
+ * An accepted connection is passed to an idle worker with SCM_RIGHTS, the
+ * worker points stdin and stdout to it and executes the business logic just
+ * like a freshly forked child. The business logic serves exactly one
+ * connection and exits, so the pool is refilled after every handoff - which
+ * happens after the client is already being served.
+ *
+ * The pool only takes the fork off the path of a connection, the exec still
+ * happens per connection: the business logic reads its stdin from the start,
+ * so it cannot be started before the connection it will read is known.
+ *
+ * Refilling forks at most POOL_REFILL_BATCH workers per connection and an
+ * empty pool grows its target by one worker, so a burst costs the accept loop
+ * a bounded number of forks per connection instead of forking up to max
+ * workers at once.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "simple_message_server.h"
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static int pool_spawn(struct worker_pool *pool);
+static void pool_retire(struct worker_pool *pool);
+static void pool_adjust(struct worker_pool *pool, int exhausted);
+static void pool_worker_main(int chan);
+static int send_fd(int chan, int fd, uint64_t accepted_ns);
+static int recv_fd(int chan, uint64_t *accepted_ns);
+
+/**
+ *
+ * \brief Initialises the warm pool and forks the first workers
+ *
+ * \param pool the pool to initialise
+ * \param min idle workers the pool keeps at least
+ * \param max idle workers the pool may grow to under load
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+int pool_init(struct worker_pool *pool, size_t min, size_t max)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->idle = malloc(max * sizeof(*pool->idle));
+    if (pool->idle == NULL)
+    {
+        print_err("malloc() for worker pool failed\n");
+        return -1;
+    }
+    pool->min = min;
+    pool->max = max;
+    pool->target = min;
+    pool->last_exhausted = time(NULL);
+
+    while (pool->idle_count < pool->target)
+    {
+        if (pool_spawn(pool) < 0)
+        {
+            pool_destroy(pool);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Passes an accepted connection to an idle worker
+ *
+ * Pops idle workers until one accepts the connection. Workers that died while idle
+ * are detected by the failing send and dropped. Afterwards the target size is grown
+ * or shrunk; call pool_refill() once the connection is closed in the server.
+ *
+ * \param pool the warm pool
+ * \param confd the connected socket, still owned by the caller
+ *
+ * \return pid of the worker now serving the connection or failure
+ * \retval -1 no idle worker, the caller has to start the business logic itself
+ *
+ */
+
+pid_t pool_handoff(struct worker_pool *pool, int confd)
+{
+    pid_t handed = -1;
+
+    while (handed < 0 && pool->idle_count > 0)
+    {
+        struct pool_worker *w = &pool->idle[--pool->idle_count];
+
+        if (send_fd(w->chan, confd, metrics_accept_time()) == 0)
+            handed = w->pid;
+        close(w->chan);
+    }
+
+    pool_adjust(pool, handed < 0);
+
+    return handed;
+}
+
+/**
+ *
+ * \brief Forks or retires idle workers towards the target size
+ *
+ * Forks at most POOL_REFILL_BATCH workers, the rest follows with the next calls.
+ *
+ * Must not be called while the server holds a connection, new workers would inherit it
+ * and keep it open after the business logic has finished.
+ *
+ * \param pool the warm pool
+ *
+ */
+
+void pool_refill(struct worker_pool *pool)
+{
+    while (pool->idle_count > pool->target)
+        pool_retire(pool);
+    for (int i = 0; i < POOL_REFILL_BATCH && pool->idle_count < pool->target; i++)
+    {
+        if (pool_spawn(pool) < 0)
+            break;
+    }
+}
+
+/**
+ *
+ * \brief Retires all idle workers and frees the pool
+ *
+ * \param pool the warm pool
+ *
+ */
+
+void pool_destroy(struct worker_pool *pool)
+{
+    while (pool->idle_count > 0)
+        pool_retire(pool);
+    free(pool->idle);
+    pool->idle = NULL;
+}
+
+/**
+ *
+ * \brief Grows the pool on exhaustion, shrinks it after a quiet period
+ *
+ * An empty pool grows the target by one worker (up to max). Every POOL_SHRINK_SECONDS without
+ * exhaustion the target decays by one worker towards min.
+ *
+ * \param pool the warm pool
+ * \param exhausted non zero if no idle worker was available
+ *
+ */
+
+static void pool_adjust(struct worker_pool *pool, int exhausted)
+{
+    time_t now = time(NULL);
+
+    if (exhausted)
+    {
+        if (pool->target < pool->max)
+            pool->target++;
+        pool->last_exhausted = now;
+    }
+    else if (pool->target > pool->min && now - pool->last_exhausted >= POOL_SHRINK_SECONDS)
+    {
+        pool->target--;
+        pool->last_exhausted = now;
+    }
+}
+
+/**
+ *
+ * \brief Forks one idle worker and pushes it onto the idle stack
+ *
+ * \param pool the warm pool
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure
+ *
+ */
+
+static int pool_spawn(struct worker_pool *pool)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        print_err("socketpair for pool worker failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if ((pid = fork()) < 0)
+    {
+        print_err("Forking pool worker failed\n");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        close(sv[0]);
+        pool_worker_main(sv[1]);
+    }
+
+    close(sv[1]);
+    metrics_child_forked();
+    pool->idle[pool->idle_count].pid = pid;
+    pool->idle[pool->idle_count].chan = sv[0];
+    pool->idle_count++;
+    return 0;
+}
+
+/**
+ *
+ * \brief Retires the most recently spawned idle worker
+ *
+ * Closing the channel makes the worker's receive return end of file, the worker
+ * exits and is reaped like every other child.
+ *
+ * \param pool the warm pool
+ *
+ */
+
+static void pool_retire(struct worker_pool *pool)
+{
+    close(pool->idle[--pool->idle_count].chan);
+}
+
+/**
+ *
+ * \brief Main of a pool worker. Never returns
+ *
+ * Drops every descriptor inherited from the server, waits for a connection and
+ * executes the business logic on it.
+ *
+ * \param chan worker end of the channel
+ *
+ */
+
+static void pool_worker_main(int chan)
+{
+    uint64_t accepted_ns;
+    int confd;
+
+    //listening socket, sibling channels and relayed connections of the epoll backend
+    close_inherited_fds(chan);
+
+    if ((confd = recv_fd(chan, &accepted_ns)) < 0)
+        _exit(EXIT_SUCCESS); //retired or server gone
+    close(chan);
+    metrics_set_accepted(accepted_ns);
+
+    start_business_logic(confd);
+}
+
+/**
+ *
+ * \brief Sends a file descriptor over a unix socket (SCM_RIGHTS)
+ *
+ * \param chan the unix socket
+ * \param fd the descriptor to pass
+ * \param accepted_ns accept time of the connection, sent as the payload
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure (e.g. peer died)
+ *
+ */
+
+static int send_fd(int chan, int fd, uint64_t accepted_ns)
+{
+    struct iovec iov = {.iov_base = &accepted_ns, .iov_len = sizeof(accepted_ns)};
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return sendmsg(chan, &msg, MSG_NOSIGNAL) == sizeof(accepted_ns) ? 0 : -1;
+}
+
+/**
+ *
+ * \brief Receives a file descriptor from a unix socket (SCM_RIGHTS)
+ *
+ * \param chan the unix socket
+ * \param accepted_ns receives the accept time sent along, 0 if it is missing
+ *
+ * \return the received descriptor or failure
+ * \retval -1 end of file, error or no descriptor attached
+ *
+ */
+
+static int recv_fd(int chan, uint64_t *accepted_ns)
+{
+    struct iovec iov = {.iov_base = accepted_ns, .iov_len = sizeof(*accepted_ns)};
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+    int fd;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    while ((n = recvmsg(chan, &msg, 0)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0)
+        return -1;
+    if (n != sizeof(*accepted_ns))
+        *accepted_ns = 0;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+/*
+ * =================================================================== eof ==
+ */
@@ -0,0 +1,761 @@
+/**
+ * @file sms_uring.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - io_uring backend
+ *
+ * Works like the epoll backend - the business logic gets one end of a unix
+ * socketpair, started by the launcher process, and the loop relays between it
+ * and the client - but every socket
+ * operation is an io_uring request instead of a syscall:
+ *  - one multishot accept delivers all new connections,
+ *  - relay buffers are registered with the ring (READ_FIXED/WRITE_FIXED),
+ *  - forwarding a chunk submits the write linked with the next read, so each
+ *    chunk costs one submission instead of two.
+ * All requests of a loop iteration are submitted by the single io_uring_enter()
+ * that also waits for completions. The ring is set up with raw syscalls, if
+ * the kernel refuses io_uring the server falls back to the epoll backend.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "simple_message_server.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//submission queue entries, the completion queue is twice as large
+#define URING_ENTRIES 4096
+//bytes per relay buffer
+#define URING_BUF_SIZE 16384
+//buffers registered with the ring, two per connection; further connections use plain buffers
+#define URING_FIXED_BUFS 256
+
+//tags stored in the low bits of the user_data of a request
+#define TAG_ACCEPT 0
+#define TAG_READ 1
+#define TAG_WRITE 2
+#define TAG_REAP 3
+#define TAG_MASK 3
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//raw io_uring instance
+struct uring
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail; //local tail, published by uring_enter()
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+struct uring_conn;
+
+//one direction of a relayed connection, at most one read or write chain in flight
+struct uring_dir
+{
+    struct uring_conn *conn;
+    int src;
+    int dst;
+    char *buf;
+    int buf_index; //registered buffer index, -1 = plain buffer
+    size_t off;    //first byte not yet written
+    size_t len;    //bytes in buf
+};
+
+//client connection relayed to the business logic
+struct uring_conn
+{
+    int client_fd;
+    int logic_fd;
+    struct uring_dir up;   //client -> business logic
+    struct uring_dir down; //business logic -> client
+    int inflight;          //requests not yet completed
+    int request_done;      //the client sent end of file
+    int response_done;     //the business logic sent end of file, the client is shut down for writing
+    int finished;          //both sockets shut down, free once inflight drops to 0
+};
+
+//state of the backend
+struct uring_server
+{
+    struct uring ring;
+    int listen_fd;
+    int multishot;
+    char *fixed;      //memory of the registered buffers
+    int *free_bufs;   //stack of unused registered buffer indices
+    int free_count;
+    const struct server_options *opts;
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static int uring_setup(struct uring *ring, unsigned entries);
+static void uring_teardown(struct uring *ring);
+static struct io_uring_sqe *uring_sqe(struct uring *ring);
+static int uring_enter(struct uring *ring, unsigned wait);
+static void register_buffers(struct uring_server *srv);
+static void arm_accept(struct uring_server *srv);
+static void on_accept(struct uring_server *srv, struct io_uring_cqe *cqe);
+static void arm_reap(struct uring_server *srv);
+static void conn_start(struct uring_server *srv, int client_fd);
+static void dir_init(struct uring_server *srv, struct uring_dir *dir, struct uring_conn *conn, int src, int dst);
+static void dir_release(struct uring_server *srv, struct uring_dir *dir);
+static void submit_read(struct uring_server *srv, struct uring_dir *dir, unsigned flags);
+static void submit_write(struct uring_server *srv, struct uring_dir *dir);
+static void on_read(struct uring_server *srv, struct uring_dir *dir, int res);
+static void on_write(struct uring_server *srv, struct uring_dir *dir, int res);
+static void conn_finish(struct uring_conn *conn);
+static void conn_put(struct uring_server *srv, struct uring_conn *conn);
+
+/**
+ *
+ * \brief Runs the io_uring event loop. Returns only on fatal errors
+ *
+ * Falls back to the epoll backend if the kernel does not provide io_uring.
+ *
+ * \param listen_fd the listening socket
+ * \param opts the parsed command line options
+ *
+ * \return Failure
+ * \retval -1 the event loop could not be set up or failed
+ *
+ */
+
+int uring_run(int listen_fd, const struct server_options *opts)
+{
+    struct uring_server srv;
+
+    memset(&srv, 0, sizeof(srv));
+    srv.listen_fd = listen_fd;
+    srv.opts = opts;
+#ifdef IORING_ACCEPT_MULTISHOT
+    srv.multishot = 1;
+#endif
+
+    if (uring_setup(&srv.ring, URING_ENTRIES) < 0)
+    {
+        print_err("io_uring not available (%s), falling back to epoll\n", strerror(errno));
+        return epoll_run(listen_fd, opts);
+    }
+
+    //writes have no MSG_NOSIGNAL, a client leaving early must fail its write, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    register_buffers(&srv);
+    arm_accept(&srv);
+    if (reap_fd() >= 0)
+        arm_reap(&srv);
+
+    while (1)
+    {
+        if (uring_enter(&srv.ring, 1) < 0)
+        {
+            if (errno == EINTR) //SIGCHLD handler
+                continue;
+            print_err("io_uring_enter failed: %s\n", strerror(errno));
+            break;
+        }
+
+        unsigned head = *srv.ring.cq_head;
+        unsigned tail = __atomic_load_n(srv.ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &srv.ring.cqes[head & *srv.ring.cq_mask];
+            struct uring_dir *dir = (struct uring_dir *)(uintptr_t)(cqe->user_data & ~(uint64_t)TAG_MASK);
+
+            switch (cqe->user_data & TAG_MASK)
+            {
+            case TAG_ACCEPT:
+                on_accept(&srv, cqe);
+                break;
+            case TAG_READ:
+                on_read(&srv, dir, cqe->res);
+                break;
+            case TAG_WRITE:
+                on_write(&srv, dir, cqe->res);
+                break;
+            case TAG_REAP: //only the launcher is a child of the event loop
+                reap_children();
+                arm_reap(&srv);
+                break;
+            }
+        }
+        __atomic_store_n(srv.ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    uring_teardown(&srv.ring);
+    free(srv.fixed);
+    free(srv.free_bufs);
+    return -1;
+}
+
+/**
+ *
+ * \brief Creates the ring and maps its queues
+ *
+ * \param ring the ring
+ * \param entries submission queue entries
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure, errno is set
+ *
+ */
+
+static int uring_setup(struct uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    int saved_errno;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    if ((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+        return -1;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else if ((ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto fail;
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    ring->sq_head = (unsigned *)((char *)ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+    return 0;
+
+fail:
+    saved_errno = errno;
+    uring_teardown(ring);
+    errno = saved_errno;
+    return -1;
+}
+
+/**
+ *
+ * \brief Unmaps the queues and closes the ring
+ *
+ * \param ring the ring
+ *
+ */
+
+static void uring_teardown(struct uring *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/**
+ *
+ * \brief Gets a cleared submission queue entry
+ *
+ * Submits the queued entries first if the queue is full.
+ *
+ * \param ring the ring
+ *
+ * \return the entry, never NULL
+ *
+ */
+
+static struct io_uring_sqe *uring_sqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    while (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        uring_enter(ring, 0);
+
+    index = ring->sqe_tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ *
+ * \brief Submits all queued entries and optionally waits for completions
+ *
+ * \param ring the ring
+ * \param wait number of completions to wait for
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 successful
+ * \retval -1 Failure, errno is set
+ *
+ */
+
+static int uring_enter(struct uring *ring, unsigned wait)
+{
+    unsigned pending;
+
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    pending = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (syscall(__NR_io_uring_enter, ring->fd, pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0)
+        return -1;
+    return 0;
+}
+
+/**
+ *
+ * \brief Registers the relay buffers with the ring
+ *
+ * Registered buffers are pinned once instead of on every request. If the kernel
+ * refuses (e.g. RLIMIT_MEMLOCK) all connections use plain buffers.
+ *
+ * \param srv the backend state
+ *
+ */
+
+static void register_buffers(struct uring_server *srv)
+{
+    struct iovec iov[URING_FIXED_BUFS];
+
+    srv->fixed = malloc((size_t)URING_FIXED_BUFS * URING_BUF_SIZE);
+    srv->free_bufs = malloc(URING_FIXED_BUFS * sizeof(*srv->free_bufs));
+    if (srv->fixed == NULL || srv->free_bufs == NULL)
+        goto plain;
+
+    for (int i = 0; i < URING_FIXED_BUFS; i++)
+    {
+        iov[i].iov_base = srv->fixed + (size_t)i * URING_BUF_SIZE;
+        iov[i].iov_len = URING_BUF_SIZE;
+        srv->free_bufs[i] = URING_FIXED_BUFS - 1 - i;
+    }
+    if (syscall(__NR_io_uring_register, srv->ring.fd, IORING_REGISTER_BUFFERS, iov, URING_FIXED_BUFS) < 0)
+    {
+        print_err("Registering io_uring buffers failed (%s), using plain buffers\n", strerror(errno));
+        goto plain;
+    }
+    srv->free_count = URING_FIXED_BUFS;
+    return;
+
+plain:
+    free(srv->fixed);
+    free(srv->free_bufs);
+    srv->fixed = NULL;
+    srv->free_bufs = NULL;
+    srv->free_count = 0;
+}
+
+/**
+ *
+ * \brief Queues the (multishot) accept on the listening socket
+ *
+ * \param srv the backend state
+ *
+ */
+
+static void arm_accept(struct uring_server *srv)
+{
+    struct io_uring_sqe *sqe = uring_sqe(&srv->ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = srv->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+#ifdef IORING_ACCEPT_MULTISHOT
+    if (srv->multishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+#endif
+    sqe->user_data = TAG_ACCEPT;
+}
+
+/**
+ *
+ * \brief Queues a one-shot poll of the SIGCHLD signalfd, with REAP_SIGNALFD
+ *
+ * \param srv the backend state
+ *
+ */
+
+static void arm_reap(struct uring_server *srv)
+{
+    struct io_uring_sqe *sqe = uring_sqe(&srv->ring);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = reap_fd();
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = TAG_REAP;
+}
+
+/**
+ *
+ * \brief Handles an accepted connection and rearms the accept if needed
+ *
+ * \param srv the backend state
+ * \param cqe the completion of the accept
+ *
+ */
+
+static void on_accept(struct uring_server *srv, struct io_uring_cqe *cqe)
+{
+#ifdef IORING_CQE_F_MORE
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+#endif
+    {
+        if (cqe->res == -EINVAL && srv->multishot)
+        {
+            srv->multishot = 0; //kernel older than 5.19
+            arm_accept(srv);
+            return;
+        }
+        arm_accept(srv);
+    }
+
+    if (cqe->res < 0)
+    {
+        if (cqe->res != -EINTR && cqe->res != -EAGAIN)
+        {
+            print_err("Accepting new Client failed\n");
+            metrics_accept_failed();
+        }
+        return;
+    }
+
+    printf("Client accepted\n");
+    metrics_accepted(cqe->res);
+    report_accept_rate(srv->opts->report_interval);
+    conn_start(srv, cqe->res);
+}
+
+/**
+ *
+ * \brief Hands a connection to the launcher and starts the reads of both directions
+ *
+ * \param srv the backend state
+ * \param client_fd the client connection, closed on failure
+ *
+ */
+
+static void conn_start(struct uring_server *srv, int client_fd)
+{
+    struct uring_conn *conn;
+    int logic_fd;
+
+    if ((conn = calloc(1, sizeof(*conn))) == NULL)
+    {
+        print_err("calloc() for relay failed\n");
+        close(client_fd);
+        return;
+    }
+    if ((logic_fd = launcher_submit(client_fd)) < 0)
+    {
+        close(client_fd);
+        free(conn);
+        return;
+    }
+
+    conn->client_fd = client_fd;
+    conn->logic_fd = logic_fd;
+    dir_init(srv, &conn->up, conn, conn->client_fd, logic_fd);
+    dir_init(srv, &conn->down, conn, logic_fd, conn->client_fd);
+    if (conn->up.buf == NULL || conn->down.buf == NULL)
+    {
+        print_err("malloc() for relay buffer failed\n");
+        dir_release(srv, &conn->up);
+        dir_release(srv, &conn->down);
+        close(conn->client_fd);
+        close(logic_fd);
+        free(conn);
+        return;
+    }
+
+    submit_read(srv, &conn->up, 0);
+    submit_read(srv, &conn->down, 0);
+}
+
+/**
+ *
+ * \brief Sets up a direction with a registered buffer if one is free
+ *
+ * \param srv the backend state
+ * \param dir the direction
+ * \param conn the connection it belongs to
+ * \param src the descriptor read from
+ * \param dst the descriptor written to
+ *
+ */
+
+static void dir_init(struct uring_server *srv, struct uring_dir *dir, struct uring_conn *conn, int src, int dst)
+{
+    dir->conn = conn;
+    dir->src = src;
+    dir->dst = dst;
+    if (srv->free_count > 0)
+    {
+        dir->buf_index = srv->free_bufs[--srv->free_count];
+        dir->buf = srv->fixed + (size_t)dir->buf_index * URING_BUF_SIZE;
+    }
+    else
+    {
+        dir->buf_index = -1;
+        dir->buf = malloc(URING_BUF_SIZE);
+    }
+}
+
+/**
+ *
+ * \brief Returns the buffer of a direction
+ *
+ * \param srv the backend state
+ * \param dir the direction
+ *
+ */
+
+static void dir_release(struct uring_server *srv, struct uring_dir *dir)
+{
+    if (dir->buf_index >= 0)
+        srv->free_bufs[srv->free_count++] = dir->buf_index;
+    else
+        free(dir->buf);
+    dir->buf = NULL;
+}
+
+/**
+ *
+ * \brief Queues a read into the (empty) buffer of a direction
+ *
+ * \param srv the backend state
+ * \param dir the direction
+ * \param flags IOSQE_ flags, used to link the read after a write
+ *
+ */
+
+static void submit_read(struct uring_server *srv, struct uring_dir *dir, unsigned flags)
+{
+    struct io_uring_sqe *sqe = uring_sqe(&srv->ring);
+
+    sqe->opcode = dir->buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = dir->src;
+    sqe->addr = (uintptr_t)dir->buf;
+    sqe->len = URING_BUF_SIZE;
+    sqe->buf_index = dir->buf_index >= 0 ? dir->buf_index : 0;
+    sqe->flags = flags;
+    sqe->user_data = (uintptr_t)dir | TAG_READ;
+    dir->conn->inflight++;
+}
+
+/**
+ *
+ * \brief Queues the write of the buffered data, linked with the next read
+ *
+ * The read only starts once the write completed in full, a short write cancels it.
+ *
+ * \param srv the backend state
+ * \param dir the direction
+ *
+ */
+
+static void submit_write(struct uring_server *srv, struct uring_dir *dir)
+{
+    struct io_uring_sqe *sqe = uring_sqe(&srv->ring);
+
+    sqe->opcode = dir->buf_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = dir->dst;
+    sqe->addr = (uintptr_t)(dir->buf + dir->off);
+    sqe->len = dir->len - dir->off;
+    sqe->buf_index = dir->buf_index >= 0 ? dir->buf_index : 0;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (uintptr_t)dir | TAG_WRITE;
+    dir->conn->inflight++;
+
+    submit_read(srv, dir, 0);
+}
+
+/**
+ *
+ * \brief Handles a completed read of a direction
+ *
+ * Data is forwarded; end of file of the request is passed on to the business logic,
+ * end of file of the response finishes the connection.
+ *
+ * \param srv the backend state
+ * \param dir the direction
+ * \param res result of the read
+ *
+ */
+
+static void on_read(struct uring_server *srv, struct uring_dir *dir, int res)
+{
+    struct uring_conn *conn = dir->conn;
+    int is_up = dir == &conn->up;
+
+    if (res == -ECANCELED) //short write, on_write queued a new chain
+    {
+        conn_put(srv, conn);
+        return;
+    }
+
+    if (!conn->finished)
+    {
+        if (res > 0)
+        {
+            dir->off = 0;
+            dir->len = res;
+            submit_write(srv, dir);
+        }
+        else if (is_up && res == 0)
+        {
+            shutdown(conn->logic_fd, SHUT_WR);
+            conn->request_done = 1;
+            if (conn->response_done)
+                conn_finish(conn);
+        }
+        else if (is_up && res < 0)
+            conn_finish(conn); //client gone, nobody to answer
+        else if (conn->request_done)
+            conn_finish(conn); //response complete (or business logic crashed)
+        else
+        {
+            //answered early (e.g. busy), closing now would reset the client before it read the answer
+            shutdown(conn->client_fd, SHUT_WR);
+            conn->response_done = 1;
+        }
+    }
+    conn_put(srv, conn);
+}
+
+/**
+ *
+ * \brief Handles a completed write of a direction
+ *
+ * \param srv the backend state
+ * \param dir the direction
+ * \param res result of the write
+ *
+ */
+
+static void on_write(struct uring_server *srv, struct uring_dir *dir, int res)
+{
+    struct uring_conn *conn = dir->conn;
+
+    if (!conn->finished)
+    {
+        if (res < 0)
+        {
+            //client gone, or the business logic stopped reading: discard the rest of the request
+            if (dir == &conn->down)
+                conn_finish(conn);
+        }
+        else if ((size_t)res < dir->len - dir->off)
+        {
+            dir->off += res;
+            submit_write(srv, dir);
+        }
+    }
+    conn_put(srv, conn);
+}
+
+/**
+ *
+ * \brief Shuts both sockets down so pending reads complete
+ *
+ * \param conn the connection
+ *
+ */
+
+static void conn_finish(struct uring_conn *conn)
+{
+    conn->finished = 1;
+    shutdown(conn->client_fd, SHUT_RDWR);
+    shutdown(conn->logic_fd, SHUT_RDWR);
+}
+
+/**
+ *
+ * \brief Drops one in-flight reference, frees a finished connection after the last one
+ *
+ * \param srv the backend state
+ * \param conn the connection
+ *
+ */
+
+static void conn_put(struct uring_server *srv, struct uring_conn *conn)
+{
+    if (--conn->inflight > 0)
+        return;
+
+    //nothing in flight any more: either finished or both directions stopped on errors
+    close(conn->client_fd);
+    close(conn->logic_fd);
+    dir_release(srv, &conn->up);
+    dir_release(srv, &conn->down);
+    free(conn);
+}
+
+/*
+ * =================================================================== eof ==
+ */
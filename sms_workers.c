@@ -0,0 +1,245 @@
+/**
+ * @file sms_workers.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Server - multi-core SO_REUSEPORT acceptor processes
+ *
+ * The supervisor binds one SO_REUSEPORT listener per worker, so the kernel
+ * spreads incoming connections across them, and forks one acceptor process per
+ * listener. Every acceptor runs the normal server core on its own listener and
+ * may be pinned to a cpu. Dead acceptors are restarted.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "simple_message_server.h"
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static pid_t worker_spawn(size_t index, const int *listeners, size_t count,
+                          const int *cpus, size_t ncpus, const struct server_options *opts);
+static int parse_cpu_list(const char *list, int *cpus, size_t max);
+
+/**
+ *
+ * \brief Starts the acceptor workers and restarts them when they die
+ *
+ * Returns only if an acceptor dies right after its start, restarting it would
+ * just spin, or if one can not be forked. The remaining acceptors are terminated
+ * and all listeners closed then.
+ *
+ * \param opts the parsed command line options
+ *
+ * \return Failure
+ * \retval -1 the workers could not be started or kept running
+ *
+ */
+
+int workers_run(const struct server_options *opts)
+{
+    size_t count = opts->workers;
+    int *listeners = malloc(count * sizeof(*listeners));
+    pid_t *pids = malloc(count * sizeof(*pids));
+    time_t *started = malloc(count * sizeof(*started));
+    int cpus[CPU_SETSIZE];
+    int ncpus = 0;
+    pid_t pid;
+    size_t i;
+    int failed = 0;
+
+    if (listeners == NULL || pids == NULL || started == NULL)
+    {
+        print_err("malloc() for acceptor workers failed\n");
+        free(listeners);
+        free(pids);
+        free(started);
+        return -1;
+    }
+
+    if (opts->cpu_list != NULL && (ncpus = parse_cpu_list(opts->cpu_list, cpus, CPU_SETSIZE)) < 0)
+    {
+        print_err("Invalid cpu list \"%s\"\n", opts->cpu_list);
+        free(listeners);
+        free(pids);
+        free(started);
+        return -1;
+    }
+
+    //bind all listeners up front, a busy port is reported once and not by every worker
+    for (i = 0; i < count; i++)
+        listeners[i] = create_socket(opts->port, opts->backlog, true);
+
+    //a listener nobody accepts on would still get its share of the connections
+    for (i = 0; i < count; i++)
+        pids[i] = -1;
+    for (i = 0; i < count && !failed; i++)
+    {
+        failed = (pids[i] = worker_spawn(i, listeners, count, cpus, ncpus, opts)) < 0;
+        started[i] = time(NULL);
+    }
+
+    while (!failed)
+    {
+        if ((pid = wait(NULL)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < count && pids[i] != pid; i++)
+            ;
+        if (i == count)
+            continue;
+
+        if (time(NULL) - started[i] < WORKER_MIN_LIFETIME)
+        {
+            print_err("Acceptor %zu exited right after its start, giving up\n", i);
+            pids[i] = -1;
+            break;
+        }
+
+        print_err("Acceptor %zu died, restarting\n", i);
+        if ((pids[i] = worker_spawn(i, listeners, count, cpus, ncpus, opts)) < 0)
+            break;
+        started[i] = time(NULL);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (pids[i] > 0)
+            kill(pids[i], SIGTERM);
+        close(listeners[i]);
+    }
+    free(listeners);
+    free(pids);
+    free(started);
+    return -1;
+}
+
+/**
+ *
+ * \brief Forks one acceptor. The child never returns
+ *
+ * The acceptor keeps only its own listener, pins itself to its cpu and serves
+ * connections. It terminates together with the supervisor.
+ *
+ * \param index number of the acceptor
+ * \param listeners the listeners of all acceptors
+ * \param count number of acceptors
+ * \param cpus cpus to pin to, acceptor index uses cpus[index % ncpus]
+ * \param ncpus number of cpus, 0 = no pinning
+ * \param opts the parsed command line options
+ *
+ * \return pid of the acceptor or -1 if it could not be forked
+ *
+ */
+
+static pid_t worker_spawn(size_t index, const int *listeners, size_t count,
+                          const int *cpus, size_t ncpus, const struct server_options *opts)
+{
+    pid_t pid;
+    cpu_set_t set;
+
+    if ((pid = fork()) < 0)
+    {
+        print_err("Forking acceptor %zu failed\n", index);
+        return -1;
+    }
+    if (pid > 0)
+        return pid;
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i != index)
+            close(listeners[i]);
+    }
+
+    if (ncpus > 0)
+    {
+        CPU_ZERO(&set);
+        CPU_SET(cpus[index % ncpus], &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            print_err("Pinning acceptor %zu to cpu %d failed: %s\n", index, cpus[index % ncpus], strerror(errno));
+    }
+
+    exit(serve(listeners[index], opts));
+}
+
+/**
+ *
+ * \brief Parses a cpu list like "0-3,6"
+ *
+ * \param list the cpu list
+ * \param cpus array receiving the cpus in list order
+ * \param max size of cpus
+ *
+ * \return number of cpus or failure
+ * \retval -1 invalid list
+ *
+ */
+
+static int parse_cpu_list(const char *list, int *cpus, size_t max)
+{
+    size_t n = 0;
+    const char *p = list;
+    char *end;
+    long first, last;
+
+    while (*p != '\0')
+    {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return -1;
+        last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(++p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return -1;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            if (n == max)
+                return -1;
+            cpus[n++] = cpu;
+        }
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            return -1;
+    }
+    return n > 0 ? (int)n : -1;
+}
+
+/*
+ * =================================================================== eof ==
+ */
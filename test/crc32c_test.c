@@ -0,0 +1,197 @@
+/**
+ * @file crc32c_test.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Test - CRC-32C against known checksums, SSE4.2 against slice-by-8
+ *
+ * Includes crc32c.c itself to reach both implementations, whichever one the
+ * CPU selected at startup. Checks the check values of RFC 3720 (B.4) with
+ * both implementations and the public entry points, then cross-checks the
+ * SSE4.2 instruction against slice-by-8 for all lengths up to CROSS_MAX at
+ * every alignment of an 8 byte word, also computed in two parts. The SSE4.2
+ * part is skipped on CPUs without it. Exits with EXIT_FAILURE on the first
+ * mismatch.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "crc32c.c"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+//longest input cross-checked, covers the tail loops and many whole words
+#define CROSS_MAX 1024
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//a CRC-32C implementation under test
+struct impl
+{
+    const char *name;
+    uint32_t (*update)(uint32_t crc, const unsigned char *p, size_t len);
+};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static int check_vectors(const struct impl *impl);
+static int check_cross(const struct impl *a, const struct impl *b);
+
+/**
+ *
+ * \brief Main Program logic
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS every checksum matched
+ * \retval EXIT_FAILURE a checksum differed
+ *
+ */
+
+int main(void)
+{
+    const struct impl sw = {"slice-by-8", crc32c_sw};
+
+    if (check_vectors(&sw) < 0)
+        return EXIT_FAILURE;
+
+    //the entry points with the implementation selected at startup
+    if (crc32c("123456789", 9) != 0xe3069283 ||
+        crc32c_final(crc32c_update(crc32c_update(CRC32C_INIT, "1234", 4), "56789", 5)) != 0xe3069283)
+    {
+        printf("FAIL crc32c() with %s\n", crc32c_impl());
+        return EXIT_FAILURE;
+    }
+    printf("ok   crc32c() with %s\n", crc32c_impl());
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        const struct impl sse42 = {"sse4.2", crc32c_sse42};
+
+        if (check_vectors(&sse42) < 0 || check_cross(&sse42, &sw) < 0)
+            return EXIT_FAILURE;
+    }
+    else
+        printf("skip sse4.2 not supported by this CPU\n");
+#endif
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ * \brief Checks an implementation against the check values of RFC 3720
+ *
+ * \param impl the implementation
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 all values matched
+ * \retval -1 a value differed
+ *
+ */
+
+static int check_vectors(const struct impl *impl)
+{
+    unsigned char zeros[32], ones[32], up[32], down[32];
+    const struct
+    {
+        const char *name;
+        const void *data;
+        size_t len;
+        uint32_t crc;
+    } vectors[] = {
+        {"empty", "", 0, 0x00000000},
+        {"123456789", "123456789", 9, 0xe3069283},
+        {"32 zeros", zeros, sizeof(zeros), 0x8a9136aa},
+        {"32 ones", ones, sizeof(ones), 0x62a8ab43},
+        {"32 ascending", up, sizeof(up), 0x46dd794e},
+        {"32 descending", down, sizeof(down), 0x113fdb5c},
+    };
+
+    for (size_t i = 0; i < sizeof(zeros); i++)
+    {
+        zeros[i] = 0;
+        ones[i] = 0xff;
+        up[i] = i;
+        down[i] = sizeof(down) - 1 - i;
+    }
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        uint32_t crc = crc32c_final(impl->update(CRC32C_INIT, vectors[i].data, vectors[i].len));
+
+        if (crc != vectors[i].crc)
+        {
+            printf("FAIL %s %s: got %08x, expected %08x\n", impl->name, vectors[i].name, (unsigned)crc,
+                   (unsigned)vectors[i].crc);
+            return -1;
+        }
+        printf("ok   %s %s\n", impl->name, vectors[i].name);
+    }
+    return 0;
+}
+
+/**
+ *
+ * \brief Cross-checks two implementations on pseudo random input
+ *
+ * \param a the implementation under test
+ * \param b the reference
+ *
+ * \return SUCCESS OR Failure
+ * \retval 0 all checksums matched
+ * \retval -1 a checksum differed
+ *
+ */
+
+static int check_cross(const struct impl *a, const struct impl *b)
+{
+    static unsigned char buf[CROSS_MAX + 8];
+    uint32_t seed = 1;
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+
+    for (size_t align = 0; align < 8; align++)
+    {
+        for (size_t len = 0; len <= CROSS_MAX; len++)
+        {
+            const unsigned char *p = buf + align;
+            uint32_t want = b->update(CRC32C_INIT, p, len);
+            uint32_t whole = a->update(CRC32C_INIT, p, len);
+            uint32_t parts = a->update(a->update(CRC32C_INIT, p, len / 3), p + len / 3, len - len / 3);
+
+            if (whole != want || parts != want)
+            {
+                printf("FAIL %s against %s: length %zu at offset %zu\n", a->name, b->name, len, align);
+                return -1;
+            }
+        }
+    }
+    printf("ok   %s against %s, lengths 0 to %d at 8 offsets\n", a->name, b->name, CROSS_MAX);
+    return 0;
+}
+
+/*
+ * =================================================================== eof ==
+ */
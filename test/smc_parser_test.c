@@ -0,0 +1,215 @@
+/**
+ * @file smc_parser_test.c
+ * Verteilte Systeme
+ * TCP/IP Uebung
+ *
+ * Test - response parser of libsmc against known responses
+ *
+ * Every vector is fed to smc_parse() in fragments of 1, 2, 3, 7 bytes and in
+ * one piece, so every split of a header line, binary field and checksum is
+ * exercised. The events are written down as a transcript, e.g.
+ *
+ *     status=0 file=out.html:5 hello end .
+ *
+ * and compared with the expected one. Prints one line per vector and split,
+ * exits with EXIT_FAILURE if any transcript differs.
+ *
+ * @author Juergen Schoener <ic16b049@technikum-wien.at>
+ * @author Juergen Spandl <ic16b029@technikum-wien.at>
+ * @date 2016/12/14
+ *
+ * @version 1
+ *
+ */
+
+/*
+ * -------------------------------------------------------------- includes --
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libsmc.h"
+#include "simple_message_protocol.h"
+
+/*
+ * --------------------------------------------------------------- defines --
+ */
+
+#define TRANSCRIPT_MAX 512
+//a vector from a string literal that may contain NUL bytes
+#define VECTOR(name, version, data, expected) {name, version, data, sizeof(data) - 1, expected}
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+//a response and what the parser has to report for it
+struct vector
+{
+    const char *name;
+    int version;
+    const char *data;
+    size_t len;
+    const char *expected;
+};
+
+/*
+ * --------------------------------------------------------------- globals --
+ */
+
+static const struct vector vectors[] = {
+    VECTOR("text", PROTO_VERSION_TEXT, "status=0\nfile=out.html\nlen=5\nhello", "status=0 file=out.html:5 hello end ."),
+    VECTOR("text-two-files", PROTO_VERSION_TEXT, "status=0\nfile=a\nlen=2\nhifile=b\nlen=0\n",
+           "status=0 file=a:2 hi end file=b:0 end ."),
+    VECTOR("text-status-only", PROTO_VERSION_TEXT, "status=3", "status=3 ."),
+    VECTOR("text-no-status", PROTO_VERSION_TEXT, "garbage\n", "error"),
+    VECTOR("text-truncated", PROTO_VERSION_TEXT, "status=0\nfile=a\nlen=5\nhi", "status=0 file=a:5 hi error"),
+    VECTOR("text-empty", PROTO_VERSION_TEXT, "", "error"),
+    VECTOR("binary", PROTO_VERSION_BINARY,
+           "\0\0\0\0" "\0\0\0\1" "\0\1" "\0\0\0\0\0\0\0\3" "a" "xyz", "status=0 file=a:3 xyz end ."),
+    VECTOR("binary-busy", PROTO_VERSION_BINARY, "\0\0\x01\xf7" "\0\0\0\0", "status=503 ."),
+    VECTOR("binary-negative", PROTO_VERSION_BINARY, "\xff\xff\xff\xff" "\0\0\0\0", "status=-1 ."),
+    VECTOR("binary-trailing", PROTO_VERSION_BINARY, "\0\0\0\0" "\0\0\0\0" "x", "status=0 error"),
+    VECTOR("binary-truncated", PROTO_VERSION_BINARY,
+           "\0\0\0\0" "\0\0\0\2" "\0\1" "\0\0\0\0\0\0\0\1" "a" "x", "status=0 file=a:1 x end error"),
+    VECTOR("checksum", PROTO_VERSION_CRC,
+           "\0\0\0\0" "\0\0\0\1" "\0\1" "\0\0\0\0\0\0\0\3" "a" "xyz" "\x25\x23\x68\x85",
+           "status=0 file=a:3 xyz end crc=25236885 ."),
+    VECTOR("checksum-missing", PROTO_VERSION_CRC,
+           "\0\0\0\0" "\0\0\0\1" "\0\1" "\0\0\0\0\0\0\0\3" "a" "xyz" "\x25\x23", "status=0 file=a:3 xyz error"),
+};
+
+static const size_t splits[] = {1, 2, 3, 7, 0};
+
+/*
+ * ------------------------------------------------------------- functions --
+ */
+
+static void transcribe(const struct vector *v, size_t split, char *out, size_t size);
+static int record(const struct smc_event *ev, char *out, size_t size);
+
+/**
+ *
+ * \brief Main Program logic
+ *
+ * \return returns success or error
+ * \retval EXIT_SUCCESS every transcript matched
+ * \retval EXIT_FAILURE at least one transcript differed
+ *
+ */
+
+int main(void)
+{
+    char transcript[TRANSCRIPT_MAX];
+    int state = EXIT_SUCCESS;
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(splits) / sizeof(splits[0]); j++)
+        {
+            transcribe(&vectors[i], splits[j], transcript, sizeof(transcript));
+            if (strcmp(transcript, vectors[i].expected) == 0)
+            {
+                printf("ok   %s split=%zu\n", vectors[i].name, splits[j]);
+                continue;
+            }
+            printf("FAIL %s split=%zu: got \"%s\", expected \"%s\"\n", vectors[i].name, splits[j], transcript,
+                   vectors[i].expected);
+            state = EXIT_FAILURE;
+        }
+    }
+    return state;
+}
+
+/**
+ *
+ * \brief Parses a vector and writes down the events
+ *
+ * \param v the vector
+ * \param split fragment size, 0 = the whole response at once
+ * \param out receives the transcript
+ * \param size size of out
+ *
+ */
+
+static void transcribe(const struct vector *v, size_t split, char *out, size_t size)
+{
+    struct smc_parser p;
+    struct smc_event ev;
+
+    out[0] = '\0';
+    smc_parser_init(&p, v->version);
+
+    for (size_t off = 0, n; off < v->len; off += n)
+    {
+        size_t pos = 0;
+
+        n = split == 0 || split > v->len - off ? v->len - off : split;
+        do
+        {
+            pos += smc_parse(&p, v->data + off + pos, n - pos, &ev);
+            if (record(&ev, out, size))
+                return;
+        } while (ev.type != SMC_EVENT_NEED_MORE);
+    }
+
+    //a pending status line or file end comes first, then the end
+    for (int i = 0; i < 3; i++)
+    {
+        smc_parser_finish(&p, &ev);
+        if (record(&ev, out, size))
+            return;
+    }
+}
+
+/**
+ *
+ * \brief Appends an event to a transcript
+ *
+ * \param ev the event
+ * \param out the transcript
+ * \param size size of out
+ *
+ * \return non zero once the response ended or failed
+ *
+ */
+
+static int record(const struct smc_event *ev, char *out, size_t size)
+{
+    size_t used = strlen(out);
+    //file content is written down as it is, the next word needs a blank
+    const char *sep = used > 0 && out[used - 1] != ' ' ? " " : "";
+
+    switch (ev->type)
+    {
+    case SMC_EVENT_STATUS:
+        snprintf(out + used, size - used, "status=%ld ", ev->status);
+        return 0;
+    case SMC_EVENT_FILE_BEGIN:
+        snprintf(out + used, size - used, "file=%s:%ld ", ev->name, ev->len);
+        return 0;
+    case SMC_EVENT_FILE_DATA:
+        snprintf(out + used, size - used, "%.*s", (int)ev->data_len, ev->data);
+        return 0;
+    case SMC_EVENT_FILE_END:
+        if (ev->has_crc)
+            snprintf(out + used, size - used, "%send crc=%08x ", sep, (unsigned)ev->crc);
+        else
+            snprintf(out + used, size - used, "%send ", sep);
+        return 0;
+    case SMC_EVENT_END:
+        snprintf(out + used, size - used, "%s.", sep);
+        return 1;
+    case SMC_EVENT_ERROR:
+        snprintf(out + used, size - used, "%serror", sep);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * =================================================================== eof ==
+ */